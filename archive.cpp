@@ -0,0 +1,979 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#include "archive.h"
+#include "stats.h"
+#include "spamsum.h"
+#include <algorithm>
+#include <thread>
+
+// Archives are read with pread, which Windows doesn't have
+#ifndef _WIN32
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+// How much of an archive is read at once
+#define ARCHIVE_BUFFER_SIZE  (1 << 16)
+
+// Problems with archives. They're negative, to tell them from errno values.
+#define ARCHIVE_TRUNCATED    -1
+#define ARCHIVE_CORRUPT      -2
+#define ARCHIVE_UNSUPPORTED  -3
+#define ARCHIVE_ENCRYPTED    -4
+#define ARCHIVE_NEED_ZLIB    -5
+
+// A tar archive is made of blocks of this size, each member starting
+// with one as its header
+#define TAR_BLOCK  512
+
+// The most a long name or extended header in a tar archive may take
+#define TAR_EXTENDED_MAX  (1 << 20)
+
+// The records of a zip archive, and where they are
+#define ZIP_LOCAL_SIGNATURE    0x04034b50
+#define ZIP_CENTRAL_SIGNATURE  0x02014b50
+#define ZIP_EOCD_SIGNATURE     0x06054b50
+#define ZIP_EOCD64_SIGNATURE   0x06064b50
+#define ZIP_LOCATOR_SIGNATURE  0x07064b50
+#define ZIP_LOCAL_SIZE    30
+#define ZIP_CENTRAL_SIZE  46
+#define ZIP_EOCD_SIZE     22
+#define ZIP_EOCD64_SIZE   56
+#define ZIP_LOCATOR_SIZE  20
+// The end of central directory record is followed by a comment of at
+// most this length
+#define ZIP_COMMENT_MAX   0xffff
+
+#define ZIP_STORED    0
+#define ZIP_DEFLATED  8
+
+#define ZIP_FLAG_ENCRYPTED  1
+#define ZIP64_EXTRA_ID      1
+
+
+static const char * describe(int error)
+{
+  switch (error)
+  {
+  case ARCHIVE_TRUNCATED:
+    return "Unexpected end of archive";
+  case ARCHIVE_CORRUPT:
+    return "Corrupt archive";
+  case ARCHIVE_UNSUPPORTED:
+    return "Unsupported archive format or compression method";
+  case ARCHIVE_ENCRYPTED:
+    return "Encrypted archive member";
+  case ARCHIVE_NEED_ZLIB:
+    return "Compressed archive members can't be read without zlib";
+  }
+  return strerror(error);
+}
+
+
+static uint32_t get16(const unsigned char * p)
+{
+  return p[0] | (uint32_t)p[1] << 8;
+}
+
+static uint32_t get32(const unsigned char * p)
+{
+  return get16(p) | get16(p + 2) << 16;
+}
+
+static uint64_t get64(const unsigned char * p)
+{
+  return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+
+/// Reads exactly size bytes at offset in fd
+///
+/// @return Returns zero on success, otherwise an error
+static int read_at(int fd, void * buf, size_t size, uint64_t offset)
+{
+  unsigned char * p = (unsigned char *)buf;
+  while (size > 0)
+  {
+    ssize_t n = pread(fd, p, size, (off_t)offset);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+	continue;
+      return errno;
+    }
+    if (0 == n)
+      return ARCHIVE_TRUNCATED;
+    p      += n;
+    size   -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+
+// --------------------------------------------------------------------
+// READING AN ARCHIVE FROM START TO END
+// --------------------------------------------------------------------
+
+class Archive::Input
+{
+ public:
+  Input() : m_pos(0) { }
+  virtual ~Input() { }
+
+  /// Reads size bytes into buf, or fewer if the data ends first. The
+  /// number read is stored in got.
+  ///
+  /// @return Returns zero on success, otherwise an error
+  virtual int read(void * buf, size_t size, size_t * got) = 0;
+
+  /// Skips over the next size bytes
+  ///
+  /// @return Returns zero on success, otherwise an error
+  virtual int skip(uint64_t size) = 0;
+
+  /// Reads exactly size bytes into buf
+  ///
+  /// @return Returns zero on success, otherwise an error
+  int read_fully(void * buf, size_t size)
+  {
+    size_t got;
+    int error = read(buf, size, &got);
+    if (0 == error && got < size)
+      error = ARCHIVE_TRUNCATED;
+    return error;
+  }
+
+  /// Returns how much has been read or skipped
+  uint64_t position(void) const { return m_pos; }
+
+ protected:
+  uint64_t m_pos;
+};
+
+
+/// The part of a file from start to end, which is read without moving
+/// the position of the descriptor, so several threads can share it
+class Archive::FileInput : public Archive::Input
+{
+ public:
+  FileInput(int fd, uint64_t start, uint64_t end) :
+    m_fd(fd),
+    m_end(end)
+  {
+    m_pos = start;
+  }
+
+  int read(void * buf, size_t size, size_t * got)
+  {
+    if (size > m_end - m_pos)
+      size = (size_t)(m_end - m_pos);
+    int error = read_at(m_fd, buf, size, m_pos);
+    if (error)
+      return error;
+    m_pos += size;
+    *got = size;
+    return 0;
+  }
+
+  int skip(uint64_t size)
+  {
+    if (size > m_end - m_pos)
+    {
+      m_pos = m_end;
+      return ARCHIVE_TRUNCATED;
+    }
+    m_pos += size;
+    return 0;
+  }
+
+ private:
+  int      m_fd;
+  uint64_t m_end;
+};
+
+
+#ifdef HAVE_ZLIB
+/// The decompressed contents of gzip or raw deflate data in a file. A
+/// gzip file may be made of several gzip streams one after the other.
+class Archive::InflateInput : public Archive::Input
+{
+ public:
+  InflateInput() : m_ready(false) { }
+
+  ~InflateInput()
+  {
+    if (m_ready)
+      inflateEnd(&m_z);
+  }
+
+  /// Starts decompressing the length bytes at start in fd. They're gzip
+  /// data if gzip is true, otherwise raw deflate data.
+  ///
+  /// @return Returns zero on success, otherwise an error
+  int start(int fd, uint64_t start, uint64_t length, bool gzip)
+  {
+    int bits = (gzip ? 15 + 16 : -15);
+    if (!m_ready)
+    {
+      memset(&m_z, 0, sizeof(m_z));
+      if (inflateInit2(&m_z, bits) != Z_OK)
+	return ENOMEM;
+      m_ready = true;
+    }
+    else if (inflateReset2(&m_z, bits) != Z_OK)
+      return ENOMEM;
+
+    m_fd         = fd;
+    m_next       = start;
+    m_end        = start + length;
+    m_gzip       = gzip;
+    m_between    = false;
+    m_done       = false;
+    m_pos        = 0;
+    m_z.next_in  = m_in;
+    m_z.avail_in = 0;
+    return 0;
+  }
+
+  int read(void * buf, size_t size, size_t * got)
+  {
+    m_z.next_out  = (Bytef *)buf;
+    m_z.avail_out = (uInt)size;
+
+    while (m_z.avail_out > 0 && !m_done)
+    {
+      // Another gzip stream needs two bytes to be recognized
+      if (0 == m_z.avail_in || (m_between && m_z.avail_in < 2))
+      {
+	bool eof;
+	int error = refill(&eof);
+	if (error)
+	  return error;
+	if (eof)
+	{
+	  if (!m_between)
+	    return ARCHIVE_TRUNCATED;
+	  m_done = true;
+	}
+	continue;
+      }
+
+      if (m_between)
+      {
+	// Anything after the last stream is ignored, as gzip does
+	if (m_z.next_in[0] != 0x1f || m_z.next_in[1] != 0x8b)
+	{
+	  m_done = true;
+	  break;
+	}
+	m_between = false;
+      }
+
+      int rc = inflate(&m_z, Z_NO_FLUSH);
+      if (Z_STREAM_END == rc)
+      {
+	if (m_gzip)
+	{
+	  m_between = true;
+	  inflateReset(&m_z);
+	}
+	else
+	  m_done = true;
+      }
+      else if (Z_MEM_ERROR == rc)
+	return ENOMEM;
+      else if (rc != Z_OK)
+	return ARCHIVE_CORRUPT;
+    }
+
+    *got = size - m_z.avail_out;
+    m_pos += *got;
+    return 0;
+  }
+
+  int skip(uint64_t size)
+  {
+    while (size > 0)
+    {
+      size_t want = (size_t)std::min<uint64_t>(size, sizeof(m_scratch));
+      int error = read_fully(m_scratch, want);
+      if (error)
+	return error;
+      size -= want;
+    }
+    return 0;
+  }
+
+ private:
+  InflateInput(const InflateInput&);
+  InflateInput& operator=(const InflateInput&);
+
+  /// Reads more of the file after whatever is left of the input.
+  /// Sets eof if there isn't any more.
+  int refill(bool * eof)
+  {
+    memmove(m_in, m_z.next_in, m_z.avail_in);
+    size_t want = (size_t)std::min<uint64_t>(sizeof(m_in) - m_z.avail_in,
+					     m_end - m_next);
+    *eof = (0 == want);
+
+    int error = read_at(m_fd, m_in + m_z.avail_in, want, m_next);
+    if (error)
+      return error;
+    m_next       += want;
+    m_z.next_in   = m_in;
+    m_z.avail_in += (uInt)want;
+    return 0;
+  }
+
+  z_stream      m_z;
+  bool          m_ready;
+  int           m_fd;
+  /// Where the next input is read from, and where the input ends
+  uint64_t      m_next, m_end;
+  bool          m_gzip;
+  /// True after the end of a gzip stream, until the next one starts
+  bool          m_between;
+  bool          m_done;
+  unsigned char m_in[ARCHIVE_BUFFER_SIZE];
+  unsigned char m_scratch[ARCHIVE_BUFFER_SIZE];
+};
+#endif
+
+
+/// Everything a thread needs to hash members. Each thread keeps one from
+/// one member to the next.
+struct Archive::context_t
+{
+  FuzzyEngine   engine;
+  unsigned char buffer[ARCHIVE_BUFFER_SIZE];
+#ifdef HAVE_ZLIB
+  InflateInput  inflater;
+#endif
+};
+
+
+// --------------------------------------------------------------------
+// TAR ARCHIVES
+// --------------------------------------------------------------------
+
+/// Parses a number in a tar header, which is in octal or, if it's too
+/// large for that, in base 256 with the top bit of the first byte set
+///
+/// @return Returns false on success, true on error
+static bool tar_number(const unsigned char * field, size_t len, uint64_t * result)
+{
+  uint64_t value = 0;
+  size_t i = 0;
+
+  if (field[0] & 0x80)
+  {
+    // Negative numbers have all of the top bits set
+    if (field[0] != 0x80)
+      return true;
+    for (i = 1 ; i < len ; ++i)
+    {
+      if (value >> 56)
+	return true;
+      value = value << 8 | field[i];
+    }
+    *result = value;
+    return false;
+  }
+
+  while (i < len && ' ' == field[i])
+    ++i;
+  for ( ; i < len && field[i] >= '0' && field[i] <= '7' ; ++i)
+  {
+    if (value >> 61)
+      return true;
+    value = value * 8 + (field[i] - '0');
+  }
+  if (i < len && field[i] != ' ' && field[i] != 0)
+    return true;
+
+  *result = value;
+  return false;
+}
+
+
+/// Returns true if header is the header of a member of a tar archive
+static bool tar_valid(const unsigned char * header)
+{
+  // The checksum is the sum of the header with the checksum itself taken
+  // to be spaces. Some old archivers summed signed bytes.
+  uint64_t expected;
+  size_t i = 148;
+  while (i < 155 && ' ' == header[i])
+    ++i;
+  if (header[i] < '0' || header[i] > '7' || tar_number(header + 148, 8, &expected))
+    return false;
+
+  uint64_t sum = 0;
+  int64_t signed_sum = 0;
+  for (i = 0 ; i < TAR_BLOCK ; ++i)
+  {
+    unsigned char c = (i >= 148 && i < 156) ? ' ' : header[i];
+    sum        += c;
+    signed_sum += (signed char)c;
+  }
+  return expected == sum || (int64_t)expected == signed_sum;
+}
+
+
+static std::string tar_string(const unsigned char * field, size_t len)
+{
+  const char * s = (const char *)field;
+  return std::string(s, strnlen(s, len));
+}
+
+
+/// Returns the name of the member whose header is header
+static std::string tar_name(const unsigned char * header)
+{
+  std::string name = tar_string(header, 100);
+
+  // POSIX archives may split the name between the name and a prefix.
+  // GNU archives use the room for the prefix for something else.
+  if (0 == memcmp(header + 257, "ustar", 6))
+  {
+    std::string prefix = tar_string(header + 345, 155);
+    if (!prefix.empty())
+      name = prefix + "/" + name;
+  }
+  return name;
+}
+
+
+/// Takes the path and size out of a pax extended header, whose records
+/// are each "length key=value\n"
+///
+/// @return Returns false on success, true on error
+static bool tar_pax(const std::string& data,
+		    std::string * path,
+		    uint64_t * size,
+		    bool * have_size)
+{
+  size_t pos = 0;
+  while (pos < data.size())
+  {
+    const char * record = data.c_str() + pos;
+    char * end;
+    unsigned long len = strtoul(record, &end, 10);
+    if (end == record || *end != ' ' || 0 == len || len > data.size() - pos ||
+	record[len - 1] != '\n')
+      return true;
+
+    const char * key = end + 1;
+    const char * eq = (const char *)memchr(key, '=', record + len - key);
+    if (NULL == eq)
+      return true;
+
+    std::string value(eq + 1, record + len - 1);
+    if (eq - key == 4 && 0 == memcmp(key, "path", 4))
+      *path = value;
+    else if (eq - key == 4 && 0 == memcmp(key, "size", 4))
+    {
+      errno = 0;
+      *size = strtoull(value.c_str(), &end, 10);
+      if (errno || *end != 0 || value.empty())
+	return true;
+      *have_size = true;
+    }
+
+    pos += len;
+  }
+  return false;
+}
+
+
+int Archive::read_tar(Input& in, context_t * ctx)
+{
+  unsigned char header[TAR_BLOCK];
+  // A long name or pax header applies to the member after it
+  std::string long_name;
+  uint64_t pax_size = 0;
+  bool have_pax_size = false;
+
+  for (;;)
+  {
+    size_t got;
+    int error = in.read(header, TAR_BLOCK, &got);
+    if (error)
+      return error;
+
+    // The archive ends with a block of zeros, but not every archiver
+    // writes it
+    if (0 == got)
+      return 0;
+    if (got < TAR_BLOCK)
+      return ARCHIVE_TRUNCATED;
+    if (0 == header[0] && 0 == memcmp(header, header + 1, TAR_BLOCK - 1))
+      return 0;
+    if (!tar_valid(header))
+      return ARCHIVE_CORRUPT;
+
+    uint64_t size;
+    if (tar_number(header + 124, 12, &size))
+      return ARCHIVE_CORRUPT;
+    char type = header[156];
+
+    if ('L' == type || 'x' == type)
+    {
+      // GNU long names and pax extended headers
+      if (size > TAR_EXTENDED_MAX)
+	return ARCHIVE_CORRUPT;
+      std::string data((size_t)size, 0);
+      if (size > 0 && (error = in.read_fully(&data[0], (size_t)size)))
+	return error;
+
+      if ('L' == type)
+	long_name.assign(data.c_str());
+      else if (tar_pax(data, &long_name, &pax_size, &have_pax_size))
+	return ARCHIVE_CORRUPT;
+    }
+    else
+    {
+      if (have_pax_size)
+	size = pax_size;
+
+      // Regular files. Everything else, such as directories and links,
+      // has no contents of its own.
+      if ('0' == type || 0 == type || '7' == type)
+      {
+	member_t m;
+	m.name        = long_name.empty() ? tar_name(header) : long_name;
+	m.offset      = in.position();
+	m.packed_size = size;
+	m.size        = size;
+	m.method      = 0;
+	m.error       = 0;
+	m.sum[0]      = 0;
+
+	if (ctx != NULL)
+	  error = hash_input(ctx, in, &m);
+	else
+	  error = in.skip(size);
+	if (error)
+	  return error;
+	m_members.push_back(m);
+      }
+      else if ((error = in.skip(size)))
+	return error;
+
+      long_name.clear();
+      have_pax_size = false;
+    }
+
+    if (size % TAR_BLOCK && (error = in.skip(TAR_BLOCK - size % TAR_BLOCK)))
+      return error;
+  }
+}
+
+
+// --------------------------------------------------------------------
+// ZIP ARCHIVES
+// --------------------------------------------------------------------
+
+/// Replaces the sizes and offset which didn't fit into the central
+/// directory entry of a member with the ones in its zip64 extra field
+static void zip64_extra(const unsigned char * extra,
+			size_t len,
+			uint64_t * size,
+			uint64_t * packed_size,
+			uint64_t * offset)
+{
+  size_t pos = 0;
+  while (pos + 4 <= len)
+  {
+    size_t field_len = get16(extra + pos + 2);
+    if (pos + 4 + field_len > len)
+      return;
+
+    if (ZIP64_EXTRA_ID == get16(extra + pos))
+    {
+      const unsigned char * p = extra + pos + 4, * end = p + field_len;
+      uint64_t * values[3] = { size, packed_size, offset };
+      for (size_t i = 0 ; i < 3 ; ++i)
+	if (UINT32_MAX == *values[i] && p + 8 <= end)
+	{
+	  *values[i] = get64(p);
+	  p += 8;
+	}
+      return;
+    }
+    pos += 4 + field_len;
+  }
+}
+
+
+int Archive::read_zip(void)
+{
+  // The end of central directory record is at the end, before the
+  // comment, so it's looked for from the end
+  size_t tail_size = (size_t)std::min<uint64_t>(m_size,
+						 ZIP_EOCD_SIZE + ZIP_COMMENT_MAX);
+  if (tail_size < ZIP_EOCD_SIZE)
+    return ARCHIVE_TRUNCATED;
+  std::vector<unsigned char> tail(tail_size);
+  uint64_t tail_start = m_size - tail_size;
+  int error = read_at(m_fd, &tail[0], tail_size, tail_start);
+  if (error)
+    return error;
+
+  size_t i = tail_size - ZIP_EOCD_SIZE + 1;
+  do
+  {
+    if (0 == i)
+      return ARCHIVE_TRUNCATED;
+    --i;
+  } while (get32(&tail[i]) != ZIP_EOCD_SIGNATURE ||
+	   i + ZIP_EOCD_SIZE + get16(&tail[i + 20]) > tail_size);
+
+  const unsigned char * eocd = &tail[i];
+  uint64_t count     = get16(eocd + 10);
+  uint64_t cd_size   = get32(eocd + 12);
+  uint64_t cd_offset = get32(eocd + 16);
+
+  if (UINT16_MAX == count || UINT32_MAX == cd_size || UINT32_MAX == cd_offset)
+  {
+    // A zip64 archive has another record before this one, and a locator
+    // telling where it is between them
+    unsigned char locator[ZIP_LOCATOR_SIZE], eocd64[ZIP_EOCD64_SIZE];
+    if (tail_start + i < ZIP_LOCATOR_SIZE)
+      return ARCHIVE_CORRUPT;
+    if ((error = read_at(m_fd, locator, sizeof(locator),
+			 tail_start + i - ZIP_LOCATOR_SIZE)))
+      return error;
+    if (get32(locator) != ZIP_LOCATOR_SIGNATURE)
+      return ARCHIVE_CORRUPT;
+    if ((error = read_at(m_fd, eocd64, sizeof(eocd64), get64(locator + 8))))
+      return error;
+    if (get32(eocd64) != ZIP_EOCD64_SIGNATURE)
+      return ARCHIVE_CORRUPT;
+    if (get32(eocd64 + 16) != 0 || get32(eocd64 + 20) != 0)
+      return ARCHIVE_UNSUPPORTED;
+    count     = get64(eocd64 + 32);
+    cd_size   = get64(eocd64 + 40);
+    cd_offset = get64(eocd64 + 48);
+  }
+  else if (get16(eocd + 4) != 0 || get16(eocd + 6) != 0)
+    // Archives split across several files
+    return ARCHIVE_UNSUPPORTED;
+
+  if (cd_offset > m_size || cd_size > m_size - cd_offset ||
+      count > cd_size / ZIP_CENTRAL_SIZE)
+    return ARCHIVE_CORRUPT;
+
+  std::vector<unsigned char> cd((size_t)cd_size + 1);
+  if ((error = read_at(m_fd, &cd[0], (size_t)cd_size, cd_offset)))
+    return error;
+
+  size_t pos = 0;
+  m_members.reserve((size_t)count);
+  for (uint64_t n = 0 ; n < count ; ++n)
+  {
+    if (pos + ZIP_CENTRAL_SIZE > cd_size)
+      return ARCHIVE_CORRUPT;
+    const unsigned char * entry = &cd[pos];
+    size_t name_len = get16(entry + 28), extra_len = get16(entry + 30);
+    size_t entry_len = ZIP_CENTRAL_SIZE + name_len + extra_len +
+      get16(entry + 32);
+    if (get32(entry) != ZIP_CENTRAL_SIGNATURE || pos + entry_len > cd_size)
+      return ARCHIVE_CORRUPT;
+    pos += entry_len;
+
+    // Directories have nothing to hash
+    const char * name = (const char *)entry + ZIP_CENTRAL_SIZE;
+    if (name_len > 0 && '/' == name[name_len - 1])
+      continue;
+
+    member_t m;
+    m.name        = std::string(name, name_len);
+    m.method      = get16(entry + 10);
+    m.packed_size = get32(entry + 20);
+    m.size        = get32(entry + 24);
+    m.offset      = get32(entry + 42);
+    m.error       = (get16(entry + 8) & ZIP_FLAG_ENCRYPTED) ? ARCHIVE_ENCRYPTED : 0;
+    m.sum[0]      = 0;
+    zip64_extra(entry + ZIP_CENTRAL_SIZE + name_len, extra_len,
+		&m.size, &m.packed_size, &m.offset);
+    m_members.push_back(m);
+  }
+
+  return 0;
+}
+
+
+// --------------------------------------------------------------------
+// HASHING THE MEMBERS
+// --------------------------------------------------------------------
+
+int Archive::hash_input(context_t * ctx, Input& in, member_t * m)
+{
+  ctx->engine.reset();
+  if (ctx->engine.set_total_input_length(m->size))
+  {
+    m->error = errno;
+    return in.skip(m->size);
+  }
+
+  uint64_t left = m->size;
+  while (left > 0)
+  {
+    size_t want = (size_t)std::min<uint64_t>(left, sizeof(ctx->buffer));
+    int error = in.read_fully(ctx->buffer, want);
+    if (error)
+      return error;
+    ctx->engine.update(ctx->buffer, want);
+    left -= want;
+  }
+
+  if (ctx->engine.digest(m->sum))
+    m->error = errno;
+  return 0;
+}
+
+
+int Archive::hash_member(context_t * ctx, member_t * m)
+{
+  if (m_type != archive_zip)
+  {
+    FileInput in(m_fd, m->offset, m->offset + m->size);
+    return hash_input(ctx, in, m);
+  }
+
+  // The data is after the local header, whose name and extra field
+  // needn't be the same length as in the central directory
+  unsigned char local[ZIP_LOCAL_SIZE];
+  int error = read_at(m_fd, local, sizeof(local), m->offset);
+  if (error)
+    return error;
+  if (get32(local) != ZIP_LOCAL_SIGNATURE)
+    return ARCHIVE_CORRUPT;
+  uint64_t start = m->offset + ZIP_LOCAL_SIZE + get16(local + 26) +
+    get16(local + 28);
+  if (start > m_size || m->packed_size > m_size - start)
+    return ARCHIVE_TRUNCATED;
+
+  if (ZIP_STORED == m->method)
+  {
+    if (m->packed_size != m->size)
+      return ARCHIVE_CORRUPT;
+    FileInput in(m_fd, start, start + m->size);
+    return hash_input(ctx, in, m);
+  }
+
+  if (ZIP_DEFLATED == m->method)
+  {
+#ifdef HAVE_ZLIB
+    InflateInput& in = ctx->inflater;
+    size_t got;
+    if ((error = in.start(m_fd, start, m->packed_size, false)) ||
+	(error = hash_input(ctx, in, m)) ||
+	(error = in.read(ctx->buffer, 1, &got)))
+      return error;
+
+    // There mustn't be more data than the central directory said
+    return (got > 0 ? ARCHIVE_CORRUPT : 0);
+#else
+    return ARCHIVE_NEED_ZLIB;
+#endif
+  }
+
+  return ARCHIVE_UNSUPPORTED;
+}
+
+
+void Archive::hash_worker(RunStats * stats, std::atomic<size_t>& next)
+{
+  StatsPhase phase(stats, PHASE_HASH);
+  context_t * ctx = new context_t;
+
+  size_t i;
+  while ((i = next++) < m_members.size())
+  {
+    member_t * m = &m_members[i];
+    if (m->error)
+      continue;
+    int error = hash_member(ctx, m);
+    if (error)
+      m->error = error;
+  }
+
+  delete ctx;
+}
+
+
+void Archive::hash_members(RunStats * stats, unsigned int threads)
+{
+  std::atomic<size_t> next(0);
+  if (threads > m_members.size())
+    threads = (unsigned int)m_members.size();
+
+  if (threads <= 1)
+    hash_worker(stats, next);
+  else
+  {
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0 ; i < threads ; ++i)
+      workers.push_back(std::thread(&Archive::hash_worker,
+				    this,
+				    stats,
+				    std::ref(next)));
+    for (unsigned int i = 0 ; i < threads ; ++i)
+      workers[i].join();
+  }
+}
+
+
+// --------------------------------------------------------------------
+// ARCHIVES
+// --------------------------------------------------------------------
+
+Archive::Archive(const TCHAR * fn, int fd, type_t type, uint64_t size) :
+  m_fn(fn),
+  m_fd(fd),
+  m_type(type),
+  m_size(size),
+  m_error(0)
+{
+}
+
+
+Archive::~Archive()
+{
+  close(m_fd);
+}
+
+
+Archive * Archive::open(const TCHAR * fn)
+{
+  int fd = ::_topen(fn, O_RDONLY);
+  _tstat_t sb;
+  if (fd < 0)
+    return NULL;
+  if (_fstat(fd, &sb) || !S_ISREG(sb.st_mode))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  // What the archive is can be told from its start
+  uint64_t size = (uint64_t)sb.st_size;
+  unsigned char header[TAR_BLOCK];
+  size_t got = (size_t)std::min<uint64_t>(size, sizeof(header));
+  if (read_at(fd, header, got, 0))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  if (got >= 4 && (0 == memcmp(header, "PK\3\4", 4) ||
+		   0 == memcmp(header, "PK\5\6", 4)))
+    return new Archive(fn, fd, archive_zip, size);
+
+  if (TAR_BLOCK == got && tar_valid(header))
+    return new Archive(fn, fd, archive_tar, size);
+
+#ifdef HAVE_ZLIB
+  // Only a gzip file with a tar archive in it
+  if (got >= 2 && 0x1f == header[0] && 0x8b == header[1])
+  {
+    InflateInput * in = new InflateInput;
+    bool is_tar = (0 == in->start(fd, 0, size, true) &&
+		   0 == in->read_fully(header, TAR_BLOCK) &&
+		   tar_valid(header));
+    delete in;
+    if (is_tar)
+      return new Archive(fn, fd, archive_tar_gz, size);
+  }
+#endif
+
+  close(fd);
+  return NULL;
+}
+
+
+bool Archive::hash(state *s)
+{
+  switch (m_type)
+  {
+  case archive_tar:
+    {
+      FileInput in(m_fd, 0, m_size);
+      m_error = read_tar(in, NULL);
+      hash_members(s->stats, s->threads);
+    }
+    break;
+
+  case archive_tar_gz:
+#ifdef HAVE_ZLIB
+    {
+      InflateInput * in = new InflateInput;
+      context_t * ctx = new context_t;
+      m_error = in->start(m_fd, 0, m_size, true);
+      if (0 == m_error)
+	m_error = read_tar(*in, ctx);
+      delete ctx;
+      delete in;
+    }
+#endif
+    break;
+
+  case archive_zip:
+    m_error = read_zip();
+    hash_members(s->stats, s->threads);
+    break;
+  }
+
+  // Members are shown under the name the archive would have been
+  std::vector<TCHAR> prefix(m_fn.begin(), m_fn.end());
+  prefix.push_back(0);
+  prepare_filename(s, &prefix[0]);
+
+  bool status = false;
+  std::basic_string<TCHAR> name;
+  for (size_t i = 0 ; i < m_members.size() ; ++i)
+  {
+    const member_t * m = &m_members[i];
+    name.assign(&prefix[0]);
+    name.push_back(_TEXT('!'));
+    name.append(m->name.begin(), m->name.end());
+
+    if (m->error)
+    {
+      if (s->stats != NULL)
+	++s->stats->files_failed;
+      print_error_unicode(s, name.c_str(), "%s", describe(m->error));
+      status = true;
+      continue;
+    }
+
+    if (s->stats != NULL)
+    {
+      ++s->stats->files_hashed;
+      s->stats->bytes_read += m->size;
+    }
+    display_result(s, name.c_str(), m->sum);
+    if (m->size > SSDEEP_MIN_FILE_SIZE)
+      s->found_meaningful_file = true;
+    s->processed_file = true;
+  }
+
+  if (m_error)
+  {
+    if (s->stats != NULL)
+      ++s->stats->files_failed;
+    print_error_unicode(s, m_fn.c_str(), "%s", describe(m_error));
+    status = true;
+  }
+
+  return status;
+}
+
+#endif  // ifndef _WIN32
@@ -0,0 +1,98 @@
+#ifndef __ARCHIVE_H
+#define __ARCHIVE_H
+
+/// @file archive.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "ssdeep.h"
+
+/// @brief The members of a tar, tar.gz or zip archive, hashed in place
+///
+/// Each member is hashed as if it were a file of its own, without writing
+/// it to the disk, and displayed as archive!member. The members of tar and
+/// zip archives can be read in any order, so they are hashed by several
+/// threads at once. A tar.gz archive can only be decompressed from its
+/// start, so its members are hashed one after the other as they are
+/// reached. Compressed archives and members need zlib.
+class Archive
+{
+ public:
+  /// Returns the archive in the file fn, or NULL if fn isn't an archive
+  /// which can be read, in which case it's hashed like any other file
+  static Archive * open(const TCHAR * fn);
+
+  ~Archive();
+
+  /// Hashes each member and displays the results in the order the
+  /// members are in the archive
+  ///
+  /// @return Returns false on success, true on error
+  bool hash(state *s);
+
+ private:
+  typedef enum
+  {
+    archive_tar,
+    archive_tar_gz,
+    archive_zip
+  } type_t;
+
+  /// A member of the archive and, once it has been hashed, its hash
+  typedef struct
+  {
+    std::string name;
+    /// Where the data of the member starts. In a zip archive, where its
+    /// local header starts.
+    uint64_t    offset;
+    /// The size of the member in the archive, and its size once it's
+    /// decompressed
+    uint64_t    packed_size, size;
+    /// The zip compression method, or zero if it isn't compressed
+    unsigned    method;
+    /// Why the member couldn't be hashed, or zero. The numbers are errno
+    /// values, or negative for problems with the archive.
+    int         error;
+    char        sum[FUZZY_MAX_RESULT];
+  } member_t;
+
+  struct context_t;
+  class Input;
+  class FileInput;
+  class InflateInput;
+
+  Archive(const TCHAR * fn, int fd, type_t type, uint64_t size);
+  Archive(const Archive&);
+  Archive& operator=(const Archive&);
+
+  std::basic_string<TCHAR> m_fn;
+  int                      m_fd;
+  type_t                   m_type;
+  uint64_t                 m_size;
+  std::vector<member_t>    m_members;
+  /// Why the rest of the archive couldn't be read, or zero
+  int                      m_error;
+
+  /// Finds the members of a tar archive, hashing them as they're reached
+  /// if ctx isn't NULL
+  int read_tar(Input& in, context_t * ctx);
+  /// Finds the members of a zip archive in its central directory
+  int read_zip(void);
+
+  /// Hashes the members which were found, on up to threads threads
+  void hash_members(RunStats * stats, unsigned int threads);
+  void hash_worker(RunStats * stats, std::atomic<size_t>& next);
+  int hash_member(context_t * ctx, member_t * m);
+  /// Hashes the data of m, which is next in in
+  ///
+  /// @return Returns zero, or the error which stopped in from being read.
+  /// Errors which only affect m are left in m->error.
+  int hash_input(context_t * ctx, Input& in, member_t * m);
+};
+
+#endif  // ifndef __ARCHIVE_H
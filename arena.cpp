@@ -0,0 +1,90 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#include "ssdeep.h"
+#include "arena.h"
+
+void * Arena::alloc_slow(size_t size, size_t align)
+{
+  // Large requests get a block of their own so that we don't waste
+  // the rest of the current block.
+  if (size > ARENA_BLOCK_SIZE / 4 || size + align > ARENA_BLOCK_SIZE / 4)
+  {
+    char * block = NULL;
+    if (size <= SIZE_MAX - align)
+      block = (char *)malloc(size + align);
+    if (NULL == block)
+      fatal_error("%s: Out of memory", __progname);
+
+    m_large.push_back(block);
+
+    uintptr_t p = ((uintptr_t)block + (align - 1)) & ~(uintptr_t)(align - 1);
+    m_size += size;
+    return (void *)p;
+  }
+
+  char * block = (char *)malloc(ARENA_BLOCK_SIZE);
+  if (NULL == block)
+    fatal_error("%s: Out of memory", __progname);
+  m_blocks.push_back(block);
+  m_cur = block;
+  m_end = block + ARENA_BLOCK_SIZE;
+
+  return alloc(size, align);
+}
+
+
+void Arena::absorb(Arena& other)
+{
+  if (&other == this)
+    return;
+
+  // We keep allocating from our own current block
+  m_blocks.insert(m_blocks.end(),
+		  other.m_blocks.begin(),
+		  other.m_blocks.end());
+  m_large.insert(m_large.end(),
+		 other.m_large.begin(),
+		 other.m_large.end());
+  m_size += other.m_size;
+
+  other.m_blocks.clear();
+  other.m_large.clear();
+  other.m_cur  = NULL;
+  other.m_end  = NULL;
+  other.m_size = 0;
+}
+
+
+void Arena::clear(void)
+{
+  if (m_blocks.empty())
+  {
+    release();
+    return;
+  }
+
+  char * first = m_blocks[0];
+  m_blocks[0] = NULL;
+  release();
+
+  m_blocks.push_back(first);
+  m_cur = first;
+  m_end = first + ARENA_BLOCK_SIZE;
+}
+
+
+void Arena::release(void)
+{
+  std::vector<char *>::iterator it;
+  for (it = m_blocks.begin() ; it != m_blocks.end() ; ++it)
+    free(*it);
+  for (it = m_large.begin() ; it != m_large.end() ; ++it)
+    free(*it);
+  m_blocks.clear();
+  m_large.clear();
+  m_cur  = NULL;
+  m_end  = NULL;
+  m_size = 0;
+}
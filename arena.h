@@ -0,0 +1,81 @@
+#ifndef __ARENA_H
+#define __ARENA_H
+
+/// @file arena.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/// The size of the blocks an Arena gets from the system
+#define ARENA_BLOCK_SIZE  (1 << 20)
+
+/// @brief Bump allocator for objects which live as long as the arena
+///
+/// Memory is handed out from large blocks and is only returned to the
+/// system when the arena is cleared or destroyed. Destructors of objects
+/// created in an arena are never run, so they must not own anything
+/// outside of it.
+class Arena
+{
+ public:
+  Arena() : m_cur(NULL), m_end(NULL), m_size(0) {}
+  ~Arena() { release(); }
+
+  /// Returns size bytes of memory aligned to align, which must be
+  /// a power of two. Never returns NULL; exits if out of memory.
+  void * alloc(size_t size, size_t align = sizeof(void *))
+  {
+    // Aligning may move p past the end of the block, in which case
+    // there's no room left at all
+    uintptr_t p = ((uintptr_t)m_cur + (align - 1)) & ~(uintptr_t)(align - 1);
+    if (NULL == m_cur || p > (uintptr_t)m_end ||
+	size > (size_t)((uintptr_t)m_end - p))
+      return alloc_slow(size, align);
+    m_cur = (char *)(p + size);
+    m_size += size;
+    return (void *)p;
+  }
+
+  /// Returns a NUL terminated copy of the first len elements of src,
+  /// converting each of them to type T
+  template <typename T, typename S>
+  T * copy(const S * src, size_t len)
+  {
+    T * dst = (T *)alloc(sizeof(T) * (len + 1), sizeof(T));
+    for (size_t i = 0 ; i < len ; ++i)
+      dst[i] = (T)src[i];
+    dst[len] = 0;
+    return dst;
+  }
+
+  /// Takes over all of the memory of other, which becomes empty.
+  /// Anything allocated from other remains valid.
+  void absorb(Arena& other);
+
+  /// Frees everything allocated from this arena. The first block is
+  /// kept for reuse, so an arena which is cleared after each use
+  /// doesn't go back to the system for memory.
+  void clear(void);
+
+  /// Returns the number of bytes handed out by this arena
+  size_t size(void) const { return m_size; }
+
+ private:
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+
+  void * alloc_slow(size_t size, size_t align);
+  void release(void);
+
+  /// Blocks of ARENA_BLOCK_SIZE bytes, and blocks holding a single
+  /// large allocation
+  std::vector<char *> m_blocks, m_large;
+  char * m_cur, * m_end;
+  size_t m_size;
+};
+
+#endif  // ifndef __ARENA_H
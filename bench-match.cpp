@@ -0,0 +1,210 @@
+// Counts the memory allocated by match_compare
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+//
+// Loads hashes of slices of random data as known hashes and compares
+// more of them against all of the known ones, with and without an LSH
+// index, counting each call of operator new along the way. Once the
+// buffers match_compare reuses have grown, a comparison should not
+// allocate anything. Memory from malloc, such as the blocks of an Arena,
+// is not counted. Built with "make bench-match".
+
+// $Id$
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <vector>
+#include "match.h"
+#include "lsh.h"
+
+#define BENCH_DATA_SIZE  (16 << 20)
+#define BENCH_KNOWN      10000
+#define BENCH_UNKNOWN    1000
+#define BENCH_SEED       UINT64_C(0x5eed5eed5eed5eed)
+
+// If these were inlined, the compiler would see memory from malloc being
+// given to operator delete, or memory from operator new given to free,
+// and warn about it
+#ifdef __GNUC__
+# define BENCH_NOINLINE  __attribute__((noinline))
+#else
+# define BENCH_NOINLINE
+#endif
+
+static std::atomic<uint64_t> allocations(0);
+
+BENCH_NOINLINE void * operator new(size_t size)
+{
+  ++allocations;
+  void * p = malloc(size ? size : 1);
+  if (NULL == p)
+    throw std::bad_alloc();
+  return p;
+}
+
+BENCH_NOINLINE void * operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+BENCH_NOINLINE void * operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  ++allocations;
+  return malloc(size ? size : 1);
+}
+
+BENCH_NOINLINE void * operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return operator new(size, std::nothrow);
+}
+
+BENCH_NOINLINE void operator delete(void * p) noexcept
+{
+  free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void * p) noexcept
+{
+  operator delete(p);
+}
+
+BENCH_NOINLINE void operator delete(void * p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+BENCH_NOINLINE void operator delete[](void * p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+
+static uint64_t rng_state = BENCH_SEED;
+
+static uint64_t rng_next(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+
+/// Returns a Filedata in arena for the hash of a random slice of data
+static Filedata * random_file(Arena& arena,
+			      const std::vector<unsigned char>& data,
+			      const char * prefix,
+			      size_t n)
+{
+  size_t size = 2048 + rng_next() % 16384;
+  size_t offset = rng_next() % (data.size() - size);
+  char sum[FUZZY_MAX_RESULT], fn[64];
+  fuzzy_hash_buf(&data[offset], (uint32_t)size, sum);
+  snprintf(fn, sizeof(fn), "%s%zu", prefix, n);
+  return Filedata::create(arena, fn, sum);
+}
+
+
+typedef struct
+{
+  /// Allocations in the first and second round of comparisons
+  uint64_t first, second;
+  /// Unknowns which matched something in the second round
+  size_t matched;
+} count_t;
+
+
+/// Compares the unknowns against the known hashes twice, first to let
+/// the reused buffers grow, counting the allocations in each round
+static count_t count_allocations(unsigned int lsh_bands,
+				 const std::vector<unsigned char>& data,
+				 FILE * devnull)
+{
+  // As main sets it up, with the options of -m and --lsh
+  state * s = new state;
+  if (initialize_state(s))
+    fatal_error("bench-match: Unable to initialize state variable");
+  s->lsh_bands = lsh_bands;
+
+  // The same hashes each time
+  rng_state = BENCH_SEED;
+  for (size_t i = 0 ; i < BENCH_KNOWN ; ++i)
+    match_add(s, random_file(s->arena, data, "known", i));
+
+  std::vector<Filedata *> unknowns;
+  for (size_t i = 0 ; i < BENCH_UNKNOWN ; ++i)
+    unknowns.push_back(random_file(s->arena, data, "unknown", i));
+
+  count_t count;
+  uint64_t rounds[2];
+  for (int round = 0 ; round < 2 ; ++round)
+  {
+    Output out(devnull);
+    uint64_t before = allocations;
+    count.matched = 0;
+    for (size_t i = 0 ; i < unknowns.size() ; ++i)
+      if (match_compare(s, unknowns[i], out))
+	++count.matched;
+    rounds[round] = allocations - before;
+  }
+  count.first  = rounds[0];
+  count.second = rounds[1];
+
+  delete s->index;
+  delete s;
+  return count;
+}
+
+
+static void report(const char * what, const count_t& count)
+{
+  printf("%-9s %6zu matched  first round %6" PRIu64 " allocations  "
+	 "then %.6f per call, %.9f per comparison\n",
+	 what,
+	 count.matched,
+	 count.first,
+	 (double)count.second / BENCH_UNKNOWN,
+	 (double)count.second / ((double)BENCH_UNKNOWN * BENCH_KNOWN));
+}
+
+
+int main(void)
+{
+  FILE * devnull = fopen("/dev/null", "w");
+  if (NULL == devnull)
+  {
+    perror("bench-match: /dev/null");
+    return EXIT_FAILURE;
+  }
+
+  // Data with pieces repeated now and then, so that some of the hashes
+  // match each other
+  std::vector<unsigned char> data(BENCH_DATA_SIZE);
+  for (size_t i = 0 ; i < data.size() ; )
+  {
+    size_t n = 4096 + rng_next() % 65536;
+    if (i > 65536 && rng_next() % 4 == 0)
+    {
+      size_t from = rng_next() % (i - n % i);
+      for (size_t j = 0 ; j < n && i < data.size() ; ++j)
+	data[i++] = data[from + j];
+    }
+    else
+      for (size_t j = 0 ; j < n && i < data.size() ; ++j)
+	data[i++] = (unsigned char)(' ' + rng_next() % 64);
+  }
+
+  count_t full = count_allocations(0, data, devnull);
+  count_t lsh  = count_allocations(20, data, devnull);
+  report("full scan", full);
+  report("lsh", lsh);
+
+  fclose(devnull);
+  return ((full.second || lsh.second) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,174 @@
+// Measures how much faster FuzzyEngine is than libfuzzy
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+//
+// Hashes the same data with fuzzy_update and with FuzzyEngine, and scores
+// the same pairs of hashes with fuzzy_compare and FuzzyEngine::compare,
+// checking that the results are the same and printing how fast each was.
+// Built with "make bench-spamsum".
+
+// $Id$
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "spamsum.h"
+
+#define BENCH_DATA_SIZE  (64 << 20)
+#define BENCH_PAIRS      200000
+#define BENCH_ROUNDS     5
+
+static uint64_t rng_state = UINT64_C(0x5eed5eed5eed5eed);
+
+static uint64_t rng_next(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+				       start).count();
+}
+
+
+/// Returns the shortest of BENCH_ROUNDS timings of f
+template <typename F>
+static double best_time(F f)
+{
+  double best = 0;
+  for (int i = 0 ; i < BENCH_ROUNDS ; ++i)
+  {
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    f();
+    double t = seconds_since(start);
+    if (0 == i || t < best)
+      best = t;
+  }
+  return best;
+}
+
+
+typedef struct
+{
+  const std::vector<unsigned char> * data;
+  char                               sum[FUZZY_MAX_RESULT];
+} hash_run_t;
+
+static void hash_fuzzy(hash_run_t * run)
+{
+  struct fuzzy_state * state = fuzzy_new();
+  fuzzy_set_total_input_length(state, run->data->size());
+  fuzzy_update(state, run->data->data(), run->data->size());
+  fuzzy_digest(state, run->sum, 0);
+  fuzzy_free(state);
+}
+
+static void hash_engine(hash_run_t * run)
+{
+  FuzzyEngine engine;
+  engine.set_total_input_length(run->data->size());
+  engine.update(run->data->data(), run->data->size());
+  engine.digest(run->sum);
+}
+
+
+typedef struct
+{
+  const std::vector<std::string> * sigs;
+  uint64_t                         total;
+} compare_run_t;
+
+static void compare_fuzzy(compare_run_t * run)
+{
+  const std::vector<std::string>& sigs = *run->sigs;
+  run->total = 0;
+  for (size_t i = 0 ; i + 1 < sigs.size() ; i += 2)
+    run->total += fuzzy_compare(sigs[i].c_str(), sigs[i + 1].c_str());
+}
+
+static void compare_engine(compare_run_t * run)
+{
+  const std::vector<std::string>& sigs = *run->sigs;
+  run->total = 0;
+  for (size_t i = 0 ; i + 1 < sigs.size() ; i += 2)
+    run->total += FuzzyEngine::compare(sigs[i].c_str(), sigs[i + 1].c_str());
+}
+
+
+static void report(const char * what, double base, double engine, const char * unit, double amount)
+{
+  printf("%-8s libfuzzy %8.1f %s  FuzzyEngine %8.1f %s  (%.2fx)\n",
+	 what, amount / base, unit, amount / engine, unit, base / engine);
+}
+
+
+int main(void)
+{
+  int status = EXIT_SUCCESS;
+
+  // Data with pieces repeated now and then, so that the hashes of
+  // different parts of it are similar
+  std::vector<unsigned char> data(BENCH_DATA_SIZE);
+  for (size_t i = 0 ; i < data.size() ; )
+  {
+    size_t n = 4096 + rng_next() % 65536;
+    if (i > 65536 && rng_next() % 4 == 0)
+    {
+      size_t from = rng_next() % (i - n % i);
+      for (size_t j = 0 ; j < n && i < data.size() ; ++j)
+	data[i++] = data[from + j];
+    }
+    else
+      for (size_t j = 0 ; j < n && i < data.size() ; ++j)
+	data[i++] = (unsigned char)(' ' + rng_next() % 64);
+  }
+
+  hash_run_t fuzzy_run, engine_run;
+  fuzzy_run.data = engine_run.data = &data;
+  double fuzzy_time  = best_time([&]() { hash_fuzzy(&fuzzy_run); });
+  double engine_time = best_time([&]() { hash_engine(&engine_run); });
+  if (strcmp(fuzzy_run.sum, engine_run.sum))
+  {
+    fprintf(stderr, "bench-spamsum: Hashes differ: %s and %s\n",
+	    fuzzy_run.sum, engine_run.sum);
+    status = EXIT_FAILURE;
+  }
+  report("hash", fuzzy_time, engine_time, "MB/s", data.size() / 1e6);
+
+  // Hashes of slices of the data, which often have something in common
+  std::vector<std::string> sigs;
+  for (size_t i = 0 ; i < 2 * BENCH_PAIRS ; ++i)
+  {
+    size_t size = 2048 + rng_next() % 16384;
+    size_t offset = rng_next() % (data.size() - size);
+    char sum[FUZZY_MAX_RESULT];
+    fuzzy_hash_buf(&data[offset], (uint32_t)size, sum);
+    sigs.push_back(sum);
+  }
+
+  compare_run_t fuzzy_compares, engine_compares;
+  fuzzy_compares.sigs = engine_compares.sigs = &sigs;
+  fuzzy_time  = best_time([&]() { compare_fuzzy(&fuzzy_compares); });
+  engine_time = best_time([&]() { compare_engine(&engine_compares); });
+  if (fuzzy_compares.total != engine_compares.total)
+  {
+    fprintf(stderr, "bench-spamsum: Scores differ\n");
+    status = EXIT_FAILURE;
+  }
+  report("compare", fuzzy_time, engine_time, "k/s", BENCH_PAIRS / 1e3);
+
+  return status;
+}
@@ -0,0 +1,387 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#include "ssdeep.h"
+#include "cache.h"
+
+// Windows has neither inode numbers nor flock, so there is no cache there
+#ifndef _WIN32
+
+#include <time.h>
+#ifdef HAVE_SYS_FILE_H
+# include <sys/file.h>
+#endif
+
+#define CACHE_HEADER  "ssdeep-cache,1"
+
+// New entries are appended to the file once there are this many bytes
+// of them
+#define CACHE_FLUSH_SIZE  (1 << 16)
+
+// The file is compacted when it has more than this many entries and
+// more than half of them have been superseded
+#define CACHE_COMPACT_MIN  4096
+
+// A file modified this recently (in seconds) could be modified again
+// without its modification time changing, so we don't cache its hash
+#define CACHE_RACY_WINDOW  2
+
+#define NSEC_PER_SEC  1000000000ll
+
+
+void cache_key(cache_key_t * key, const struct stat * sb)
+{
+  key->dev  = (uint64_t)sb->st_dev;
+  key->ino  = (uint64_t)sb->st_ino;
+  key->size = (uint64_t)sb->st_size;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+  key->mtime = (int64_t)sb->st_mtim.tv_sec * NSEC_PER_SEC + sb->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+  key->mtime = (int64_t)sb->st_mtimespec.tv_sec * NSEC_PER_SEC +
+    sb->st_mtimespec.tv_nsec;
+#else
+  key->mtime = (int64_t)sb->st_mtime * NSEC_PER_SEC;
+#endif
+}
+
+
+/// Returns true if sum looks like a fuzzy hash without a filename
+static bool valid_sum(const char * sum, size_t len)
+{
+  if (0 == len || len >= FUZZY_MAX_RESULT || !isdigit((unsigned char)sum[0]))
+    return false;
+
+  int colons = 0;
+  for (size_t i = 0 ; i < len ; ++i)
+  {
+    if (':' == sum[i])
+      ++colons;
+    else if (',' == sum[i] || '"' == sum[i] || !isgraph((unsigned char)sum[i]))
+      return false;
+  }
+  return (2 == colons);
+}
+
+
+static bool write_all(int fd, const char * buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+	continue;
+      return true;
+    }
+    buf += n;
+    len -= n;
+  }
+  return false;
+}
+
+
+HashCache::HashCache(const char * fn) : m_fn(fn), m_records(0)
+{
+}
+
+
+int HashCache::lock_file(int flags)
+{
+  for (;;)
+  {
+    int fd = open(m_fn.c_str(), flags, 0666);
+    if (fd < 0)
+      return -1;
+
+#ifdef HAVE_FLOCK
+    int op = ((flags & O_ACCMODE) == O_RDONLY) ? LOCK_SH : LOCK_EX;
+    while (flock(fd, op))
+    {
+      if (errno != EINTR)
+      {
+	close(fd);
+	return -1;
+      }
+    }
+#endif
+
+    // While we waited for the lock the file may have been compacted,
+    // which replaces it with a new one.
+    struct stat a, b;
+    if (fstat(fd, &a) || stat(m_fn.c_str(), &b))
+    {
+      close(fd);
+      if (ENOENT == errno)
+	continue;
+      return -1;
+    }
+    if (a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+      return fd;
+
+    close(fd);
+  }
+}
+
+
+void HashCache::set(const cache_key_t& key, const char * sum, size_t len)
+{
+  entry_t& e = m_entries[std::make_pair(key.dev, key.ino)];
+  e.size  = key.size;
+  e.mtime = key.mtime;
+  e.sum   = m_arena.copy<char>(sum, len);
+}
+
+
+void HashCache::parse(const char * line)
+{
+  cache_key_t key;
+  char * end;
+
+  key.dev = strtoull(line, &end, 10);
+  if (',' != *end)
+    return;
+  key.ino = strtoull(end + 1, &end, 10);
+  if (',' != *end)
+    return;
+  key.size = strtoull(end + 1, &end, 10);
+  if (',' != *end)
+    return;
+  key.mtime = strtoll(end + 1, &end, 10);
+  if (',' != *end)
+    return;
+
+  ++end;
+  size_t len = strlen(end);
+  if (!valid_sum(end, len))
+    return;
+
+  set(key, end, len);
+  ++m_records;
+}
+
+
+void HashCache::read_entries(int fd)
+{
+  std::string data;
+  char buffer[1 << 16];
+  bool header = true;
+  ssize_t n;
+
+  m_records = 0;
+
+  for (;;)
+  {
+    n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (n <= 0)
+      break;
+    data.append(buffer, n);
+
+    // Only complete lines are used. A line without a newline at the
+    // end is one which another process didn't finish writing.
+    size_t start = 0, nl;
+    while ((nl = data.find('\n', start)) != std::string::npos)
+    {
+      data[nl] = 0;
+      if (header)
+      {
+	if (strcmp(data.c_str() + start, CACHE_HEADER))
+	  return;
+	header = false;
+      }
+      else
+	parse(data.c_str() + start);
+      start = nl + 1;
+    }
+    data.erase(0, start);
+  }
+}
+
+
+bool HashCache::load(void)
+{
+  int fd = lock_file(O_RDONLY);
+  if (fd < 0)
+    return (errno != ENOENT);
+
+  // Anything but an empty file needs to start with our header, so that
+  // we don't append to (and later compact) some other file
+  char header[sizeof(CACHE_HEADER)];
+  ssize_t n = read(fd, header, sizeof(header));
+  if (n > 0 &&
+      (n != (ssize_t)sizeof(header) ||
+       memcmp(header, CACHE_HEADER "\n", sizeof(header))))
+  {
+    close(fd);
+    errno = EINVAL;
+    return true;
+  }
+
+  if (n > 0 && lseek(fd, 0, SEEK_SET) == 0)
+    read_entries(fd);
+  close(fd);
+
+  return false;
+}
+
+
+bool HashCache::lookup(const cache_key_t& key, char * sum)
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  map_t::const_iterator it = m_entries.find(std::make_pair(key.dev, key.ino));
+  if (it == m_entries.end() ||
+      it->second.size != key.size ||
+      it->second.mtime != key.mtime)
+    return false;
+
+  strcpy(sum, it->second.sum);
+  return true;
+}
+
+
+void HashCache::insert(const cache_key_t& key, const char * sum)
+{
+  if (key.mtime / NSEC_PER_SEC >= (int64_t)time(NULL) - CACHE_RACY_WINDOW)
+    return;
+
+  size_t len = strlen(sum);
+  if (!valid_sum(sum, len))
+    return;
+
+  char line[128];
+  snprintf(line, sizeof(line), "%llu,%llu,%llu,%lld,",
+	   (unsigned long long)key.dev,
+	   (unsigned long long)key.ino,
+	   (unsigned long long)key.size,
+	   (long long)key.mtime);
+
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  set(key, sum, len);
+  m_pending += line;
+  m_pending.append(sum, len);
+  m_pending += '\n';
+
+  if (m_pending.size() >= CACHE_FLUSH_SIZE)
+    flush();
+}
+
+
+bool HashCache::flush(void)
+{
+  if (m_pending.empty())
+    return false;
+
+  int fd = lock_file(O_RDWR | O_APPEND | O_CREAT);
+  if (fd < 0)
+    return true;
+
+  // Start a new file with the header. If somebody didn't finish the last
+  // line, end it, so that only that line is lost.
+  bool status = false;
+  struct stat sb;
+  char last = '\n';
+  if (fstat(fd, &sb))
+    status = true;
+  else if (0 == sb.st_size)
+    status = write_all(fd, CACHE_HEADER "\n", strlen(CACHE_HEADER) + 1);
+  else if (pread(fd, &last, 1, sb.st_size - 1) == 1 && '\n' != last)
+    status = write_all(fd, "\n", 1);
+
+  if (!status)
+    status = write_all(fd, m_pending.data(), m_pending.size());
+
+  if (close(fd))
+    status = true;
+
+  for (size_t i = 0 ; i < m_pending.size() ; ++i)
+    if ('\n' == m_pending[i])
+      ++m_records;
+  m_pending.clear();
+
+  return status;
+}
+
+
+bool HashCache::compact(void)
+{
+  int fd = lock_file(O_RDWR);
+  if (fd < 0)
+    return true;
+
+  // Pick up whatever other processes have added since we loaded
+  if (lseek(fd, 0, SEEK_SET) == 0)
+    read_entries(fd);
+
+  std::string tmp = m_fn + ".XXXXXX";
+  int out = mkstemp(&tmp[0]);
+  if (out < 0)
+  {
+    close(fd);
+    return true;
+  }
+
+  struct stat sb;
+  if (0 == fstat(fd, &sb))
+    fchmod(out, sb.st_mode & 0777);
+
+  std::string data = CACHE_HEADER "\n";
+  char line[128];
+  bool status = false;
+
+  map_t::const_iterator it;
+  for (it = m_entries.begin() ; it != m_entries.end() && !status ; ++it)
+  {
+    snprintf(line, sizeof(line), "%llu,%llu,%llu,%lld,",
+	     (unsigned long long)it->first.first,
+	     (unsigned long long)it->first.second,
+	     (unsigned long long)it->second.size,
+	     (long long)it->second.mtime);
+    data += line;
+    data += it->second.sum;
+    data += '\n';
+
+    if (data.size() >= CACHE_FLUSH_SIZE)
+    {
+      status = write_all(out, data.data(), data.size());
+      data.clear();
+    }
+  }
+
+  if (!status)
+    status = write_all(out, data.data(), data.size());
+  if (close(out))
+    status = true;
+
+  // The lock on the old file is held until the new one is in place
+  if (status || rename(tmp.c_str(), m_fn.c_str()))
+  {
+    unlink(tmp.c_str());
+    status = true;
+  }
+  else
+    m_records = m_entries.size();
+
+  close(fd);
+  return status;
+}
+
+
+bool HashCache::save(void)
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  if (flush())
+    return true;
+
+  if (m_records > CACHE_COMPACT_MIN && m_records > 2 * m_entries.size())
+    return compact();
+
+  return false;
+}
+
+#endif  // ifndef _WIN32
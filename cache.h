@@ -0,0 +1,118 @@
+#ifndef __CACHE_H
+#define __CACHE_H
+
+/// @file cache.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "arena.h"
+
+/// Identifies a version of a file on the disk
+typedef struct
+{
+  uint64_t dev, ino, size;
+  /// Modification time in nanoseconds since the epoch
+  int64_t mtime;
+} cache_key_t;
+
+/// @brief Persistent cache of the fuzzy hashes of files
+///
+/// Remembers the hash of each file by its device, inode, size and
+/// modification time, so that files which haven't changed since they were
+/// last hashed don't need to be read again. The cache file is a log which
+/// is only ever appended to, under an exclusive lock, so several copies of
+/// the program can share it. Each inode has a single current entry; when a
+/// file changes, its new entry supersedes the old one. Once most of the
+/// entries in the file have been superseded it is rewritten (compacted).
+///
+/// All of the functions may be called from several threads at once.
+class HashCache
+{
+ public:
+  /// Creates a cache backed by the file fn, which need not exist yet
+  HashCache(const char * fn);
+
+  /// Reads the cache file, if any.
+  ///
+  /// @return Returns false on success, true on error
+  bool load(void);
+
+  /// If there is an entry for key, copies its hash into sum, which
+  /// must hold at least FUZZY_MAX_RESULT bytes.
+  ///
+  /// @return Returns true if the hash was found, false otherwise
+  bool lookup(const cache_key_t& key, char * sum);
+
+  /// Records sum as the hash of the file identified by key
+  void insert(const cache_key_t& key, const char * sum);
+
+  /// Appends the new entries to the cache file and compacts it if
+  /// it has grown too large.
+  ///
+  /// @return Returns false on success, true on error
+  bool save(void);
+
+ private:
+  HashCache(const HashCache&);
+  HashCache& operator=(const HashCache&);
+
+  typedef struct
+  {
+    uint64_t     size;
+    int64_t      mtime;
+    const char * sum;
+  } entry_t;
+
+  struct key_hash
+  {
+    size_t operator()(const std::pair<uint64_t, uint64_t>& k) const
+    {
+      return (size_t)(k.first * 0x9e3779b97f4a7c15ull ^ k.second);
+    }
+  };
+
+  typedef std::unordered_map<std::pair<uint64_t, uint64_t>,
+			     entry_t,
+			     key_hash> map_t;
+
+  std::string m_fn;
+  std::mutex  m_lock;
+
+  /// The current entry for each (device, inode) and the memory for
+  /// their hashes
+  map_t m_entries;
+  Arena m_arena;
+
+  /// Entries which have not been written to the file yet
+  std::string m_pending;
+
+  /// Number of entries in the file, including superseded ones
+  uint64_t m_records;
+
+  /// Parse the cache file open on fd into m_entries
+  void read_entries(int fd);
+
+  /// Add the entry in line, which has been read from the cache file
+  void parse(const char * line);
+
+  void set(const cache_key_t& key, const char * sum, size_t len);
+
+  /// Append m_pending to the cache file
+  bool flush(void);
+
+  /// Rewrite the cache file with only the current entries
+  bool compact(void);
+
+  /// Opens the cache file and locks it
+  int lock_file(int flags);
+};
+
+/// Fill in key for the file whose status is sb.
+void cache_key(cache_key_t * key, const struct stat * sb);
+
+#endif  // ifndef __CACHE_H
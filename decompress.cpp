@@ -0,0 +1,358 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "decompress.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+
+Decompressor::format_t Decompressor::detect(const char * data, size_t len)
+{
+  const unsigned char * p = (const unsigned char *)data;
+  if (len >= 2 && 0x1f == p[0] && 0x8b == p[1])
+    return format_gzip;
+  if (len >= 4 && 0x28 == p[0] && 0xb5 == p[1] && 0x2f == p[2] && 0xfd == p[3])
+    return format_zstd;
+  return format_none;
+}
+
+
+bool Decompressor::supported(format_t format)
+{
+  switch (format)
+  {
+#ifdef HAVE_ZLIB
+  case format_gzip:
+    return true;
+#endif
+#ifdef HAVE_ZSTD
+  case format_zstd:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+
+const char * Decompressor::name(format_t format)
+{
+  switch (format)
+  {
+  case format_gzip:
+    return "gzip";
+  case format_zstd:
+    return "zstd";
+  default:
+    return "no compression";
+  }
+}
+
+
+Decompressor::Decompressor(format_t format,
+			   FILE * handle,
+			   const char * data,
+			   size_t len) :
+  m_format(format),
+  m_handle(handle),
+  m_prefix(data, len),
+  m_prefix_pos(0),
+  m_stopping(false),
+  m_finished(false),
+  m_current_pos(0),
+  m_next_in(m_in),
+  m_avail_in(0),
+  m_eof(false),
+  m_done(false)
+{
+  m_current.data = NULL;
+  m_current.len  = 0;
+
+  for (int i = 0 ; i < DECOMPRESS_BLOCKS ; ++i)
+  {
+    char * block = (char *)malloc(DECOMPRESS_BLOCK_SIZE);
+    if (NULL == block)
+      throw std::bad_alloc();
+    m_free.push_back(block);
+  }
+
+#ifdef HAVE_ZLIB
+  m_z_ready = false;
+  m_between = false;
+  if (format_gzip == format)
+  {
+    memset(&m_z, 0, sizeof(m_z));
+    if (inflateInit2(&m_z, 15 + 16) != Z_OK)
+      throw std::bad_alloc();
+    m_z_ready = true;
+  }
+#endif
+#ifdef HAVE_ZSTD
+  m_zstd = NULL;
+  m_in_frame = false;
+  if (format_zstd == format)
+  {
+    m_zstd = ZSTD_createDStream();
+    if (NULL == m_zstd)
+      throw std::bad_alloc();
+    ZSTD_initDStream(m_zstd);
+  }
+#endif
+
+  m_thread = std::thread(&Decompressor::run, this);
+}
+
+
+Decompressor::~Decompressor()
+{
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_stopping = true;
+  }
+  m_changed.notify_all();
+  m_thread.join();
+
+  free(m_current.data);
+  for (size_t i = 0 ; i < m_free.size() ; ++i)
+    free(m_free[i]);
+  for (size_t i = 0 ; i < m_full.size() ; ++i)
+    free(m_full[i].data);
+
+#ifdef HAVE_ZLIB
+  if (m_z_ready)
+    inflateEnd(&m_z);
+#endif
+#ifdef HAVE_ZSTD
+  if (m_zstd != NULL)
+    ZSTD_freeDStream(m_zstd);
+#endif
+}
+
+
+size_t Decompressor::read(char * buf, size_t len)
+{
+  size_t done = 0;
+
+  while (done < len)
+  {
+    if (m_current_pos == m_current.len)
+    {
+      // Hand the block we've finished back and wait for the next one
+      std::unique_lock<std::mutex> guard(m_lock);
+      if (m_current.data != NULL)
+      {
+	m_free.push_back(m_current.data);
+	m_current.data = NULL;
+	m_changed.notify_all();
+      }
+      m_changed.wait(guard, [this] {
+	  return !m_full.empty() || m_finished; });
+      if (m_full.empty())
+	break;
+
+      m_current = m_full.front();
+      m_full.pop_front();
+      m_current_pos = 0;
+      continue;
+    }
+
+    size_t n = m_current.len - m_current_pos;
+    if (n > len - done)
+      n = len - done;
+    memcpy(buf + done, m_current.data + m_current_pos, n);
+    m_current_pos += n;
+    done += n;
+  }
+
+  return done;
+}
+
+
+const char * Decompressor::error(void) const
+{
+  return (m_error.empty() ? NULL : m_error.c_str());
+}
+
+
+void Decompressor::run(void)
+{
+  for (;;)
+  {
+    char * block;
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_changed.wait(guard, [this] {
+	  return !m_free.empty() || m_stopping; });
+      if (m_stopping)
+	return;
+      block = m_free.back();
+      m_free.pop_back();
+    }
+
+    // A short block is the last one
+    block_t b;
+    b.data = block;
+    b.len  = fill(block, DECOMPRESS_BLOCK_SIZE);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_full.push_back(b);
+    if (b.len < DECOMPRESS_BLOCK_SIZE)
+      m_finished = true;
+    m_changed.notify_all();
+    if (m_finished)
+      return;
+  }
+}
+
+
+void Decompressor::refill(void)
+{
+  memmove(m_in, m_next_in, m_avail_in);
+  m_next_in = m_in;
+
+  size_t want = sizeof(m_in) - m_avail_in, got;
+  if (m_prefix_pos < m_prefix.size())
+  {
+    got = m_prefix.size() - m_prefix_pos;
+    if (got > want)
+      got = want;
+    memcpy(m_in + m_avail_in, m_prefix.data() + m_prefix_pos, got);
+    m_prefix_pos += got;
+  }
+  else
+  {
+    got = fread(m_in + m_avail_in, 1, want, m_handle);
+    if (0 == got && ferror(m_handle))
+      m_error = strerror(errno ? errno : EIO);
+  }
+
+  m_avail_in += got;
+  m_eof = (0 == got);
+}
+
+
+size_t Decompressor::fill(char * out, size_t size)
+{
+  switch (m_format)
+  {
+#ifdef HAVE_ZLIB
+  case format_gzip:
+    return fill_gzip(out, size);
+#endif
+#ifdef HAVE_ZSTD
+  case format_zstd:
+    return fill_zstd(out, size);
+#endif
+  default:
+    m_error = "Unsupported compression";
+    return 0;
+  }
+}
+
+
+#ifdef HAVE_ZLIB
+size_t Decompressor::fill_gzip(char * out, size_t size)
+{
+  m_z.next_out  = (Bytef *)out;
+  m_z.avail_out = (uInt)size;
+
+  while (m_z.avail_out > 0 && !m_done)
+  {
+    // Another gzip stream needs two bytes to be recognized
+    if ((0 == m_avail_in || (m_between && m_avail_in < 2)) && !m_eof)
+    {
+      refill();
+      continue;
+    }
+
+    if (m_between)
+    {
+      // Anything after the last stream is ignored, as gzip does
+      if (m_avail_in < 2 || m_next_in[0] != 0x1f || m_next_in[1] != 0x8b)
+      {
+	m_done = true;
+	break;
+      }
+      m_between = false;
+    }
+
+    // Once the input has run out, inflate may still have output to give
+    m_z.next_in  = m_next_in;
+    m_z.avail_in = (uInt)m_avail_in;
+    int rc = inflate(&m_z, Z_NO_FLUSH);
+    m_next_in  = m_z.next_in;
+    m_avail_in = m_z.avail_in;
+
+    if (Z_STREAM_END == rc)
+    {
+      m_between = true;
+      inflateReset(&m_z);
+    }
+    else if (rc != Z_OK)
+    {
+      if (Z_BUF_ERROR == rc)
+	m_error = "Truncated gzip data";
+      else if (Z_MEM_ERROR == rc)
+	m_error = strerror(ENOMEM);
+      else
+	m_error = "Corrupt gzip data";
+      m_done = true;
+    }
+  }
+
+  return size - m_z.avail_out;
+}
+#endif
+
+
+#ifdef HAVE_ZSTD
+size_t Decompressor::fill_zstd(char * out, size_t size)
+{
+  ZSTD_outBuffer output = { out, size, 0 };
+
+  while (output.pos < size && !m_done)
+  {
+    if (0 == m_avail_in && !m_eof)
+    {
+      refill();
+      continue;
+    }
+
+    if (0 == m_avail_in && !m_in_frame)
+    {
+      m_done = true;
+      break;
+    }
+
+    // Once the input has run out, the frame may still have output to give
+    size_t before = output.pos;
+    ZSTD_inBuffer input = { m_next_in, m_avail_in, 0 };
+    size_t rc = ZSTD_decompressStream(m_zstd, &output, &input);
+    m_next_in  += input.pos;
+    m_avail_in -= input.pos;
+
+    if (ZSTD_isError(rc))
+    {
+      m_error = std::string("Corrupt zstd data: ") + ZSTD_getErrorName(rc);
+      m_done = true;
+    }
+    else if (rc != 0 && 0 == m_avail_in && m_eof && output.pos == before)
+    {
+      m_error = "Truncated zstd data";
+      m_done = true;
+    }
+    else
+      // Zero means a frame has just ended; another may follow
+      m_in_frame = (rc != 0);
+  }
+
+  return output.pos;
+}
+#endif
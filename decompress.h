@@ -0,0 +1,143 @@
+#ifndef __DECOMPRESS_H
+#define __DECOMPRESS_H
+
+/// @file decompress.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+/// How much decompressed data is handed over at once
+#define DECOMPRESS_BLOCK_SIZE  (1 << 18)
+
+/// How many blocks may be waiting to be read
+#define DECOMPRESS_BLOCKS      4
+
+/// @brief Decompresses a gzip or zstd compressed file on a thread of its own
+///
+/// The thread runs ahead of the reader by up to DECOMPRESS_BLOCKS blocks,
+/// so that whatever the reader does with the data overlaps with
+/// decompressing the rest of it. Files made of several compressed streams
+/// one after the other, as from cat, are read as one. A Decompressor must
+/// only be read by one thread at a time.
+class Decompressor
+{
+ public:
+  typedef enum
+  {
+    format_none,
+    format_gzip,
+    format_zstd
+  } format_t;
+
+  /// Returns the format of compressed data which starts with the len
+  /// bytes at data, or format_none if it isn't compressed
+  static format_t detect(const char * data, size_t len);
+
+  /// Returns true if this build can decompress format
+  static bool supported(format_t format);
+
+  /// Returns the name of format
+  static const char * name(format_t format);
+
+  /// Starts decompressing the data of format in handle. The len bytes at
+  /// data were read from handle already and come before the rest of it.
+  /// The handle isn't closed by the Decompressor.
+  Decompressor(format_t format, FILE * handle, const char * data, size_t len);
+
+  /// Stops decompressing, whether or not everything has been read
+  ~Decompressor();
+
+  /// Reads up to len bytes of decompressed data into buf, fewer only at
+  /// the end of the data
+  ///
+  /// @return Returns the number of bytes read
+  size_t read(char * buf, size_t len);
+
+  /// Returns why the data ended early, or NULL if all of it was read.
+  /// Only meaningful once read has reached the end.
+  const char * error(void) const;
+
+ private:
+  Decompressor(const Decompressor&);
+  Decompressor& operator=(const Decompressor&);
+
+  typedef struct
+  {
+    char * data;
+    size_t len;
+  } block_t;
+
+  format_t    m_format;
+  FILE      * m_handle;
+  /// Input which was read before decompressing started
+  std::string m_prefix;
+  size_t      m_prefix_pos;
+
+  std::thread             m_thread;
+  std::mutex              m_lock;
+  std::condition_variable m_changed;
+  /// Blocks to be filled, and blocks waiting to be read
+  std::vector<char *>     m_free;
+  std::deque<block_t>     m_full;
+  /// True once the reader has gone away
+  bool                    m_stopping;
+  /// True once the last block has been handed over
+  bool                    m_finished;
+  std::string             m_error;
+
+  /// The block being read, and how much of it has been
+  block_t m_current;
+  size_t  m_current_pos;
+
+  /// Compressed input, from next_in to end_in
+  unsigned char   m_in[1 << 16];
+  unsigned char * m_next_in;
+  size_t          m_avail_in;
+  bool            m_eof;
+
+  /// The thread: fills blocks until the data or the reader runs out
+  void run(void);
+
+  /// Reads more compressed input after whatever is left of it, setting
+  /// m_eof if there isn't any more
+  void refill(void);
+
+  /// Decompresses up to size bytes into out, setting m_error on a problem
+  ///
+  /// @return Returns the number of bytes written, which is less than
+  /// size only at the end of the data or on an error
+  size_t fill(char * out, size_t size);
+
+#ifdef HAVE_ZLIB
+  size_t fill_gzip(char * out, size_t size);
+  z_stream m_z;
+  bool     m_z_ready;
+  /// True after the end of a gzip stream, until the next one starts
+  bool     m_between;
+#endif
+#ifdef HAVE_ZSTD
+  size_t fill_zstd(char * out, size_t size);
+  ZSTD_DStream * m_zstd;
+  /// True if the input so far ends in the middle of a zstd frame
+  bool           m_in_frame;
+#endif
+  /// True once the compressed data has ended
+  bool m_done;
+};
+
+#endif  // ifndef __DECOMPRESS_H
@@ -12,6 +12,7 @@
 // $Id$
 
 #include "ssdeep.h"
+#include "stats.h"
 
 #define STATUS_OK   false
 
@@ -21,6 +22,51 @@ static bool is_special_dir(TCHAR *d)
           (!_tcsncmp(d,_TEXT(".."),2) && (_tcslen(d) == 2)));
 }
 
+
+/// Returns true if fn, or its name if the pattern has no directory
+/// separator in it, matches one of patterns
+static bool matches_any(const std::vector<std::basic_string<TCHAR> >& patterns,
+			const TCHAR *fn)
+{
+  const TCHAR *name = _tcsrchr(fn, DIR_SEPARATOR);
+  name = (NULL == name) ? fn : name + 1;
+
+  for (size_t i = 0 ; i < patterns.size() ; ++i)
+  {
+    const TCHAR *pattern = patterns[i].c_str();
+    if (glob_match(pattern, _tcschr(pattern, DIR_SEPARATOR) ? fn : name))
+      return true;
+  }
+  return false;
+}
+
+
+/// Returns true if the file fn is left out because of its size or name.
+/// Only regular files have a size which counts.
+static bool excluded(const state *s, const TCHAR *fn, bool regular, uint64_t size)
+{
+  if (regular && (size < s->min_size || size > s->max_size))
+    return true;
+
+  if (!s->include_patterns.empty() && !matches_any(s->include_patterns, fn))
+    return true;
+
+  return matches_any(s->exclude_patterns, fn);
+}
+
+
+/// Returns true if the file fn should be skipped, counting it if so
+static bool skip_file(const state *s, const TCHAR *fn, bool regular, uint64_t size)
+{
+  if (!excluded(s, fn, regular, size))
+    return false;
+
+  if (s->stats != NULL)
+    ++s->stats->files_skipped;
+  return true;
+}
+
+
 #ifndef _WIN32
 
 static TCHAR DOUBLE_DIR[4] =
@@ -263,27 +309,25 @@ static int file_type_helper(_tstat_t sb)
 }
 
 
-static int file_type(state *s, TCHAR *fn)
+static int file_type(state *s, TCHAR *fn, _tstat_t *sb)
 {
-  _tstat_t sb;
-
   if (NULL == s || NULL == fn)
     return file_unknown;
 
-  if (_lstat(fn,&sb))
+  if (_lstat(fn,sb))
   {
     print_error_unicode(s,fn,"%s", strerror(errno));
     return file_unknown;
   }
 
-  return file_type_helper(sb);
+  return file_type_helper(*sb);
 }
 
 
-static bool should_hash_symlink(state *s, TCHAR *fn, int *link_type)
+// On success sb holds the status of the file the link points to
+static bool should_hash_symlink(state *s, TCHAR *fn, int *link_type, _tstat_t *sb)
 {
   int type;
-  _tstat_t sb;
 
   if (NULL == s || NULL == fn)
     fatal_error("%s: Null state passed into should_hash_symlink", __progname);
@@ -291,13 +335,13 @@ static bool should_hash_symlink(state *s, TCHAR *fn, int *link_type)
   // We must look at what this symlink points to before we process it.
   // The normal file_type function uses lstat to examine the file,
   // we use stat to examine what this symlink points to.
-  if (_sstat(fn,&sb))
+  if (_sstat(fn,sb))
     {
       print_error_unicode(s,fn,"%s",strerror(errno));
       return false;
     }
 
-  type = file_type_helper(sb);
+  type = file_type_helper(*sb);
 
   if (type == file_directory)
     {
@@ -318,7 +362,8 @@ static bool should_hash_symlink(state *s, TCHAR *fn, int *link_type)
 
 static bool should_hash(state *s, TCHAR *fn)
 {
-  int type = file_type(s, fn);
+  _tstat_t sb;
+  int type = file_type(s, fn, &sb);
 
   if (NULL == s || NULL == fn)
     fatal_error("%s: Null state passed into should_hash", __progname);
@@ -334,12 +379,16 @@ static bool should_hash(state *s, TCHAR *fn)
     return false;
   }
 
-  if (type == file_symlink)
-    return should_hash_symlink(s,fn,NULL);
+  if (type == file_symlink && !should_hash_symlink(s,fn,NULL,&sb))
+    return false;
 
   if (type == file_unknown)
     return false;
 
+  // Files the user doesn't want are never opened
+  if (skip_file(s, fn, S_ISREG(sb.st_mode), (uint64_t)sb.st_size))
+    return false;
+
   // By default we hash anything we can't identify as a "bad thing"
   return true;
 }
@@ -347,6 +396,7 @@ static bool should_hash(state *s, TCHAR *fn)
 
 bool process_normal(state *s, TCHAR *fn)
 {
+  StatsPhase phase(s->stats, PHASE_WALK);
   clean_name(s,fn);
 
   if (should_hash(s,fn))
@@ -354,6 +404,50 @@ bool process_normal(state *s, TCHAR *fn)
 
   return false;
 }
+
+
+uint64_t measure_files(const state *s, const TCHAR *fn, const std::atomic<bool>& stop)
+{
+  _tstat_t sb;
+
+  // Symbolic links to directories aren't followed, so there can't be
+  // any cycles
+  if (stop || _lstat(fn, &sb))
+    return 0;
+  if (S_ISLNK(sb.st_mode) && (_sstat(fn, &sb) || S_ISDIR(sb.st_mode)))
+    return 0;
+
+  if (!S_ISDIR(sb.st_mode))
+  {
+    if (!S_ISREG(sb.st_mode) || excluded(s, fn, true, (uint64_t)sb.st_size))
+      return 0;
+    return (uint64_t)sb.st_size;
+  }
+
+  if (!(s->mode & mode_recursive))
+    return 0;
+
+  _TDIR *dir = _topendir(fn);
+  if (NULL == dir)
+    return 0;
+
+  uint64_t total = 0;
+  std::basic_string<TCHAR> path;
+  struct _tdirent *entry;
+  while (!stop && (entry = _treaddir(dir)) != NULL)
+  {
+    if (is_special_dir(entry->d_name))
+      continue;
+
+    path.assign(fn);
+    path += (TCHAR)DIR_SEPARATOR;
+    path += entry->d_name;
+    total += measure_files(s, path.c_str(), stop);
+  }
+
+  _tclosedir(dir);
+  return total;
+}
 #endif   // ifndef _WIN32
 
 
@@ -362,15 +456,21 @@ bool process_stdin(state *s)
   if (NULL == s)
     return true;
 
+  StatsPhase phase(s->stats, PHASE_HASH);
   char sum[FUZZY_MAX_RESULT];
   int status = fuzzy_hash_stream(stdin, sum);
 
   if (status != 0)
   {
+    if (s->stats != NULL)
+      ++s->stats->files_failed;
     print_error_unicode(s,_TEXT("stdin"),"Error processing stdin");
     return true;
   }
 
+  if (s->stats != NULL)
+    ++s->stats->files_hashed;
+
   display_result(s,_TEXT("stdin"),sum);
 
   return false;
@@ -443,6 +543,8 @@ bool process_win32(state *s, TCHAR *fn)
   if (NULL == s || NULL == fn)
     return true;
 
+  StatsPhase phase(s->stats, PHASE_WALK);
+
   //print_status("process_win32 got %S", fn);
 
   if (is_win32_device_file(fn))
@@ -576,7 +678,10 @@ bool process_win32(state *s, TCHAR *fn)
       */
 
       } else {
-	hash_file(s, new_fn);
+	uint64_t size = ((uint64_t)FindFileData.nFileSizeHigh << 32) |
+	  FindFileData.nFileSizeLow;
+	if (!skip_file(s, new_fn, true, size))
+	  hash_file(s, new_fn);
       }
     }
 
@@ -599,4 +704,14 @@ bool process_win32(state *s, TCHAR *fn)
 
   return false;
 }
+
+
+uint64_t measure_files(const state *s, const TCHAR *fn, const std::atomic<bool>& stop)
+{
+  // Hashing isn't estimated on Windows
+  (void)s;
+  (void)fn;
+  (void)stop;
+  return 0;
+}
 #endif
@@ -3,6 +3,11 @@
 #include "main.h"
 #include "ssdeep.h"
 #include "match.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "archive.h"
+#include "stats.h"
+#include "spamsum.h"
 
 #define MAX_STATUS_MSG   78
 
@@ -10,9 +15,15 @@ bool display_result(state *s, const TCHAR * fn, const char * sum) {
   // Only spend the extra time to make a Filedata object if we need to
   if (MODE(mode_match_pretty) || MODE(mode_match) || MODE(mode_directory)) {
     Filedata * f = NULL;
+
+    // Files we are only comparing don't need to outlive this function
+    static thread_local Arena arena;
     
     try {
-      f = new Filedata(fn, sum);
+      if (MODE(mode_match_pretty) || MODE(mode_directory))
+	f = Filedata::create(s->arena, fn, sum);
+      else
+	f = Filedata::create(arena, fn, sum);
     }
     catch (const std::bad_alloc&) {
       fatal_error("%s: Unable to create Filedata object in engine.cpp:display_result()", __progname);
@@ -33,106 +44,278 @@ bool display_result(state *s, const TCHAR * fn, const char * sum) {
 			      "Unable to add hash to set of known hashes");
       } else {
 	// We haven't add f to the set of knowns, so let's free it.
-	delete f;
+	arena.clear();
       }
     }
   }
   else
   {
     // No special options selected. Display the hash for this file
+    Output& out = stdout_output();
+    if (s->binary)
+    {
+      if (s->first_file_processed)
+      {
+	out.text(SSDEEPV2_0_HEADER);
+	out.put('\n');
+	s->first_file_processed = false;
+      }
+
+      unsigned char record[FILEDATA_RECORD_MAX];
+      size_t len = Filedata::encode(sum, _tcslen(fn), record);
+      if (0 == len)
+	internal_error("%s: Unable to encode %s", __progname, sum);
+      out.write((const char *)record, len);
+      out.filename(fn, false);
+      return false;
+    }
+
     if (s->first_file_processed)
     {
-      print_status("%s", OUTPUT_FILE_HEADER);
+      out.text(OUTPUT_FILE_HEADER);
+      out.newline();
       s->first_file_processed = false;
     }
 
-    printf ("%s,\"", sum);
-    display_filename(stdout, fn, true);
-    print_status("\"");
+    out.text(sum);
+    out.write(",\"", 2);
+    out.filename(fn, true);
+    out.put('"');
+    out.newline();
   }
 
   return false;
 }
 
 
-bool hash_file(state *s, TCHAR *fn) {
-  size_t fn_length;
-  char *sum;
-  TCHAR *my_filename, *msg;
-  FILE *handle;
+// How much of a file we read at once
+#define HASH_BUFFER_SIZE  (1 << 16)
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+/// Everything needed to hash a file. Each thread keeps one from one file
+/// to the next, so that hashing a file doesn't allocate any memory.
+typedef struct hash_context
+{
+  FuzzyEngine   engine;
+  unsigned char buffer[HASH_BUFFER_SIZE];
+} hash_context_t;
+
+
+/// Hash the file open on fd, whose status is in job->sb, into job->sum
+///
+/// @return Returns false on success, true on error
+static bool hash_fd(hash_context_t *ctx, hash_job_t *job, int fd)
+{
+  ctx->engine.reset();
+  if (S_ISREG(job->sb.st_mode) &&
+      ctx->engine.set_total_input_length((uint_least64_t)job->sb.st_size))
+    return true;
+
+  for (;;)
+  {
+    ssize_t n = read(fd, ctx->buffer, HASH_BUFFER_SIZE);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+	continue;
+      return true;
+    }
+    if (0 == n)
+      break;
+    ctx->engine.update(ctx->buffer, n);
+    job->length += n;
+  }
+
+  return ctx->engine.digest(job->sum);
+}
+
+
+int hash_job_open(const state *s, hash_job_t *job)
+{
+  int fd;
+
+  job->open_error = 0;
+  job->read_error = 0;
+  job->length     = 0;
+  job->cacheable  = false;
 
 #ifdef _WIN32
   TCHAR expanded_fn[SSDEEP_PATH_MAX];
-  if (!expanded_path(fn) && !(s->mode & mode_relative)) {
+  if (!expanded_path(&job->fn[0]) && !(s->mode & mode_relative)) {
     _sntprintf(expanded_fn, 
 	       SSDEEP_PATH_MAX,
 	       _TEXT("\\\\?\\%s"),
-	       fn);
+	       job->fn.c_str());
   } else {
-    _tcsncpy(expanded_fn, fn, SSDEEP_PATH_MAX);
+    _tcsncpy(expanded_fn, job->fn.c_str(), SSDEEP_PATH_MAX);
   }
-  handle = _tfopen(expanded_fn, _TEXT("rb"));
+  fd = _topen(expanded_fn, O_RDONLY | O_BINARY);
 # else
-  handle = fopen(fn, "rb");
+  fd = _topen(job->fn.c_str(), O_RDONLY | O_BINARY);
 #endif
 
-  if (NULL == handle)
+  if (fd < 0 || _fstat(fd, &job->sb))
   {
-    print_error_unicode(s,fn,"%s", strerror(errno));
-    return true;
+    job->open_error = errno;
+    if (fd >= 0)
+      close(fd);
+    return -1;
   }
- 
-  if ((sum = (char *)malloc(sizeof(char) * FUZZY_MAX_RESULT)) == NULL)
+
+#ifndef _WIN32
+  // Only regular files keep their contents from one run to the next
+  if (s->cache != NULL && S_ISREG(job->sb.st_mode))
   {
-    fclose(handle);
-    print_error_unicode(s,fn,"%s", strerror(errno));
-    return true;
+    job->cacheable = true;
+    cache_key(&job->key, &job->sb);
+    if (s->cache->lookup(job->key, job->sum))
+    {
+      close(fd);
+      return -1;
+    }
+  }
+#endif
+
+  return fd;
+}
+
+
+void hash_job_read(const state *s, hash_job_t *job, int fd)
+{
+  static thread_local hash_context_t ctx;
+
+  if (hash_fd(&ctx, job, fd))
+    job->read_error = errno;
+  hash_job_close(s, job, fd);
+}
+
+
+void hash_job_close(const state *s, hash_job_t *job, int fd)
+{
+#ifndef _WIN32
+  // The hash is only good if the file didn't change while we read it
+  struct stat after;
+  if (job->cacheable && 0 == job->read_error && 0 == fstat(fd, &after))
+  {
+    cache_key_t now;
+    cache_key(&now, &after);
+    if (now.size == job->key.size && now.mtime == job->key.mtime)
+      s->cache->insert(job->key, job->sum);
+  }
+#else
+  (void)s;
+#endif
+
+  close(fd);
+}
+
+
+void hash_job_announce(state *s, const hash_job_t *job)
+{
+  if (!MODE(mode_verbose))
+    return;
+
+  // Long names are shortened to their basename
+  const TCHAR * my_filename = job->fn.c_str();
+  if (job->fn.size() > MAX_STATUS_MSG)
+  {
+    const TCHAR * sep = _tcsrchr(my_filename, DIR_SEPARATOR);
+    if (sep != NULL)
+      my_filename = sep + 1;
   }
 
 #define MSG_LENGTH (MAX_STATUS_MSG + 20)
-  if ((msg = (TCHAR *)malloc(sizeof(TCHAR) * MSG_LENGTH)) == NULL)
+  TCHAR msg[MSG_LENGTH];
+  _sntprintf(msg,
+	     MSG_LENGTH-1,
+	     _TEXT("Hashing: %s%s"),
+	     my_filename,
+	     _TEXT(BLANK_LINE));
+  msg[MSG_LENGTH-1] = 0;
+  stdout_output().flush();
+  _ftprintf(stderr,_TEXT("%s\r"), msg);
+}
+
+
+bool hash_job_finish(state *s, hash_job_t *job)
+{
+  TCHAR * fn = &job->fn[0];
+
+  if (job->open_error || job->read_error)
   {
-    free(sum);
-    fclose(handle);
-    print_error_unicode(s,fn,"%s", strerror(errno));
+    if (s->stats != NULL)
+      ++s->stats->files_failed;
+    print_error_unicode(s,fn,"%s",
+			strerror(job->open_error ? job->open_error : job->read_error));
     return true;
   }
 
-  if (MODE(mode_verbose))
+  if (s->stats != NULL)
   {
-    fn_length = _tcslen(fn);
-    if (fn_length > MAX_STATUS_MSG)
-    {
-      // We have to make a duplicate of the string to call basename on it
-      // We need the original name for the output later on
-      my_filename = _tcsdup(fn);
-      my_basename(my_filename);
-    }
-    else
-      my_filename = fn;
-
-    _sntprintf(msg,
-	       MSG_LENGTH-1,
-	       _TEXT("Hashing: %s%s"),
-	       my_filename,
-	       _TEXT(BLANK_LINE));
-    _ftprintf(stderr,_TEXT("%s\r"), msg);
-
-    if (fn_length > MAX_STATUS_MSG)
-      free(my_filename);
+    ++s->stats->files_hashed;
+    s->stats->bytes_read += job->length;
   }
 
-  fuzzy_hash_file(handle,sum);
   prepare_filename(s,fn);
-  display_result(s,fn,sum);
+  display_result(s,fn,job->sum);
 
-  if (find_file_size(handle) > SSDEEP_MIN_FILE_SIZE)
+  // Block devices don't have a size, but we've read all of them
+  uint64_t size = 0;
+  if (S_ISREG(job->sb.st_mode))
+    size = job->sb.st_size;
+#ifdef S_ISBLK
+  else if (S_ISBLK(job->sb.st_mode))
+    size = job->length;
+#endif
+  if (size > SSDEEP_MIN_FILE_SIZE)
     s->found_meaningful_file = true;
   s->processed_file = true;
 
-  fclose(handle);
-  free(sum);
-  free(msg);
   return false;
 }
 
+
+bool hash_file(state *s, TCHAR *fn) {
+  StatsPhase phase(s->stats, PHASE_HASH);
+  static thread_local hash_job_t job;
+
+#ifndef _WIN32
+  // Archives are recognized by their contents, so every file has to be
+  // opened here before the pipeline opens it again
+  if (s->archives)
+  {
+    Archive * archive = Archive::open(fn);
+    if (archive != NULL)
+    {
+      // The members are displayed right away, after the files before
+      if (s->pipeline != NULL)
+	s->pipeline->drain();
+      job.fn.assign(fn);
+      hash_job_announce(s, &job);
+
+      bool status = archive->hash(s);
+      delete archive;
+      return status;
+    }
+  }
+#endif
+
+  if (s->pipeline != NULL)
+  {
+    s->pipeline->submit(fn);
+    return false;
+  }
+
+  job.fn.assign(fn);
+
+  int fd = hash_job_open(s, &job);
+  if (0 == job.open_error)
+    hash_job_announce(s, &job);
+  if (fd >= 0)
+    hash_job_read(s, &job, fd);
+
+  return hash_job_finish(s, &job);
+}
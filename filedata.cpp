@@ -10,34 +10,55 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
+#include <new>
 
 
-bool Filedata::valid(void) const
+// Copy the first len elements of src, converting them to type T, into
+// arena or, when arena is NULL, onto the heap.
+template <typename T, typename S>
+static T * copy_string(Arena * arena, const S * src, size_t len)
+{
+  if (arena)
+    return arena->copy<T>(src, len);
+
+  T * dst = (T *)malloc(sizeof(T) * (len + 1));
+  if (NULL == dst)
+    throw std::bad_alloc();
+  for (size_t i = 0 ; i < len ; ++i)
+    dst[i] = (T)src[i];
+  dst[len] = 0;
+  return dst;
+}
+
+
+bool Filedata::valid(const char * sig, size_t len)
 {
   // A valid fuzzy hash has the form
   // [blocksize]:[sig1]:[sig2]
   // with no filename at the end
 
-  // First find the block size
-  const char * sig = m_signature.c_str();
-  unsigned int block_size;
-  if (-1 == sscanf(sig, "%u:", &block_size))
+  // There has to be something there for the block size
+  size_t pos = 0;
+  while (pos < len && isspace((unsigned char)sig[pos]))
+    ++pos;
+  if (pos == len)
     return false;
 
   // Move past the blocksize
-  sig = strchr(sig,':');
+  const char * end = sig + len;
+  sig = (const char *)memchr(sig, ':', len);
   if (!sig)
     return false;
 
   // Move past the first colon and Look for the second colon
   ++sig;
-  sig = strchr(sig,':');
+  sig = (const char *)memchr(sig, ':', end - sig);
   if (!sig)
     return false;
 
   // Finally, a valid signature does *not* have a filename at the end of it
-  sig = strchr(sig,',');
-  if (sig)
+  if (memchr(sig, ',', end - sig))
     return false;
 
   return true;
@@ -56,121 +77,368 @@ void Filedata::clear_cluster(void)
 }
 
 
-Filedata::Filedata(const TCHAR * fn, const char * sig, const char * match_file)
+Filedata::Filedata(void) :
+  m_cluster(NULL),
+  m_signature_id(0),
+  m_signature(NULL),
+  m_signature_length(0),
+  m_filename(NULL),
+  m_filename_length(0),
+  m_match_file(NULL),
+  m_owned(false)
 {
-  m_signature = std::string(sig);
-  if (!valid())
-    throw std::bad_alloc();
+}
 
-  m_filename = _tcsdup(fn);
-  m_cluster  = NULL;
 
-  if (NULL == match_file)
-    m_has_match_file = false;
-  else
+Filedata::~Filedata()
+{
+  if (m_owned)
   {
-    m_has_match_file = true;
-    m_match_file = std::string(match_file);
+    free(m_signature);
+    free(m_filename);
+    free((char *)m_match_file);
   }
 }
 
 
-Filedata::Filedata(const std::string& sig, const char * match_file)
+void Filedata::init(Arena * arena,
+		    const TCHAR * fn,
+		    const char * sig,
+		    const char * match_file)
 {
-  // Set the easy stuff first
-  m_cluster = NULL;
+  size_t sig_len = strlen(sig);
+  if (!valid(sig, sig_len))
+    throw std::bad_alloc();
 
-  if (NULL == match_file)
-    m_has_match_file = false;
-  else
+  m_signature = copy_string<char>(arena, sig, sig_len);
+  m_signature_length = sig_len;
+  m_filename_length = _tcslen(fn);
+  m_filename = copy_string<TCHAR>(arena, fn, m_filename_length);
+  m_match_file = match_file;
+}
+
+
+Filedata::Filedata(const TCHAR * fn, const char * sig, const char * match_file) :
+  Filedata()
+{
+  // Anything we allocate before throwing is freed by the destructor
+  m_owned = true;
+  init(NULL, fn, sig, NULL);
+
+  if (match_file)
+    m_match_file = copy_string<char>(NULL, match_file, strlen(match_file));
+}
+
+
+Filedata * Filedata::create(Arena& arena,
+			    const TCHAR * fn,
+			    const char * sig,
+			    const char * match_file)
+{
+  Filedata * f = new (arena.alloc(sizeof(Filedata))) Filedata();
+  f->init(&arena, fn, sig, match_file);
+  return f;
+}
+
+
+Filedata * Filedata::create(Arena& arena,
+			    const TCHAR * fn,
+			    size_t fn_len,
+			    const char * sig,
+			    size_t sig_len,
+			    const char * match_file)
+{
+  Filedata * f = new (arena.alloc(sizeof(Filedata))) Filedata();
+  f->m_signature = arena.copy<char>(sig, sig_len);
+  f->m_signature_length = sig_len;
+  f->m_filename = arena.copy<TCHAR>(fn, fn_len);
+  f->m_filename_length = fn_len;
+  f->m_match_file = match_file;
+  return f;
+}
+
+
+Filedata * Filedata::parse(Arena& arena,
+			   const char * line,
+			   size_t len,
+			   const char * match_file)
+{
+  // A line has the form [blocksize]:[sig1]:[sig2],"[filename]"
+  // although the filename is optional. The signature ends at the first
+  // comma or quotation mark.
+  size_t sig_len = 0, colons = 0;
+  for ( ; sig_len < len ; ++sig_len)
   {
-    m_has_match_file = true;
-    m_match_file = std::string(match_file);
+    char c = line[sig_len];
+    if (',' == c || '"' == c)
+      break;
+    if (':' == c)
+      ++colons;
   }
 
-  // If we don't have a filename included with the sig, that's ok,
-  // but we should find out now.
-  // If there is a filename, it should be immediately after the
-  // first comma and enclosed in quotation marks.
-  size_t start, stop;
-  start = sig.find_first_of(",\"");
-  if (std::string::npos == start)
+  const char * name = NULL;
+  size_t name_len = 0;
+  if (sig_len == len)
   {
-    // There is no filename. Ok. We still have a valid Filedata.
-    m_filename  = _tcsdup(_TEXT("[NO FILENAME]"));
-    m_signature = std::string(sig);
+    // There is no filename. Ok. We still have to check the validity
+    // of the signature; as in valid(), all we insist on is that it
+    // has two colons.
+    if (colons < 2)
+      return NULL;
+  }
+  else
+  {
+    // The filename starts after the comma and quotation mark and
+    // runs up to the quotation mark at the very end of the line.
+    if (len < sig_len + 3 || '"' != line[len - 1])
+      return NULL;
+    name = line + sig_len + 2;
+    name_len = len - sig_len - 3;
+  }
 
-    // We still have to check the validity of the signature
-    if (!valid())
-      throw std::bad_alloc();
+  Filedata * f = new (arena.alloc(sizeof(Filedata))) Filedata();
+  f->m_match_file = match_file;
+  f->m_signature = arena.copy<char>(line, sig_len);
+  f->m_signature_length = sig_len;
 
-    return;
+  if (NULL == name)
+  {
+    f->m_filename_length = _tcslen(_TEXT("[NO FILENAME]"));
+    f->m_filename = arena.copy<TCHAR>(_TEXT("[NO FILENAME]"),
+				      f->m_filename_length);
+    return f;
   }
 
-  // There is a filename. Ok.
-  // Advance past the comma and quotation mark.
-  start += 2;
+  // Unescape any quotation marks in the filename. As before, every
+  // backslash in front of a quotation mark goes. On Win32 we also
+  // have to do a kludgy cast from ordinary char values to the TCHAR
+  // values we use internally.
+  TCHAR * fn = (TCHAR *)arena.alloc(sizeof(TCHAR) * (name_len + 1),
+				    sizeof(TCHAR));
+  size_t pos = 0;
+  for (size_t i = 0 ; i < name_len ; ++i)
+  {
+    if ('"' == name[i])
+      while (pos > 0 && _TEXT('\\') == fn[pos - 1])
+	--pos;
+    fn[pos++] = (TCHAR)name[i];
+  }
+  fn[pos] = 0;
 
-  // Look for the second quotation mark, which should be at the end
-  // of the string.
-  stop = sig.find_last_of('"');
-  if (stop != sig.size() - 1)
-    throw std::bad_alloc();
+  f->m_filename = fn;
+  f->m_filename_length = pos;
 
-  // Skip any malformed input lines.
-  if (start > stop)
-    throw std::bad_alloc();
+  return f;
+}
 
-  // Strip off the final quotation mark and record the filename
-  std::string tmp = sig.substr(start,(stop - start));
-
-  // Strip off the filename from the signature. Remember that "start"
-  // now points to two characters ahead of the comma
-  m_signature = sig.substr(0,start-2);
-
-  // Unescape any quotation marks in the filename
-  while (tmp.find(std::string("\\\"")) != std::string::npos)
-    tmp.replace(tmp.find(std::string("\\\"")),2,std::string("\""));
-
-#ifndef _WIN32
-  m_filename = strdup(tmp.c_str());
-#else
-  char * tmp2 = strdup(tmp.c_str());
-
-  // On Win32 we have to do a kludgy cast from ordinary char
-  // values to the TCHAR values we use internally. Because we may have
-  // reset the string length, get it again.
-  // The extra +1 is for the terminating newline
-  size_t i, sz = strlen(tmp2);
-  m_filename = (TCHAR *)malloc(sizeof(TCHAR) * (sz + 1));
-  if (NULL == m_filename) {
-    free (tmp2);
-    throw std::bad_alloc();
+
+// The binary format of files of known hashes stores each character of a
+// hash as its index in the base64 alphabet, packed six bits at a time.
+static const char b64[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Returns the index of c in b64, or -1 if it isn't there
+static int b64_index(char c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if ('+' == c)
+    return 62;
+  if ('/' == c)
+    return 63;
+  return -1;
+}
+
+
+size_t Filedata::encode(const char * sig, size_t fn_len, unsigned char * out)
+{
+  // A record has the form
+  // [blocksize index][len1][len2][packed sig1 and sig2][filename length]
+  // where the block size is 3 times 2 to the power of its index and the
+  // filename length is a little endian base 128 number.
+  uint64_t blocksize = 0;
+  const char * p = sig;
+  while (*p >= '0' && *p <= '9' && blocksize <= UINT32_MAX)
+    blocksize = blocksize * 10 + (*p++ - '0');
+  if (':' != *p++)
+    return 0;
+
+  unsigned index = 0;
+  while (index < FUZZY_NUM_BLOCKHASHES && (UINT64_C(3) << index) != blocksize)
+    ++index;
+  if (FUZZY_NUM_BLOCKHASHES == index)
+    return 0;
+
+  const char * sig1 = p;
+  const char * colon = strchr(sig1, ':');
+  if (NULL == colon)
+    return 0;
+  const char * sig2 = colon + 1;
+  size_t len1 = colon - sig1, len2 = strlen(sig2);
+  if (len1 > SPAMSUM_LENGTH || len2 > SPAMSUM_LENGTH)
+    return 0;
+
+  out[0] = (unsigned char)index;
+  out[1] = (unsigned char)len1;
+  out[2] = (unsigned char)len2;
+  size_t pos = 3;
+
+  uint32_t bits = 0;
+  unsigned nbits = 0;
+  for (size_t i = 0 ; i < len1 + len2 ; ++i)
+  {
+    int v = b64_index(i < len1 ? sig1[i] : sig2[i - len1]);
+    if (v < 0)
+      return 0;
+    bits |= (uint32_t)v << nbits;
+    nbits += 6;
+    if (nbits >= 8)
+    {
+      out[pos++] = (unsigned char)bits;
+      bits >>= 8;
+      nbits -= 8;
+    }
   }
+  if (nbits > 0)
+    out[pos++] = (unsigned char)bits;
 
-  for (i = 0 ; i < sz ; i++)
-    m_filename[i] = (TCHAR)(tmp2[i]);
-  m_filename[i] = 0;
+  uint64_t n = fn_len;
+  while (n >= 0x80)
+  {
+    out[pos++] = (unsigned char)(n | 0x80);
+    n >>= 7;
+  }
+  out[pos++] = (unsigned char)n;
 
-  free (tmp2);
-#endif
+  return pos;
 }
 
 
-bool operator==(const Filedata& a, const Filedata& b)
+Filedata * Filedata::decode(Arena& arena,
+			    const unsigned char * data,
+			    size_t len,
+			    size_t * used,
+			    const char * match_file)
 {
-  if (a.get_signature() != b.get_signature())
-    return false;
-  if (a.has_match_file() && !b.has_match_file())
-    return false;
-  if (!a.has_match_file() && b.has_match_file())
-    return false;
-  if (a.has_match_file() && b.has_match_file())
+  *used = 0;
+  if (len < 3)
+    return NULL;
+
+  unsigned index = data[0];
+  size_t len1 = data[1], len2 = data[2];
+  if (index >= FUZZY_NUM_BLOCKHASHES ||
+      len1 > SPAMSUM_LENGTH ||
+      len2 > SPAMSUM_LENGTH)
   {
-    if (a.get_match_file() != b.get_match_file())
-      return false;
+    *used = len;
+    return NULL;
   }
 
-  return true;
+  size_t pos = 3 + ((len1 + len2) * 6 + 7) / 8;
+  uint64_t name_len = 0;
+  for (unsigned shift = 0 ; ; shift += 7)
+  {
+    if (pos >= len)
+      return NULL;
+    // No filename is longer than two megabytes
+    if (shift > 14)
+    {
+      *used = len;
+      return NULL;
+    }
+    unsigned char b = data[pos++];
+    name_len |= (uint64_t)(b & 0x7f) << shift;
+    if (0 == (b & 0x80))
+      break;
+  }
+  if (name_len > len - pos)
+    return NULL;
+
+  // Spell out the signature as the text format has it
+  char sig[FUZZY_MAX_RESULT];
+  char digits[16];
+  size_t ndigits = 0;
+  uint64_t blocksize = UINT64_C(3) << index;
+  do
+  {
+    digits[ndigits++] = '0' + (blocksize % 10);
+    blocksize /= 10;
+  } while (blocksize > 0);
+
+  size_t sig_len = 0;
+  while (ndigits > 0)
+    sig[sig_len++] = digits[--ndigits];
+  sig[sig_len++] = ':';
+
+  const unsigned char * packed = data + 3;
+  uint32_t bits = 0;
+  unsigned nbits = 0;
+  for (size_t i = 0 ; i < len1 + len2 ; ++i)
+  {
+    if (nbits < 6)
+    {
+      bits |= (uint32_t)*packed++ << nbits;
+      nbits += 8;
+    }
+    if (i == len1)
+      sig[sig_len++] = ':';
+    sig[sig_len++] = b64[bits & 0x3f];
+    bits >>= 6;
+    nbits -= 6;
+  }
+  if (len2 == 0)
+    sig[sig_len++] = ':';
+
+  Filedata * f = new (arena.alloc(sizeof(Filedata))) Filedata();
+  f->m_match_file = match_file;
+  f->m_signature = arena.copy<char>(sig, sig_len);
+  f->m_signature_length = sig_len;
+
+  // On Win32 each byte of the filename is one of the TCHAR values we use
+  // internally, as in parse
+  const unsigned char * name = data + pos;
+  TCHAR * fn = (TCHAR *)arena.alloc(sizeof(TCHAR) * ((size_t)name_len + 1),
+				    sizeof(TCHAR));
+  for (size_t i = 0 ; i < name_len ; ++i)
+    fn[i] = (TCHAR)name[i];
+  fn[name_len] = 0;
+
+  f->m_filename = fn;
+  f->m_filename_length = (size_t)name_len;
+
+  *used = pos + (size_t)name_len;
+  return f;
+}
+
+
+size_t FiledataSignatureHash::operator()(const Filedata * f) const
+{
+  // Signatures are long enough that it pays to hash a word at a time
+  const char * p = f->get_signature();
+  size_t len = f->get_signature_length();
+  uint64_t h = len, w;
+
+  while (len >= sizeof(w))
+  {
+    memcpy(&w, p, sizeof(w));
+    h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 29;
+    p += sizeof(w);
+    len -= sizeof(w);
+  }
+
+  w = 0;
+  memcpy(&w, p, len);
+  h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+  return (size_t)(h ^ (h >> 32));
 }
 
+
+bool operator==(const Filedata& a, const Filedata& b)
+{
+  return a.same_signature(&b) && a.same_match_file(&b);
+}
@@ -10,38 +10,115 @@
 #include <string>
 #include <iostream>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "tchar-local.h"
+#include "arena.h"
+#include "fuzzy.h"
+
+/// The most bytes which a record in the binary format of files of known
+/// hashes takes before its filename
+#define FILEDATA_RECORD_MAX  (3 + (2 * SPAMSUM_LENGTH * 6 + 7) / 8 + 10)
 
 /// Contains a fuzzy hash and associated metadata for file
+///
+/// A Filedata either owns its strings, when made with new, or lives
+/// entirely inside an Arena, when made with one of the create functions.
+/// In the latter case it is never deleted; it goes away with the arena.
 class Filedata
 {
  public:
- Filedata() : m_has_match_file(false) {}
-
   /// Creates a new Filedata object with the given filename and signature
   ///
   /// If sig is not valid, throws std::bad_alloc
   Filedata(const TCHAR * fn, const char * sig, const char * match_file = NULL);
 
-  /// Creates a new Filedata object with the given filename and signature
+  /// Creates a new Filedata object in the arena. The match_file is not
+  /// copied and must last at least as long as the new object.
   ///
   /// If sig is not valid, throws std::bad_alloc
-  Filedata(const std::string& sig, const char * match_file = NULL);
+  static Filedata * create(Arena& arena,
+			   const TCHAR * fn,
+			   const char * sig,
+			   const char * match_file = NULL);
+
+  /// Creates a new Filedata object in the arena from a filename and
+  /// signature of the given lengths, which are not checked. This is
+  /// for copies of existing Filedata objects. The match_file is not
+  /// copied and must last at least as long as the new object.
+  static Filedata * create(Arena& arena,
+			   const TCHAR * fn,
+			   size_t fn_len,
+			   const char * sig,
+			   size_t sig_len,
+			   const char * match_file = NULL);
+
+  /// Creates a new Filedata object in the arena from a line in a file
+  /// of known hashes, without its newline. The line does not need to be
+  /// NUL terminated. The match_file is not copied and must last at
+  /// least as long as the new object.
+  ///
+  /// Returns NULL if the line does not contain a valid signature
+  static Filedata * parse(Arena& arena,
+			  const char * line,
+			  size_t len,
+			  const char * match_file = NULL);
+
+  /// Creates a new Filedata object in the arena from the record of the
+  /// binary format at the start of the len bytes at data. The filename
+  /// is used as it is, without any unescaping. The match_file is not
+  /// copied and must last at least as long as the new object.
+  ///
+  /// Returns NULL with *used set to zero if data only holds part of the
+  /// record, or with *used set to something else if the record isn't
+  /// valid. Otherwise *used is the length of the record.
+  static Filedata * decode(Arena& arena,
+			   const unsigned char * data,
+			   size_t len,
+			   size_t * used,
+			   const char * match_file = NULL);
+
+  /// Encodes the signature sig and the length of a filename of fn_len
+  /// characters into out, which must hold FILEDATA_RECORD_MAX bytes.
+  /// The filename itself, one byte per character, completes the record.
+  ///
+  /// Returns the number of bytes used, or zero if sig can't be encoded
+  static size_t encode(const char * sig, size_t fn_len, unsigned char * out);
 
   /// Returns the file's fuzzy hash without a filename.
-  /// std::string("[blocksize]:[sig1]:[sig2]")
-  std::string get_signature(void) const { return m_signature; }
+  /// "[blocksize]:[sig1]:[sig2]"
+  const char * get_signature(void) const { return m_signature; }
+  /// Returns the length of the file's fuzzy hash
+  size_t get_signature_length(void) const { return m_signature_length; }
+  /// Returns true if this file and other have the same fuzzy hash
+  bool same_signature(const Filedata * other) const
+  {
+    return m_signature_length == other->m_signature_length &&
+      (m_signature == other->m_signature ||
+       !memcmp(m_signature, other->m_signature, m_signature_length));
+  }
 
   /// Returns the file's name
   /// RBF - Should this be a std::wstring?
   TCHAR * get_filename(void) const { return m_filename; }
+  /// Returns the length of the file's name, in characters
+  size_t get_filename_length(void) const { return m_filename_length; }
 
   /// Returns true if this file came from a file of known files on the disk
-  bool has_match_file(void) const { return m_has_match_file; }
+  bool has_match_file(void) const { return (m_match_file != NULL); }
   /// Returns the name of the file on the disk from which this file came
   /// RBF - Should this be a std::wstring?
-  std::string get_match_file(void) const { return m_match_file; }
+  const char * get_match_file(void) const { return m_match_file; }
+  /// Returns true if this file and other came from the same file
+  /// of known hashes, or if neither of them did.
+  bool same_match_file(const Filedata * other) const
+  {
+    if (m_match_file == other->m_match_file)
+      return true;
+    if (NULL == m_match_file || NULL == other->m_match_file)
+      return false;
+    return !strcmp(m_match_file, other->m_match_file);
+  }
 
   /// Returns true if this file belongs to a cluster of similar files
   bool has_cluster(void) const { return (m_cluster != NULL); }
@@ -49,27 +126,61 @@ class Filedata
   std::set<Filedata* >* get_cluster(void) const { return m_cluster; }
   void clear_cluster(void);
 
-  ~Filedata() { if (m_filename) { free(m_filename); } }
+  /// Returns the index of this file's signature among the distinct
+  /// signatures in the set of known hashes. Files with identical
+  /// signatures share the same index.
+  size_t get_signature_id(void) const { return m_signature_id; }
+  void set_signature_id(size_t id) { m_signature_id = id; }
+
+  ~Filedata();
 
  private:
+  Filedata(void);
   Filedata(const Filedata &other) { (void) other; assert(false); /* never copy */ }
 
+  /// Fill in the signature, filename and match file. The first two
+  /// are copied into arena or, when arena is NULL, onto the heap.
+  void init(Arena * arena,
+	    const TCHAR * fn,
+	    const char * sig,
+	    const char * match_file);
+
   std::set<Filedata *> * m_cluster;
 
+  size_t m_signature_id;
+
   /// Original signature in the form [blocksize]:[sig1]:[sig2]
-  /// It may also contain the filename, but there is no guarantee of that
-  /// one way or the other.
-  std::string m_signature;
+  char * m_signature;
+  size_t m_signature_length;
 
   /// RBF - Should this be a std::wstring?
   TCHAR * m_filename;
+  size_t m_filename_length;
 
   /// File of hashes where we got this known file from, if any
-  std::string m_match_file;
-  bool m_has_match_file;
+  const char * m_match_file;
 
-  /// Returns true if the m_signature field contains a valid fuzzy hash
-  bool valid(void) const;
+  /// True if the strings above were allocated with malloc
+  bool m_owned;
+
+  /// Returns true if sig contains a valid fuzzy hash
+  static bool valid(const char * sig, size_t len);
+};
+
+
+/// Hashes the signature of a Filedata, so that files can be grouped
+/// by signature without copying it.
+struct FiledataSignatureHash
+{
+  size_t operator()(const Filedata * f) const;
+};
+
+struct FiledataSignatureEqual
+{
+  bool operator()(const Filedata * a, const Filedata * b) const
+  {
+    return a->same_signature(b);
+  }
 };
 
 
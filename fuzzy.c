@@ -69,7 +69,20 @@
 #define ROLLING_WINDOW 7
 #define MIN_BLOCKSIZE 3
 #define HASH_INIT 0x27
-#define NUM_BLOCKHASHES 31
+#define NUM_BLOCKHASHES FUZZY_NUM_BLOCKHASHES
+
+// Counting what we do for fuzzy_get_stats. The counts are shared by
+// every thread, so they are updated atomically.
+#if FUZZY_ENABLE_STATS
+#if !defined(__GNUC__)
+#error "--enable-stats requires a compiler with __atomic builtins"
+#endif
+static struct fuzzy_stats fuzzy_stats;
+#define FUZZY_COUNT(counter) \
+  ((void)__atomic_fetch_add(&fuzzy_stats.counter, 1, __ATOMIC_RELAXED))
+#else
+#define FUZZY_COUNT(counter) ((void)0)
+#endif
 
 // Enable bit-parallel string processing only if bit-parallel algorithms
 // are enabled and considered to be efficient.
@@ -172,6 +185,12 @@ struct fuzzy_state
   if(NULL == (self = malloc(sizeof(struct fuzzy_state))))
     /* malloc sets ENOMEM */
     return NULL;
+  fuzzy_reset(self);
+  return self;
+}
+
+void fuzzy_reset(struct fuzzy_state *self)
+{
   self->bhstart = 0;
   self->bhend = 1;
   self->bhendlimit = NUM_BLOCKHASHES - 1;
@@ -185,7 +204,6 @@ struct fuzzy_state
   self->flags = 0;
   self->rollmask = 0;
   roll_init(&self->roll);
-  return self;
 }
 
 /*@only@*/ /*@null@*/ struct fuzzy_state *fuzzy_clone(const struct fuzzy_state *state)
@@ -233,6 +251,7 @@ static void fuzzy_try_fork_blockhash(struct fuzzy_state *self)
   obh = self->bh + (self->bhend - 1);
   if (self->bhend <= self->bhendlimit)
   {
+    FUZZY_COUNT(forks);
     nbh = obh + 1;
     nbh->h = obh->h;
     nbh->halfh = obh->halfh;
@@ -264,12 +283,13 @@ static void fuzzy_try_reduce_blockhash(struct fuzzy_state *self)
     return;
   /* At this point we are clearly no longer interested in the
    * start_blocksize. Get rid of it. */
+  FUZZY_COUNT(reductions);
   ++self->bhstart;
   self->reduce_border *= 2;
   self->rollmask = self->rollmask * 2 + 1;
 }
 
-static const char *b64 =
+static const char b64[] =
   "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 static void fuzzy_engine_step(struct fuzzy_state *self, unsigned char c)
@@ -309,6 +329,7 @@ static void fuzzy_engine_step(struct fuzzy_state *self, unsigned char c)
     /* We have hit a reset point. We now emit hashes which are
      * based on all characters in the piece of the message between
      * the last reset point and this one */
+    FUZZY_COUNT(triggers[i]);
     if (unlikely(0 == self->bh[i].dindex)) {
       /* Can only happen 30 times. */
       /* First step for this blocksize. Clone next. */
@@ -354,6 +375,17 @@ int fuzzy_update(struct fuzzy_state *self,
   return 0;
 }
 
+int fuzzy_update_iov(struct fuzzy_state *self,
+		     const struct fuzzy_iovec *iov,
+		     size_t iovcnt)
+{
+  size_t i;
+  for (i = 0; i < iovcnt; ++i)
+    if (fuzzy_update(self, iov[i].base, iov[i].len) < 0)
+      return -1;
+  return 0;
+}
+
 static size_t memcpy_eliminate_sequences(char *dst,
 					 const char *src,
 					 size_t n)
@@ -508,20 +540,47 @@ int fuzzy_hash_buf(const unsigned char *buf,
 		   uint32_t buf_len,
 		   /*@out@*/ char *result)
 {
-  struct fuzzy_state *ctx;
-  int ret = -1;
-  if (NULL == (ctx = fuzzy_new()))
+  return fuzzy_hash_buffer(buf, buf_len, result);
+}
+
+int fuzzy_hash_buffer(const unsigned char *buf,
+		      size_t buf_len,
+		      /*@out@*/ char *result)
+{
+  struct fuzzy_iovec iov;
+  iov.base = buf;
+  iov.len = buf_len;
+  return fuzzy_hash_iov(&iov, 1, result);
+}
+
+int fuzzy_hash_iov(const struct fuzzy_iovec *iov,
+		   size_t iovcnt,
+		   /*@out@*/ char *result)
+{
+  /* The state is small enough to live on the stack */
+  struct fuzzy_state ctx;
+  uint_least64_t total = 0;
+  size_t i;
+
+  /* The sum can't wrap, because it stops growing once it's too large */
+  for (i = 0; i < iovcnt; ++i)
+  {
+    if (iov[i].len > FUZZY_TOTAL_SIZE_MAX - total)
+    {
+      errno = EOVERFLOW;
+      return -1;
+    }
+    total += iov[i].len;
+  }
+
+  fuzzy_reset(&ctx);
+  if (fuzzy_set_total_input_length(&ctx, total) < 0)
+    return -1;
+  if (fuzzy_update_iov(&ctx, iov, iovcnt) < 0)
+    return -1;
+  if (fuzzy_digest(&ctx, result, 0) < 0)
     return -1;
-  if (fuzzy_set_total_input_length(ctx, buf_len) < 0)
-    goto out;
-  if (fuzzy_update(ctx, buf, buf_len) < 0)
-    goto out;
-  if (fuzzy_digest(ctx, result, 0) < 0)
-    goto out;
-  ret = 0;
- out:
-  fuzzy_free(ctx);
-  return ret;
+  return 0;
 }
 
 static int fuzzy_update_stream(struct fuzzy_state *state,
@@ -544,18 +603,13 @@ static int fuzzy_update_stream(struct fuzzy_state *state,
 
 int fuzzy_hash_stream(FILE *handle, /*@out@*/ char *result)
 {
-  struct fuzzy_state *ctx;
-  int ret = -1;
-  if (NULL == (ctx = fuzzy_new()))
+  struct fuzzy_state ctx;
+  fuzzy_reset(&ctx);
+  if (fuzzy_update_stream(&ctx, handle) < 0)
+    return -1;
+  if (fuzzy_digest(&ctx, result, 0) < 0)
     return -1;
-  if (fuzzy_update_stream(ctx, handle) < 0)
-    goto out;
-  if (fuzzy_digest(ctx, result, 0) < 0)
-    goto out;
-  ret = 0;
- out:
-  fuzzy_free(ctx);
-  return ret;
+  return 0;
 }
 
 int fuzzy_hash_file(FILE *handle, /*@out@*/ char *result)
@@ -563,7 +617,7 @@ int fuzzy_hash_file(FILE *handle, /*@out@*/ char *result)
   off_t fpos;
   struct stat fst;
   int status = -1;
-  struct fuzzy_state *ctx;
+  struct fuzzy_state ctx;
   fpos = ftello(handle);
   if (fpos < 0)
     return -1;
@@ -572,20 +626,17 @@ int fuzzy_hash_file(FILE *handle, /*@out@*/ char *result)
   // At least, the file pointed by `handle` must be seekable.
   if (fseeko(handle, 0, SEEK_SET) < 0)
     return -1;
-  if (NULL == (ctx = fuzzy_new()))
+  fuzzy_reset(&ctx);
+  if (S_ISREG(fst.st_mode) && fuzzy_set_total_input_length(&ctx, (uint_least64_t)fst.st_size) < 0)
     return -1;
-  if (S_ISREG(fst.st_mode) && fuzzy_set_total_input_length(ctx, (uint_least64_t)fst.st_size) < 0)
-    goto out;
-  if (fuzzy_update_stream(ctx, handle) < 0)
-    goto out;
-  status = fuzzy_digest(ctx, result, 0);
-out:
+  if (fuzzy_update_stream(&ctx, handle) < 0)
+    return -1;
+  status = fuzzy_digest(&ctx, result, 0);
   if (status == 0)
   {
     if (fseeko(handle, fpos, SEEK_SET) < 0)
       status = -1;
   }
-  fuzzy_free(ctx);
   return status;
 }
 
@@ -808,10 +859,11 @@ static uint32_t score_strings(const char *s1,
   unsigned long long parray[CHAR_MAX - CHAR_MIN + 1];
   size_t i;
   // skip short strings
-  if (s1len < ROLLING_WINDOW)
-    return 0;
-  if (s2len < ROLLING_WINDOW)
+  if (s1len < ROLLING_WINDOW || s2len < ROLLING_WINDOW)
+  {
+    FUZZY_COUNT(substring_rejections);
     return 0;
+  }
   // construct position array for faster string algorithms
   memset(parray, 0, sizeof(parray));
   for (i = 0; i < s1len; i++)
@@ -819,17 +871,25 @@ static uint32_t score_strings(const char *s1,
   // the two strings must have a common substring of length
   // ROLLING_WINDOW to be candidates
   if (!has_common_substring_pa(parray, s2, s2len))
+  {
+    FUZZY_COUNT(substring_rejections);
     return 0;
+  }
   // compute the edit distance between the two strings. The edit distance gives
   // us a pretty good idea of how closely related the two strings are
+  FUZZY_COUNT(edit_distances);
   score = edit_distn_pa(parray, s1len, s2, s2len);
 #else
   // the two strings must have a common substring of length
   // ROLLING_WINDOW to be candidates
   if (!has_common_substring(s1, s1len, s2, s2len))
+  {
+    FUZZY_COUNT(substring_rejections);
     return 0;
+  }
   // compute the edit distance between the two strings. The edit distance gives
   // us a pretty good idea of how closely related the two strings are
+  FUZZY_COUNT(edit_distances);
   score = edit_distn(s1, s1len, s2, s2len);
 #endif
   // compute MIN(s1len, s2len)
@@ -983,3 +1043,30 @@ int fuzzy_compare(const char *str1, const char *str2)
 
   return (int)score;
 }
+
+int fuzzy_get_stats(struct fuzzy_stats *stats)
+{
+#if FUZZY_ENABLE_STATS
+  size_t i;
+  if (NULL == stats)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  for (i = 0; i < NUM_BLOCKHASHES; ++i)
+    stats->triggers[i] =
+      __atomic_load_n(&fuzzy_stats.triggers[i], __ATOMIC_RELAXED);
+  stats->forks = __atomic_load_n(&fuzzy_stats.forks, __ATOMIC_RELAXED);
+  stats->reductions =
+    __atomic_load_n(&fuzzy_stats.reductions, __ATOMIC_RELAXED);
+  stats->substring_rejections =
+    __atomic_load_n(&fuzzy_stats.substring_rejections, __ATOMIC_RELAXED);
+  stats->edit_distances =
+    __atomic_load_n(&fuzzy_stats.edit_distances, __ATOMIC_RELAXED);
+  return 0;
+#else
+  (void)stats;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
@@ -54,6 +54,16 @@
 /// There is also a function to
 /// @link fuzzy_compare() compute the
 /// similarity between any two fuzzy signatures @endlink.
+///
+/// \par Thread safety
+/// All functions may be called from any number of threads at once,
+/// without a lock. A fuzzy_state is only used by the functions it is
+/// passed to, so different threads may use different states at the same
+/// time, but one state must not be used by two threads at once. The
+/// library has no other writable state, apart from the counts returned
+/// by fuzzy_get_stats, which are updated atomically, and errno, which
+/// every thread has its own of. fuzzy_hash_buf, fuzzy_compare and the
+/// others which don't take a state are therefore reentrant.
 
 
 #include <stdint.h>
@@ -85,6 +95,16 @@ struct fuzzy_state;
  */
 extern /*@only@*/ /*@null@*/ struct fuzzy_state *fuzzy_new(void);
 
+/**
+ * @brief Return a fuzzy_state object to the state fuzzy_new created it in.
+ *
+ * This allows one state to be used for hashing many inputs, one after the
+ * other, without allocating memory for each of them. It may be called at
+ * any time, including after an error.
+ * @param state The fuzzy state
+ */
+extern void fuzzy_reset(struct fuzzy_state *state);
+
 /**
  * @brief Create a copy of a fuzzy_state object and return it.
  *
@@ -121,6 +141,33 @@ extern int fuzzy_update(struct fuzzy_state *state,
 			const unsigned char *buffer,
 			size_t buffer_size);
 
+/**
+ * @brief A piece of data in memory, for hashing data which is not in one
+ * place without copying it
+ */
+struct fuzzy_iovec
+{
+  /** The start of the data */
+  const unsigned char *base;
+  /** The length of the data */
+  size_t len;
+};
+
+/**
+ * @brief Feed the data in several buffers to the state, one after the other.
+ *
+ * This is the same as calling fuzzy_update for each of them in turn.
+ * When an error occurs, the state is undefined. In that case it must not be
+ * passed to any function besides fuzzy_free.
+ * @param state The fuzzy state
+ * @param iov The buffers
+ * @param iovcnt The number of buffers
+ * @return zero on success, non-zero on error
+ */
+extern int fuzzy_update_iov(struct fuzzy_state *state,
+			    const struct fuzzy_iovec *iov,
+			    size_t iovcnt);
+
 /**
  * @brief Obtain the fuzzy hash from the state.
  *
@@ -159,6 +206,39 @@ extern int fuzzy_hash_buf(const unsigned char *buf,
 			  uint32_t buf_len,
 			  /*@out@*/ char *result);
 
+/**
+ * @brief Compute the fuzzy hash of a buffer of any size
+ *
+ * The same as fuzzy_hash_buf, but buf_len may be larger than 4 GiB.
+ * @param buf The data to be fuzzy hashed
+ * @param buf_len The length of the data being hashed
+ * @param result Where the fuzzy hash of buf is stored. This variable
+ * must be allocated to hold at least FUZZY_MAX_RESULT bytes.
+ * @return Returns zero on success, non-zero on error. If the buffer is
+ * too large to be hashed errno is set to EOVERFLOW.
+ */
+extern int fuzzy_hash_buffer(const unsigned char *buf,
+			     size_t buf_len,
+			     /*@out@*/ char *result);
+
+/**
+ * @brief Compute the fuzzy hash of the data in several buffers
+ *
+ * Computes the fuzzy hash of the concatenation of the buffers, without
+ * concatenating them.
+ * It is the caller's responsibility to append the filename,
+ * if any, to result after computation.
+ * @param iov The buffers
+ * @param iovcnt The number of buffers
+ * @param result Where the fuzzy hash is stored. This variable
+ * must be allocated to hold at least FUZZY_MAX_RESULT bytes.
+ * @return Returns zero on success, non-zero on error. If the buffers are
+ * too large to be hashed errno is set to EOVERFLOW.
+ */
+extern int fuzzy_hash_iov(const struct fuzzy_iovec *iov,
+			  size_t iovcnt,
+			  /*@out@*/ char *result);
+
 /**
  * @brief Compute the fuzzy hash of a file using an open handle
  *
@@ -213,6 +293,41 @@ extern int fuzzy_hash_filename(const char *filename, /*@out@*/ char * result);
 /// inputs is NULL, returns -1.
 extern int fuzzy_compare(const char *sig1, const char *sig2);
 
+/** Number of block sizes a fuzzy hash may be computed at */
+#define FUZZY_NUM_BLOCKHASHES 31
+
+/**
+ * @brief Counts of the work done by the library, for profiling
+ *
+ * The counts cover every thread since the library was loaded.
+ */
+struct fuzzy_stats
+{
+  /** Number of pieces of the input which ended at each block size,
+   *  starting with the smallest */
+  uint_least64_t triggers[FUZZY_NUM_BLOCKHASHES];
+  /** Number of times hashing started at a larger block size */
+  uint_least64_t forks;
+  /** Number of times the smallest block size was dropped */
+  uint_least64_t reductions;
+  /** Number of pairs of hashes compared without a common substring,
+   *  which were not compared any further */
+  uint_least64_t substring_rejections;
+  /** Number of edit distances computed */
+  uint_least64_t edit_distances;
+};
+
+/**
+ * @brief Obtain the counts of the work done by the library
+ *
+ * The counts are only kept if the library was configured with
+ * --enable-stats. Keeping them has no cost otherwise.
+ * @param stats Where the counts are stored
+ * @return Returns zero on success. Returns -1 and sets errno to ENOSYS if
+ * the counts are not kept.
+ */
+extern int fuzzy_get_stats(/*@out@*/ struct fuzzy_stats *stats);
+
 /** Length of an individual fuzzy hash signature component. */
 #define SPAMSUM_LENGTH 64
 
@@ -20,6 +20,7 @@
 
 
 #include "ssdeep.h"
+#include "lsh.h"
 
 void try_msg(void)
 {
@@ -35,6 +36,46 @@ bool expanded_path(TCHAR *p)
 }
 
 
+bool initialize_state(state *s)
+{
+  if (NULL == s)
+    return true;
+
+  s->mode                  = mode_none;
+  s->first_file_processed  = true;
+  s->found_meaningful_file = false;
+  s->processed_file        = false;
+
+  s->threshold = 0;
+
+  s->lsh_bands = 0;
+  s->lsh_rows  = LSH_DEFAULT_ROWS;
+  s->index     = NULL;
+
+  s->memory_budget = 0;
+  s->threads       = 0;
+  s->serve_path    = NULL;
+  s->cache         = NULL;
+  s->pipeline      = NULL;
+  s->locality      = false;
+  s->archives      = false;
+  s->binary        = false;
+  s->list_file     = NULL;
+  s->min_size      = 0;
+  s->max_size      = UINT64_MAX;
+  s->stats         = NULL;
+  s->print_stats   = false;
+  s->progress      = NULL;
+
+  s->known.handle       = NULL;
+  s->known.decompressor = NULL;
+  s->known.buffer       = NULL;
+  s->known.buffer_size  = 0;
+
+  return false;
+}
+
+
 void sanity_check(state *s, bool condition, const char *msg)
 {
   if (NULL == s)
@@ -101,6 +142,118 @@ bool my_dirname(TCHAR *c)
 
 
 
+bool parse_size(const char *str, uint64_t *result)
+{
+  char *end;
+  uint64_t multiplier = 1;
+
+  if (NULL == str || NULL == result || !isdigit((unsigned char)str[0]))
+    return true;
+
+  errno = 0;
+  unsigned long long value = strtoull(str, &end, 10);
+  if (errno)
+    return true;
+
+  switch (*end) {
+  case 'k': case 'K': multiplier = 1ull << 10; ++end; break;
+  case 'm': case 'M': multiplier = 1ull << 20; ++end; break;
+  case 'g': case 'G': multiplier = 1ull << 30; ++end; break;
+  case 't': case 'T': multiplier = 1ull << 40; ++end; break;
+  }
+
+  if (*end != 0 || value > UINT64_MAX / multiplier)
+    return true;
+
+  *result = value * multiplier;
+  return false;
+}
+
+
+/// If the first element of *pattern matches c, moves *pattern past it
+/// and returns true
+static bool glob_char(const TCHAR **pattern, TCHAR c)
+{
+  const TCHAR *p = *pattern;
+
+  if (_TEXT('?') == *p)
+  {
+    *pattern = p + 1;
+    return true;
+  }
+
+  if (_TEXT('[') == *p)
+  {
+    const TCHAR *q = p + 1;
+    bool negate = (_TEXT('!') == *q || _TEXT('^') == *q);
+    if (negate)
+      ++q;
+
+    // A ] right after the [ is one of the characters in the set
+    const TCHAR *first = q;
+    bool found = false;
+    while (*q && (q == first || *q != _TEXT(']')))
+    {
+      if (_TEXT('-') == q[1] && q[2] && q[2] != _TEXT(']'))
+      {
+	if (q[0] <= c && c <= q[2])
+	  found = true;
+	q += 3;
+      }
+      else
+      {
+	if (*q == c)
+	  found = true;
+	++q;
+      }
+    }
+
+    // Without the closing ] the [ is an ordinary character
+    if (_TEXT(']') == *q)
+    {
+      if (found == negate)
+	return false;
+      *pattern = q + 1;
+      return true;
+    }
+  }
+
+  if (*p != c)
+    return false;
+  *pattern = p + 1;
+  return true;
+}
+
+
+bool glob_match(const TCHAR *pattern, const TCHAR *str)
+{
+  // Where to start again if what follows the last * doesn't match
+  const TCHAR *star = NULL, *resume = NULL;
+
+  while (*str)
+  {
+    if (_TEXT('*') == *pattern)
+    {
+      star   = ++pattern;
+      resume = str;
+    }
+    else if (*pattern && glob_char(&pattern, *str))
+      ++str;
+    else if (star != NULL)
+    {
+      pattern = star;
+      str     = ++resume;
+    }
+    else
+      return false;
+  }
+
+  while (_TEXT('*') == *pattern)
+    ++pattern;
+  return (0 == *pattern);
+}
+
+
 void prepare_filename(state *s, TCHAR *fn)
 {
   if (s->mode & mode_barename)
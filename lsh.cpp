@@ -0,0 +1,200 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "lsh.h"
+#include "fuzzy.h"
+#include <algorithm>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The length of the substrings two signatures must have in common
+// before fuzzy_compare will give them a non-zero score
+#define LSH_GRAM_LENGTH 7
+
+// Band number used for the key which makes identical signatures collide
+#define LSH_EXACT_BAND  0xffffffffu
+
+// See http://xoshiro.di.unimi.it/splitmix64.c
+static uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+
+static uint64_t fnv1a(uint64_t h, const char * s, size_t len)
+{
+  for (size_t i = 0 ; i < len ; ++i)
+  {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+
+static uint64_t mix(uint64_t h, uint64_t v)
+{
+  h ^= v;
+  return splitmix64(&h);
+}
+
+
+// Copy one half of a signature, up to the character etoken or end,
+// removing sequences of more than three identical characters the same
+// way fuzzy_compare does. Returns the number of characters written.
+static size_t copy_eliminate_sequences(char * out,
+				       const char ** in,
+				       const char * end,
+				       char etoken)
+{
+  size_t len = 0;
+  const char * p = *in;
+
+  while (p < end && *p != etoken)
+  {
+    if (len < 3 ||
+	*p != out[len-1] || *p != out[len-2] || *p != out[len-3])
+    {
+      if (len == SPAMSUM_LENGTH)
+	break;
+      out[len++] = *p;
+    }
+    ++p;
+  }
+
+  *in = p;
+  return len;
+}
+
+
+LshIndex::LshIndex(unsigned int bands, unsigned int rows) :
+  m_bands(bands), m_rows(rows)
+{
+  uint64_t seed = 0;
+  for (unsigned int i = 0 ; i < bands * rows ; ++i)
+  {
+    // Multipliers must be odd for the hash functions to be permutations
+    m_mul.push_back(splitmix64(&seed) | 1);
+    m_add.push_back(splitmix64(&seed));
+  }
+}
+
+
+void LshIndex::half_keys(const char * s,
+			 size_t len,
+			 unsigned long block_size,
+			 std::vector<uint64_t>& out) const
+{
+  if (len < LSH_GRAM_LENGTH)
+    return;
+
+  uint64_t grams[SPAMSUM_LENGTH];
+  size_t num_grams = len - LSH_GRAM_LENGTH + 1;
+  for (size_t i = 0 ; i < num_grams ; ++i)
+    grams[i] = fnv1a(0xcbf29ce484222325ull, s + i, LSH_GRAM_LENGTH);
+
+  for (unsigned int band = 0 ; band < m_bands ; ++band)
+  {
+    uint64_t key = mix(block_size, band);
+    for (unsigned int row = 0 ; row < m_rows ; ++row)
+    {
+      unsigned int k = band * m_rows + row;
+      uint64_t min = UINT64_MAX;
+      for (size_t i = 0 ; i < num_grams ; ++i)
+      {
+	uint64_t h = grams[i] * m_mul[k] + m_add[k];
+	if (h < min)
+	  min = h;
+      }
+      key = mix(key, min);
+    }
+    out.push_back(key);
+  }
+}
+
+
+bool LshIndex::keys(const Filedata * f, std::vector<uint64_t>& out) const
+{
+  char b1[SPAMSUM_LENGTH], b2[SPAMSUM_LENGTH];
+  size_t b1len, b2len;
+  const char * sig = f->get_signature();
+  const char * end = sig + f->get_signature_length();
+
+  out.clear();
+
+  unsigned long block_size = 0;
+  const char * digits = sig;
+  while (sig < end && *sig >= '0' && *sig <= '9' && block_size <= ULONG_MAX / 10)
+    block_size = block_size * 10 + (*sig++ - '0');
+  if (sig == digits || sig == end || ':' != *sig)
+    return false;
+  ++sig;
+  b1len = copy_eliminate_sequences(b1, &sig, end, ':');
+  if (sig == end)
+    return false;
+  ++sig;
+  b2len = copy_eliminate_sequences(b2, &sig, end, ',');
+
+  // Each half is keyed by the block size it was computed with, so that
+  // signatures whose block sizes differ by a factor of two still meet.
+  half_keys(b1, b1len, block_size, out);
+  if (block_size <= ULONG_MAX / 2)
+    half_keys(b2, b2len, block_size * 2, out);
+
+  // fuzzy_compare scores identical signatures 100 even if they are
+  // too short to have any substrings in common.
+  uint64_t exact = mix(block_size, LSH_EXACT_BAND);
+  exact = fnv1a(exact, b1, b1len);
+  exact = fnv1a(exact, ":", 1);
+  exact = fnv1a(exact, b2, b2len);
+  out.push_back(exact);
+
+  return true;
+}
+
+
+void LshIndex::insert(const Filedata * f, size_t pos)
+{
+  std::vector<uint64_t> k;
+  if (!keys(f, k))
+    return;
+
+  // Two halves can produce the same key; don't record f twice.
+  std::sort(k.begin(), k.end());
+  k.erase(std::unique(k.begin(), k.end()), k.end());
+
+  std::vector<uint64_t>::const_iterator it;
+  for (it = k.begin() ; it != k.end() ; ++it)
+    m_buckets[*it].push_back(pos);
+}
+
+
+void LshIndex::candidates(const Filedata * f, std::vector<size_t>& out) const
+{
+  static thread_local std::vector<uint64_t> k;
+
+  out.clear();
+  if (!keys(f, k))
+    return;
+
+  std::vector<uint64_t>::const_iterator it;
+  for (it = k.begin() ; it != k.end() ; ++it)
+  {
+    std::unordered_map<uint64_t, std::vector<size_t> >::const_iterator b;
+    b = m_buckets.find(*it);
+    if (b != m_buckets.end())
+      out.insert(out.end(), b->second.begin(), b->second.end());
+  }
+
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
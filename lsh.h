@@ -0,0 +1,66 @@
+#ifndef __LSH_H
+#define __LSH_H
+
+/// @file lsh.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include "filedata.h"
+
+/// The default number of rows (MinHash values) combined into each band
+#define LSH_DEFAULT_ROWS  1
+
+/// The largest number of MinHash values we compute for a single signature
+#define LSH_MAX_HASHES    1024
+
+/// @brief Locality-sensitive hashing index over the set of known hashes
+///
+/// Each half of a signature is reduced to the set of its substrings of
+/// length 7 (the same unit fuzzy_compare requires two signatures to share
+/// before it scores them). Those sets are summarized with MinHash and the
+/// MinHash values are grouped into bands. Two signatures become candidates
+/// for comparison when, for some block size they have in common, all of
+/// the rows in any one band agree. Increasing the number of bands raises
+/// recall, increasing the number of rows per band lowers the number of
+/// candidates. Identical signatures are always candidates of each other.
+///
+/// The index only selects candidates; scores are still computed with
+/// fuzzy_compare.
+class LshIndex
+{
+ public:
+  LshIndex(unsigned int bands, unsigned int rows);
+
+  /// Record the known file f, stored at position pos in the set of knowns
+  void insert(const Filedata * f, size_t pos);
+
+  /// Replace the contents of out with the positions of the known files
+  /// which may be similar to f, in ascending order.
+  void candidates(const Filedata * f, std::vector<size_t>& out) const;
+
+ private:
+  unsigned int m_bands, m_rows;
+
+  /// Multipliers and increments for our family of hash functions
+  std::vector<uint64_t> m_mul, m_add;
+
+  /// Maps bucket keys to the positions of the known files in them
+  std::unordered_map<uint64_t, std::vector<size_t> > m_buckets;
+
+  /// Compute the bucket keys for f. Returns false if f is not a valid
+  /// signature.
+  bool keys(const Filedata * f, std::vector<uint64_t>& out) const;
+
+  /// Add the band keys for one half of a signature with the given
+  /// (effective) block size to out
+  void half_keys(const char * s,
+		 size_t len,
+		 unsigned long block_size,
+		 std::vector<uint64_t>& out) const;
+};
+
+#endif  // ifndef __LSH_H
@@ -10,6 +10,15 @@
 
 #include "ssdeep.h"
 #include "match.h"
+#include "lsh.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "progress.h"
+#include <thread>
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
 
 #ifdef _WIN32 
 // This can't go in main.h or we get multiple definitions of it
@@ -19,22 +28,6 @@ int _CRT_fmode = _O_BINARY;
 #endif
 
 
-static bool initialize_state(state *s)
-{
-  if (NULL == s)
-    return true;
-
-  s->mode                  = mode_none;
-  s->first_file_processed  = true;
-  s->found_meaningful_file = false;
-  s->processed_file        = false;
-
-  s->threshold = 0;
-
-  return false;
-}
-
-
 // In order to fit on one Win32 screen this function should produce
 // no more than 22 lines of output.
 static void usage(void)
@@ -61,19 +54,169 @@ static void usage(void)
   print_status ("-a - Display all matches, regardless of score");
 
   print_status ("-t - Only displays matches above the given threshold");
+  print_status ("-f - Hash the files named in the given file, or standard input for -");
+  print_status ("Long options: --lsh --memory-budget --threads --serve --cache --stats --binary");
+  print_status ("  --locality --min-size --max-size --include --exclude --progress --archives");
+
+  print_status ("-h - Display this help message; -V - Display version number and exit");
+}
+
+
+// Long options which have no single letter equivalent
+enum {
+  OPT_LSH = 256,
+  OPT_MEMORY_BUDGET,
+  OPT_THREADS,
+  OPT_SERVE,
+  OPT_CACHE,
+  OPT_LOCALITY,
+  OPT_MIN_SIZE,
+  OPT_MAX_SIZE,
+  OPT_INCLUDE,
+  OPT_EXCLUDE,
+  OPT_STATS,
+  OPT_PROGRESS,
+  OPT_ARCHIVES,
+  OPT_BINARY
+};
+
+static const struct option long_options[] = {
+  { "lsh",           required_argument, NULL, OPT_LSH           },
+  { "memory-budget", required_argument, NULL, OPT_MEMORY_BUDGET },
+  { "threads",       required_argument, NULL, OPT_THREADS       },
+  { "serve",         required_argument, NULL, OPT_SERVE         },
+  { "cache",         required_argument, NULL, OPT_CACHE         },
+  { "locality",      no_argument,       NULL, OPT_LOCALITY      },
+  { "min-size",      required_argument, NULL, OPT_MIN_SIZE      },
+  { "max-size",      required_argument, NULL, OPT_MAX_SIZE      },
+  { "include",       required_argument, NULL, OPT_INCLUDE       },
+  { "exclude",       required_argument, NULL, OPT_EXCLUDE       },
+  { "stats",         no_argument,       NULL, OPT_STATS         },
+  { "progress",      no_argument,       NULL, OPT_PROGRESS      },
+  { "archives",      no_argument,       NULL, OPT_ARCHIVES      },
+  { "binary",        no_argument,       NULL, OPT_BINARY        },
+  { NULL,            0,                 NULL, 0                 }
+};
+
+
+// Adds the argument to --include or --exclude to patterns
+static void add_pattern(std::vector<std::basic_string<TCHAR> >& patterns,
+			const char *arg)
+{
+#ifdef _WIN32
+  std::wstring pattern(strlen(arg) + 1, 0);
+  size_t len = mbstowcs(&pattern[0], arg, pattern.size());
+  if ((size_t)-1 == len)
+    fatal_error("%s: Illegal pattern", __progname);
+  pattern.resize(len);
+  patterns.push_back(pattern);
+#else
+  patterns.push_back(arg);
+#endif
+}
+
+
+// Parses the argument to --lsh, BANDS[,ROWS]
+static void parse_lsh(state *s, const char *arg)
+{
+  char *end;
 
-  print_status ("-h - Display this help message");
-  print_status ("-V - Display version number and exit");
+  s->lsh_bands = (unsigned int)strtoul(arg, &end, 10);
+  if (',' == *end)
+    s->lsh_rows = (unsigned int)strtoul(end + 1, &end, 10);
+
+  if (*end != 0 || 0 == s->lsh_bands || 0 == s->lsh_rows ||
+      s->lsh_bands > LSH_MAX_HASHES ||
+      s->lsh_rows > LSH_MAX_HASHES / s->lsh_bands)
+    fatal_error("%s: Illegal LSH parameters", __progname);
 }
 
 
 static void process_cmd_line(state *s, int argc, char **argv)
 {
   int i;
-  bool match_files_loaded = false;
+  bool match_files_loaded = false, show_progress = false;
 
-  while ((i=getopt(argc,argv,"gavhVpdsblcxt:rm:k:")) != -1) {
+  while ((i=getopt_long(argc,argv,"gavhVpdsblcxt:rm:k:f:",
+			long_options,NULL)) != -1) {
     switch(i) {
+
+    case OPT_LSH:
+      parse_lsh(s,optarg);
+      break;
+
+    case OPT_MEMORY_BUDGET:
+      if (parse_size(optarg,&s->memory_budget) || 0 == s->memory_budget)
+	fatal_error("%s: Illegal memory budget", __progname);
+      break;
+
+    case OPT_THREADS:
+      if (atol(optarg) < 1)
+	fatal_error("%s: Illegal number of threads", __progname);
+      s->threads = (unsigned int)atol(optarg);
+      break;
+
+    case OPT_SERVE:
+      s->serve_path = optarg;
+      break;
+
+    case OPT_CACHE:
+#ifdef _WIN32
+      fatal_error("%s: The cache is not supported on this platform", __progname);
+#else
+      delete s->cache;
+      s->cache = new HashCache(optarg);
+      if (s->cache->load())
+	fatal_error("%s: %s", optarg,
+		    (EINVAL == errno) ? "Not a cache file" : strerror(errno));
+#endif
+      break;
+
+    case OPT_LOCALITY:
+      s->locality = true;
+      break;
+
+    case OPT_MIN_SIZE:
+      if (parse_size(optarg, &s->min_size))
+	fatal_error("%s: Illegal minimum size", __progname);
+      break;
+
+    case OPT_MAX_SIZE:
+      if (parse_size(optarg, &s->max_size))
+	fatal_error("%s: Illegal maximum size", __progname);
+      break;
+
+    case OPT_INCLUDE:
+      add_pattern(s->include_patterns, optarg);
+      break;
+
+    case OPT_EXCLUDE:
+      add_pattern(s->exclude_patterns, optarg);
+      break;
+
+    case OPT_STATS:
+      if (NULL == s->stats)
+	s->stats = new RunStats();
+      s->print_stats = true;
+      break;
+
+    case OPT_PROGRESS:
+      if (NULL == s->stats)
+	s->stats = new RunStats();
+      show_progress = true;
+      break;
+
+    case OPT_ARCHIVES:
+#ifdef _WIN32
+      fatal_error("%s: Archives are not supported on this platform", __progname);
+#else
+      s->archives = true;
+#endif
+      break;
+
+    case OPT_BINARY:
+      s->binary = true;
+      break;
       
     case 'g':
       s->mode |= mode_cluster;
@@ -132,16 +275,18 @@ static void process_cmd_line(state *s, int argc, char **argv)
       if (MODE(mode_compare_unknown) || MODE(mode_sigcompare))
 	fatal_error("Positive matching cannot be combined with other matching modes");
       s->mode |= mode_match;
-      if (!match_load(s,optarg))
-	match_files_loaded = true;
+      s->known_files.push_back(optarg);
       break;
       
     case 'k':
       if (MODE(mode_match) || MODE(mode_sigcompare))
 	fatal_error("Signature matching cannot be combined with other matching modes");
       s->mode |= mode_compare_unknown;
-      if (!match_load(s,optarg))
-	match_files_loaded = true;
+      s->known_files.push_back(optarg);
+      break;
+
+    case 'f':
+      s->list_file = optarg;
       break;
 
     case 'h':
@@ -158,14 +303,6 @@ static void process_cmd_line(state *s, int argc, char **argv)
     }
   }
 
-  // We don't include mode_sigcompare in this list as we haven't loaded
-  // the matching files yet. In that mode the matching files are in fact 
-  // the command line arguments.
-  sanity_check(s,
-	       ((MODE(mode_match) || MODE(mode_compare_unknown))
-		&& !match_files_loaded),
-	       "No matching files loaded");
-  
   sanity_check(s,
 	       ((s->mode & mode_barename) && (s->mode & mode_relative)),
 	       "Relative paths and bare names are mutually exclusive");
@@ -178,6 +315,21 @@ static void process_cmd_line(state *s, int argc, char **argv)
 	       MODE(mode_csv) && MODE(mode_cluster),
 	       "CSV and clustering modes cannot be combined");
 
+  // The index only finds files which have something in common
+  sanity_check(s,
+	       MODE(mode_display_all) && s->lsh_bands > 0,
+	       "Displaying all matches and the LSH index cannot be combined");
+
+  // The memory budget applies to comparing signature files without
+  // loading them, which in turn only produces pretty matching output.
+  sanity_check(s,
+	       s->memory_budget > 0 && !MODE(mode_sigcompare),
+	       "A memory budget can only be used with signature file matching");
+
+  sanity_check(s,
+	       s->memory_budget > 0 && (MODE(mode_cluster) || s->lsh_bands > 0),
+	       "A memory budget cannot be combined with clustering or the LSH index");
+
   // -m, -p, and -d are incompatible with -k and -x
   // The former treat FILES as raw files. The latter require them to be sigs
   sanity_check(s,
@@ -186,6 +338,102 @@ static void process_cmd_line(state *s, int argc, char **argv)
 		(MODE(mode_compare_unknown) || MODE(mode_sigcompare))),
 	       "Incompatible matching modes");
 
+  if (0 == s->threads)
+    s->threads = std::thread::hardware_concurrency();
+  if (0 == s->threads)
+    s->threads = 1;
+
+  // The server answers queries about single files against the known
+  // hashes; it has nothing to do with FILES or the modes which compare
+  // them against each other.
+  sanity_check(s,
+	       s->serve_path != NULL &&
+	       !(MODE(mode_match) || MODE(mode_compare_unknown)),
+	       "Serving requires a file of known hashes");
+
+  sanity_check(s,
+	       s->serve_path != NULL &&
+	       (MODE(mode_match_pretty) || MODE(mode_directory) ||
+		MODE(mode_cluster) || s->memory_budget > 0),
+	       "Serving cannot be combined with pretty matching, directory mode, clustering, or a memory budget");
+
+  sanity_check(s,
+	       s->serve_path != NULL && optind != argc,
+	       "Serving does not take any FILES");
+
+  // Only files we hash ourselves can be cached
+  sanity_check(s,
+	       s->cache != NULL &&
+	       (MODE(mode_compare_unknown) || MODE(mode_sigcompare) ||
+		s->serve_path != NULL),
+	       "The cache can only be used when hashing files");
+
+  sanity_check(s,
+	       s->locality &&
+	       (MODE(mode_compare_unknown) || MODE(mode_sigcompare) ||
+		s->serve_path != NULL),
+	       "Disk order can only be used when hashing files");
+
+  sanity_check(s,
+	       s->archives &&
+	       (MODE(mode_compare_unknown) || MODE(mode_sigcompare) ||
+		s->serve_path != NULL),
+	       "Archives can only be opened when hashing files");
+
+  // Only plain hashing writes hashes; matching writes results
+  sanity_check(s,
+	       s->binary &&
+	       (MODE(mode_match) || MODE(mode_match_pretty) ||
+		MODE(mode_directory) || MODE(mode_cluster) ||
+		MODE(mode_compare_unknown) || MODE(mode_sigcompare) ||
+		s->serve_path != NULL),
+	       "Binary output can only be used when hashing files");
+
+  sanity_check(s,
+	       s->binary && isatty(fileno(stdout)),
+	       "Binary output cannot be written to a terminal");
+
+  sanity_check(s,
+	       s->list_file != NULL &&
+	       (MODE(mode_compare_unknown) || MODE(mode_sigcompare) ||
+		s->serve_path != NULL),
+	       "A list of files can only be used when hashing files");
+
+  sanity_check(s,
+	       (s->min_size > 0 || s->max_size != UINT64_MAX ||
+		!s->include_patterns.empty() || !s->exclude_patterns.empty()) &&
+	       (MODE(mode_compare_unknown) || MODE(mode_sigcompare) ||
+		s->serve_path != NULL),
+	       "Files can only be selected when hashing files");
+
+  sanity_check(s,
+	       s->min_size > s->max_size,
+	       "The minimum size is larger than the maximum size");
+
+  // Both rewrite the last line of stderr
+  sanity_check(s,
+	       show_progress && MODE(mode_verbose),
+	       "Verbose mode and progress reporting are mutually exclusive");
+
+  sanity_check(s,
+	       show_progress && s->serve_path != NULL,
+	       "Progress cannot be reported when serving");
+
+  if (show_progress)
+    s->progress = new ProgressReporter(s);
+
+  if (!s->known_files.empty() &&
+      !match_load(s, &s->known_files[0], (int)s->known_files.size()))
+    match_files_loaded = true;
+
+  // We don't include mode_sigcompare in this list as we haven't loaded
+  // the matching files yet. In that mode the matching files are in fact 
+  // the command line arguments.
+  sanity_check(s,
+	       ((MODE(mode_match) || MODE(mode_compare_unknown))
+		&& !match_files_loaded),
+	       "No matching files loaded");
+
 
 }
 
@@ -243,6 +491,152 @@ static void generate_filename(state *s, TCHAR *fn, TCHAR *cwd, TCHAR *input)
 }
 
 
+// How much of a list of files we read at once
+#define LIST_BUFFER_SIZE  (1 << 16)
+
+// How long to wait for more of a list, in milliseconds, before showing
+// the results of the files which are done
+#define LIST_WAIT_MS  100
+
+/// Reads the next part of the list of files open on fd into buffer
+static ssize_t read_list(state *s, int fd, char *buffer, size_t size)
+{
+#ifdef HAVE_POLL_H
+  // The names may be written by another program as it finds the files.
+  // Don't hold on to the results while we wait for it.
+  if (s->pipeline != NULL)
+  {
+    struct pollfd pfd;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    while (0 == poll(&pfd, 1, LIST_WAIT_MS))
+    {
+      s->pipeline->display_done();
+      stdout_output().flush();
+      fflush(stdout);
+    }
+  }
+#else
+  (void)s;
+#endif
+
+  ssize_t n;
+  do
+  {
+    n = read(fd, buffer, size);
+  } while (n < 0 && EINTR == errno);
+
+  return n;
+}
+
+
+/// Hashes the file name, which was read from a list of files
+static bool process_list_entry(state *s, char *name, TCHAR *fn, TCHAR *cwd)
+{
+  if ('\0' == name[0])
+    return false;
+
+#ifdef _WIN32
+  TCHAR input[SSDEEP_PATH_MAX];
+  if (0 == MultiByteToWideChar(CP_UTF8, 0, name, -1, input, SSDEEP_PATH_MAX))
+  {
+    print_error(s, "%s: Invalid file name", name);
+    return true;
+  }
+  generate_filename(s, fn, cwd, input);
+  return process_win32(s, fn);
+#else
+  if (strlen(name) >= SSDEEP_PATH_MAX)
+  {
+    print_error(s, "%s: %s", name, strerror(ENAMETOOLONG));
+    return true;
+  }
+  generate_filename(s, fn, cwd, name);
+  return process_normal(s, fn);
+#endif
+}
+
+
+/// Hashes each of the files named in the file list_fn, or in standard
+/// input if list_fn is "-". The names are separated by NUL characters if
+/// there is one before the first newline, otherwise by newlines.
+static bool process_list(state *s, const char *list_fn, TCHAR *fn, TCHAR *cwd)
+{
+  int fd = STDIN_FILENO;
+  if (strcmp(list_fn, "-"))
+    fd = open(list_fn, O_RDONLY);
+  if (fd < 0)
+  {
+    print_error(s, "%s: %s", list_fn, strerror(errno));
+    return true;
+  }
+
+  std::vector<char> buffer(LIST_BUFFER_SIZE);
+  std::string data;
+  // The separator, or -1 until we know which it is
+  int separator = -1;
+  bool status = false;
+  ssize_t n;
+
+  while ((n = read_list(s, fd, &buffer[0], buffer.size())) > 0)
+  {
+    data.append(&buffer[0], n);
+
+    if (separator < 0)
+    {
+      size_t nul = data.find('\0'), nl = data.find('\n');
+      if (nul != std::string::npos && (std::string::npos == nl || nul < nl))
+	separator = 0;
+      else if (nl != std::string::npos)
+	separator = '\n';
+      else
+	continue;
+    }
+
+    size_t start = 0, end;
+    while ((end = data.find((char)separator, start)) != std::string::npos)
+    {
+      // Lists written on Windows have \r\n at the end of each line
+      data[end] = 0;
+      if ('\n' == separator && end > start && '\r' == data[end - 1])
+	data[end - 1] = 0;
+      status = process_list_entry(s, &data[start], fn, cwd) || status;
+      start = end + 1;
+    }
+    data.erase(0, start);
+  }
+
+  if (n < 0)
+  {
+    print_error(s, "%s: %s", list_fn, strerror(errno));
+    status = true;
+  }
+  else if (!data.empty())
+  {
+    // The last name doesn't need a separator after it
+    if (separator != 0 && '\r' == data[data.size() - 1])
+      data.erase(data.size() - 1);
+    status = process_list_entry(s, &data[0], fn, cwd) || status;
+  }
+
+  if (fd != STDIN_FILENO)
+    close(fd);
+  return status;
+}
+
+
+/// Stops showing the progress and writes the statistics for --stats,
+/// if they were asked for
+static void report_stats(state *s)
+{
+  delete s->progress;
+  s->progress = NULL;
+
+  if (s->print_stats)
+    s->stats->report();
+}
+
+
 int main(int argc, char **argv)
 {
   int count, goal = argc;
@@ -268,10 +662,20 @@ int main(int argc, char **argv)
   s->argv = argv;
 #endif
 
+  if (s->progress != NULL)
+    s->progress->measure(s->argv + optind, s->argc - optind);
+
+  if (s->serve_path != NULL)
+  {
+    status = serve(s, s->serve_path);
+    report_stats(s);
+    return (status ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+
   // Anything left on the command line at this point is a file
   // or directory we're supposed to process. If there's nothing
   // specified, we should tackle standard input 
-  if (optind == argc) {
+  if (optind == argc && NULL == s->list_file) {
     status = process_stdin(s);
   }
   else {
@@ -294,26 +698,54 @@ int main(int argc, char **argv)
     if (!(s->mode & mode_sigcompare)) {
       goal = s->argc;
     }
+
+    // With a memory budget the signature files are compared as they are
+    // read instead of being loaded first.
+    if (MODE(mode_sigcompare) && s->memory_budget > 0) {
+      s->mode |= mode_match_pretty;
+      match_sharded(s, argv + count, goal - count);
+      report_stats(s);
+      return (EXIT_SUCCESS);
+    }
+    
+    // All of the signature files are loaded at once, so that they
+    // can be read in parallel.
+    if (MODE(mode_sigcompare)) {
+      match_load(s, argv + count, goal - count);
+      count = goal;
+    }
     
+    // Files are read and hashed on other threads while we look for more
+    if (!MODE(mode_compare_unknown))
+      s->pipeline = HashPipeline::create(s);
+
     while (count < goal)
     {
-      if (MODE(mode_sigcompare))
-	match_load(s,argv[count]);
-      else if (MODE(mode_compare_unknown))
+      if (MODE(mode_compare_unknown))
 	match_compare_unknown(s,argv[count]);
       else {
 	generate_filename(s, fn, cwd, s->argv[count]);
 	
 #ifdef _WIN32
-	status = status || process_win32(s, fn);
+	status = process_win32(s, fn) || status;
 #else
-	status = status || process_normal(s, fn);
+	status = process_normal(s, fn) || status;
 #endif
       }
       
       ++count;
     }
 
+    if (s->list_file != NULL)
+      status = process_list(s, s->list_file, fn, cwd) || status;
+
+    // Waiting for the last files is part of hashing them
+    {
+      StatsPhase phase(s->stats, PHASE_HASH);
+      delete s->pipeline;
+      s->pipeline = NULL;
+    }
+
     // If we processed files, but didn't find anything large enough
     // to be meaningful, we should display a warning message to the user.
     // This happens mostly when people are testing very small files
@@ -324,6 +756,8 @@ int main(int argc, char **argv)
     }
   }
 
+  if (s->cache != NULL && s->cache->save())
+    print_error(s, "%s: Unable to save the cache: %s", __progname, strerror(errno));
 
   // If the user has requested us to compare signature files, use
   // our existng code to pretty-print directory matching to do the
@@ -335,5 +769,6 @@ int main(int argc, char **argv)
   if (MODE(mode_cluster))
     display_clusters(s);
 
+  report_stats(s);
   return (EXIT_SUCCESS);
 }
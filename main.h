@@ -85,6 +85,10 @@
 # include <libgen.h>
 #endif
 
+#ifdef HAVE_GETOPT_H
+# include <getopt.h>
+#endif
+
 
 // This allows us to open standard input in binary mode by default 
 // See http://gnuwin32.sourceforge.net/compile.html for more.
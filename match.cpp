@@ -19,9 +19,16 @@
 
 
 #include "match.h"
+#include "lsh.h"
+#include "stats.h"
+#include "spamsum.h"
+#include "decompress.h"
+#include <atomic>
+#include <thread>
 
-// The longest line we should encounter when reading files of known hashes 
-#define MAX_STR_LEN  2048
+// How much of a file of known hashes we read at once. Longer lines
+// are fine; the buffer grows to fit them.
+#define KNOWN_BUFFER_SIZE  (1 << 18)
 
 #define MIN_SUBSTR_LEN 7
 
@@ -29,6 +36,147 @@
 // SIGNATURE FILE FUNCTIONS
 // ------------------------------------------------------------------
 
+/// Prepare r to read the next remaining bytes from handle
+static void sig_reader_init(sig_reader_t *r, FILE * handle, uint64_t remaining)
+{
+  if (NULL == r->buffer)
+  {
+    r->buffer_size = KNOWN_BUFFER_SIZE;
+    r->buffer = (char *)malloc(r->buffer_size);
+    if (NULL == r->buffer)
+      fatal_error("%s: Out of memory", __progname);
+  }
+
+  r->handle    = handle;
+  r->decompressor = NULL;
+  r->pos       = 0;
+  r->len       = 0;
+  r->remaining = remaining;
+  r->eof       = (0 == remaining);
+  r->binary    = false;
+}
+
+
+/// Move the unread data to the front of the buffer and read more after
+/// it. If the unread data fills the whole buffer, it has to grow.
+static void sig_reader_fill(sig_reader_t *r)
+{
+  size_t avail = r->len - r->pos;
+  memmove(r->buffer, r->buffer + r->pos, avail);
+  r->pos = 0;
+  r->len = avail;
+
+  if (avail == r->buffer_size)
+  {
+    r->buffer_size *= 2;
+    r->buffer = (char *)realloc(r->buffer, r->buffer_size);
+    if (NULL == r->buffer)
+      fatal_error("%s: Out of memory", __progname);
+  }
+
+  size_t want = r->buffer_size - avail;
+  if (want > r->remaining)
+    want = (size_t)r->remaining;
+
+  size_t got;
+  if (r->decompressor)
+    got = r->decompressor->read(r->buffer + avail, want);
+  else
+    got = fread(r->buffer + avail, 1, want, r->handle);
+  r->len += got;
+  r->remaining -= got;
+  if (got < want || 0 == r->remaining)
+    r->eof = true;
+}
+
+
+/// Find the next line in the file of known hashes, refilling the read
+/// buffer as needed. The line is not NUL terminated and doesn't include
+/// the newline. As with fgets, the line ends at any NUL character.
+///
+/// @return Returns false if there are no more lines, true otherwise
+static bool sig_reader_line(sig_reader_t *r, const char ** line, size_t * len)
+{
+  const char * start, * end;
+
+  for (;;)
+  {
+    start = r->buffer + r->pos;
+    size_t avail = r->len - r->pos;
+
+    end = (const char *)memchr(start, '\n', avail);
+    if (end)
+    {
+      r->pos += (end - start) + 1;
+      break;
+    }
+
+    if (r->eof)
+    {
+      if (0 == avail)
+	return false;
+      end = start + avail;
+      r->pos = r->len;
+      break;
+    }
+
+    sig_reader_fill(r);
+  }
+
+  const char * nul = (const char *)memchr(start, 0, end - start);
+  if (nul)
+    end = nul;
+
+  // Remove the newlines, if any. Works on both DOS and *nix newlines
+  while (end > start && ('\r' == end[-1] || '\n' == end[-1]))
+    --end;
+
+  *line = start;
+  *len  = end - start;
+  return true;
+}
+
+
+/// Decode the next record in a file of known hashes in the binary
+/// format, refilling the read buffer as needed. A bad record leaves no
+/// way to find the one after it, so the rest of the file is skipped.
+///
+/// @return Returns false if there are no more records, true otherwise.
+/// On a bad record, *f is NULL.
+static bool sig_reader_record(sig_reader_t *r,
+			      Arena& arena,
+			      const char * match_file,
+			      Filedata ** f)
+{
+  for (;;)
+  {
+    size_t avail = r->len - r->pos, used;
+    *f = Filedata::decode(arena,
+			  (const unsigned char *)r->buffer + r->pos,
+			  avail,
+			  &used,
+			  match_file);
+    if (*f != NULL)
+    {
+      r->pos += used;
+      return true;
+    }
+
+    if (used > 0 || r->eof)
+    {
+      if (0 == avail)
+	return false;
+      r->pos = r->len;
+      r->remaining = 0;
+      r->eof = true;
+      return true;
+    }
+
+    sig_reader_fill(r);
+  }
+}
+
+
 /// Open a file of known hashes and determine if it's valid
 ///
 /// @param s State variable
@@ -40,38 +188,73 @@ bool sig_file_open(state *s, const char * fn)
   if (NULL == s || NULL == fn)
     return true;
 
-  s->known_handle = fopen(fn,"rb");
-  if (NULL == s->known_handle)
+  FILE * handle = fopen(fn,"rb");
+  if (NULL == handle)
   {
     if ( ! (MODE(mode_silent)) )
       perror(fn);
     return true;
   }
 
+  sig_reader_init(&s->known, handle, UINT64_MAX);
+  s->known_fn = s->arena.copy<char>(fn, strlen(fn));
+
+  // Compressed files are recognized by their first bytes, which have
+  // been read by the time we know. They're decompressed again from there.
+  sig_reader_fill(&s->known);
+  Decompressor::format_t format =
+    Decompressor::detect(s->known.buffer, s->known.len);
+  if (format != Decompressor::format_none)
+  {
+    if (!Decompressor::supported(format))
+    {
+      if ( ! (MODE(mode_silent)) )
+	print_error(s,
+		    "%s: Compressed with %s, which this build can't read",
+		    fn,
+		    Decompressor::name(format));
+      fclose(handle);
+      s->known.handle = NULL;
+      return true;
+    }
+
+    s->known.decompressor = new Decompressor(format,
+					     handle,
+					     s->known.buffer,
+					     s->known.len);
+    s->known.pos       = 0;
+    s->known.len       = 0;
+    s->known.remaining = UINT64_MAX;
+    s->known.eof       = false;
+  }
+
   // The first line of the file should contain a valid ssdeep header. 
-  char buffer[MAX_STR_LEN];
-  if (NULL == fgets(buffer,MAX_STR_LEN,s->known_handle))
+  const char * line;
+  size_t len;
+  if (!sig_reader_line(&s->known, &line, &len))
   {
     if ( ! (MODE(mode_silent)) )
       perror(fn);
-    fclose(s->known_handle);
+    sig_file_close(s);
     return true;
   }
 
-  chop_line(buffer);
-
-  if (strncmp(buffer,SSDEEPV1_0_HEADER,MAX_STR_LEN) &&
-      strncmp(buffer,SSDEEPV1_1_HEADER,MAX_STR_LEN)) 
+  s->known.binary = (len == strlen(SSDEEPV2_0_HEADER) &&
+		     !memcmp(line, SSDEEPV2_0_HEADER, len));
+  if (!(len == strlen(SSDEEPV1_0_HEADER) &&
+	!memcmp(line, SSDEEPV1_0_HEADER, len)) &&
+      !(len == strlen(SSDEEPV1_1_HEADER) &&
+	!memcmp(line, SSDEEPV1_1_HEADER, len)) &&
+      !s->known.binary)
   {
     if ( ! (MODE(mode_silent)) )
       print_error(s,"%s: Invalid file header.", fn);
-    fclose(s->known_handle);
+    sig_file_close(s);
     return true;
   }
 
   // We've now read the first line
   s->line_number = 1;
-  s->known_fn = strdup(fn);
 
   return false;
 }
@@ -82,32 +265,46 @@ bool sig_file_open(state *s, const char * fn)
 /// it to a Filedata 
 ///
 /// @param s State variable
+/// @param arena Where to allocate the data we read
 /// @param f Structure where to store the data we read
 ///
 /// @return Returns true if there is no entry to read or on error. 
 /// Otherwise, false.
-bool sig_file_next(state *s, Filedata ** f)
+bool sig_file_next(state *s, Arena& arena, Filedata ** f)
 {
-  if (NULL == s || NULL == f || NULL == s->known_handle)
+  if (NULL == s || NULL == f || NULL == s->known.handle)
     return true;
 
-  char buffer[MAX_STR_LEN];
-  memset(buffer,0,MAX_STR_LEN);
-  if (NULL == fgets(buffer,MAX_STR_LEN,s->known_handle))
+  if (s->known.binary)
+  {
+    if (!sig_reader_record(&s->known, arena, s->known_fn, f))
+      return true;
+
+    s->line_number++;
+    if (NULL == *f)
+    {
+      print_error(s,
+		  "%s: Bad record %llu",
+		  s->known_fn,
+		  s->line_number - 1);
+      return true;
+    }
+    return false;
+  }
+
+  const char * line;
+  size_t len;
+  if (!sig_reader_line(&s->known, &line, &len))
     return true;
 
   s->line_number++;
-  chop_line(buffer);
 
-  try 
-  {
-    *f = new Filedata(std::string(buffer),s->known_fn);
-  }
-  catch (const std::bad_alloc&)
+  *f = Filedata::parse(arena, line, len, s->known_fn);
+  if (NULL == *f)
   {
     // This can happen on a badly formatted line, or a blank one.
     // We don't display errors on blank lines.
-    if (strlen(buffer) > 0)
+    if (len > 0)
       print_error(s,
 		  "%s: Bad hash in line %llu", 
 		  s->known_fn, 
@@ -125,12 +322,22 @@ bool sig_file_close(state *s)
   if (NULL == s)
     return true;
 
-  free(s->known_fn);
-
-  if (s->known_handle == NULL)
+  if (s->known.handle == NULL)
     return true;
 
-  if (fclose(s->known_handle))
+  // Whatever stopped decompressing early is only known at the end
+  if (s->known.decompressor)
+  {
+    const char * error = s->known.decompressor->error();
+    if (s->known.eof && error)
+      print_error(s, "%s: %s", s->known_fn, error);
+    delete s->known.decompressor;
+    s->known.decompressor = NULL;
+  }
+
+  FILE * handle = s->known.handle;
+  s->known.handle = NULL;
+  if (fclose(handle))
     return true;
   
   return false;
@@ -139,7 +346,7 @@ bool sig_file_close(state *s)
 
 bool sig_file_end(state *s)
 {
-  return (feof(s->known_handle));
+  return (s->known.eof && s->known.pos == s->known.len);
 }
 
 
@@ -160,8 +367,8 @@ void display_clusters(const state *s)
     std::set<Filedata *>::const_iterator cit;
     for (cit = (*it)->begin() ; cit != (*it)->end() ; ++cit)
     {
-      display_filename(stdout, (*cit)->get_filename(), false);
-      print_status("");
+      stdout_output().filename((*cit)->get_filename(), false);
+      stdout_output().newline();
     }
     
     print_status("");
@@ -254,15 +461,18 @@ void handle_clustering(state *s, Filedata *a, Filedata *b)
 void handle_match(state *s, 
 		  Filedata *a, 
 		  Filedata *b, 
-		  int score)
+		  int score,
+		  Output& out)
 {
   if (s->mode & mode_csv)
   {
-    printf("\"");
-    display_filename(stdout, a->get_filename(), true);
-    printf("\",\"");
-    display_filename(stdout, b->get_filename(), true);
-    print_status("\",%u", score);
+    out.put('"');
+    out.filename(a->get_filename(), true);
+    out.write("\",\"", 3);
+    out.filename(b->get_filename(), true);
+    out.write("\",", 2);
+    out.number(score);
+    out.newline();
   }
   else if (s->mode & mode_cluster)
   {
@@ -273,60 +483,234 @@ void handle_match(state *s,
     // The match file names may be empty. If so, we don't print them
     // or the colon which separates them from the filename
     if (a->has_match_file())
-      printf ("%s:", a->get_match_file().c_str());
-    display_filename(stdout, a->get_filename(), false);
-    printf (" matches ");
+    {
+      out.text(a->get_match_file());
+      out.put(':');
+    }
+    out.filename(a->get_filename(), false);
+    out.write(" matches ", 9);
     if (b->has_match_file())
-      printf ("%s:", b->get_match_file().c_str());
-    display_filename(stdout, b->get_filename(), false);
-    print_status(" (%u)", score);
+    {
+      out.text(b->get_match_file());
+      out.put(':');
+    }
+    out.filename(b->get_filename(), false);
+    out.write(" (", 2);
+    out.number(score);
+    out.put(')');
+    out.newline();
+  }
+}
+
+
+/// Returns true if f and k are the same file, in which case we don't
+/// display them as matching each other
+static bool is_same_file(state *s, Filedata * f, Filedata * k)
+{
+  // When in pretty mode, we still want to avoid printing
+  // A matches A (100).
+  if (s->mode & mode_match_pretty)
+  {
+    if (f->get_filename_length() == k->get_filename_length() &&
+	!(_tcsncmp(f->get_filename(),
+		   k->get_filename(),
+		   f->get_filename_length())) &&
+	f->same_signature(k))
+    {
+      // Unless these results from different matching files (such as
+      // what happens in sigcompare mode). That being said, we have to
+      // be careful to avoid NULL values such as when working in 
+      // normal pretty print mode.
+      if (!f->has_match_file() || f->same_match_file(k))
+	return true;
+    }
+  }
+
+  return false;
+}
+
+
+/// Returns the score if it should be displayed, -1 otherwise
+static int filter_score(state *s, int score)
+{
+  if (-1 == score)
+    print_error(s, "%s: Bad hashes in comparison", __progname);
+  else
+  {
+    if (score > s->threshold || MODE(mode_display_all))
+      return score;
+  }
+
+  return -1;
+}
+
+
+/// Returns true if fuzzy_compare would score signatures a and b as zero
+/// because of their block sizes, without comparing their hashes
+static bool blocksizes_differ(const char * a, const char * b)
+{
+  unsigned long x = strtoul(a, NULL, 10), y = strtoul(b, NULL, 10);
+  return (x != y &&
+	  (x > ULONG_MAX / 2 || x * 2 != y) &&
+	  (y > ULONG_MAX / 2 || y * 2 != x));
+}
+
+
+int match_score(state *s, Filedata * f, Filedata * k)
+{
+  if (is_same_file(s, f, k))
+    return -1;
+
+  if (s->stats != NULL)
+  {
+    ++s->stats->comparisons;
+    if (blocksizes_differ(f->get_signature(), k->get_signature()))
+      ++s->stats->comparisons_rejected;
+  }
+
+  return filter_score(s, FuzzyEngine::compare(f->get_signature(),
+					      k->get_signature()));
+}
+
+
+/// The score of a known signature, which is only meaningful when query
+/// is the number of the file being compared
+typedef struct
+{
+  uint32_t query;
+  int      score;
+} score_slot_t;
+
+/// Scores of the known signatures against the file being compared, by
+/// signature id. Each file gets a new query number, so the scores of the
+/// files before it don't have to be cleared.
+typedef struct
+{
+  std::vector<score_slot_t> slots;
+  uint32_t                  query;
+} score_cache_t;
+
+/// What comparing one file did, for --stats
+typedef struct compare_counts
+{
+  uint64_t compared, rejected, skipped, matched;
+} compare_counts_t;
+
+/// Compare f against the known file k and display the match, if any.
+/// Each distinct known signature is only compared once; its score
+/// is kept in scores and reused for every file that shares it.
+///
+/// @return Returns true if the files matched, false otherwise
+static bool match_compare_one(state *s,
+			      Filedata * f,
+			      Filedata * k,
+			      score_cache_t& scores,
+			      compare_counts_t& counts,
+			      Output& out)
+{
+  if (is_same_file(s, f, k))
+    return false;
+
+  score_slot_t& slot = scores.slots[k->get_signature_id()];
+  int& score = slot.score;
+  if (slot.query != scores.query)
+  {
+    slot.query = scores.query;
+    if (s->stats != NULL)
+    {
+      ++counts.compared;
+      if (blocksizes_differ(f->get_signature(), k->get_signature()))
+	++counts.rejected;
+    }
+    score = FuzzyEngine::compare(f->get_signature(),
+				 k->get_signature());
   }
+  else
+    ++counts.skipped;
+
+  int display = filter_score(s, score);
+  if (-1 == display)
+    return false;
+
+  handle_match(s,f,k,display,out);
+  ++counts.matched;
+  return true;
 }
 
 
-bool match_compare(state *s, Filedata * f)
+void match_build_index(state *s)
+{
+  if (0 == s->lsh_bands || s->index != NULL)
+    return;
+
+  s->index = new LshIndex(s->lsh_bands, s->lsh_rows);
+  for (size_t i = 0 ; i < s->all_files.size() ; ++i)
+    s->index->insert(s->all_files[i], i);
+}
+
+
+bool match_compare(state *s, Filedata * f, Output& out)
 {
   if (NULL == s)
     fatal_error("%s: Null state passed into match_compare", __progname);
 
+  StatsPhase phase(s->stats, PHASE_COMPARE);
   bool status = false;  
-  size_t fn_len = _tcslen(f->get_filename());
+  compare_counts_t counts = { 0, 0, 0, 0 };
+
+  // These are reused from one call to the next so that comparing a file
+  // doesn't allocate any memory once they have grown large enough.
+  // The scores only grow when there are more known signatures, and
+  // nothing in them is cleared, so that a file compared against a few
+  // candidates doesn't cost as much as one compared against them all.
+  static thread_local score_cache_t scores;
+  static thread_local std::vector<size_t> candidates;
+  if (scores.slots.size() < s->signature_ids.size())
+  {
+    score_slot_t unused = { 0, 0 };
+    scores.slots.resize(s->signature_ids.size(), unused);
+  }
+  if (0 == ++scores.query)
+  {
+    // The query numbers have wrapped around, so the oldest scores
+    // could be taken for this file's
+    for (size_t i = 0 ; i < scores.slots.size() ; ++i)
+      scores.slots[i].query = 0;
+    scores.query = 1;
+  }
 
-  std::vector<Filedata* >::const_iterator it;
-  for (it = s->all_files.begin() ; it != s->all_files.end() ; ++it)
+  if (s->lsh_bands > 0)
   {
-    // When in pretty mode, we still want to avoid printing
-    // A matches A (100).
-    if (s->mode & mode_match_pretty)
-    {
-      if (!(_tcsncmp(f->get_filename(),
-		     (*it)->get_filename(),
-		     std::max(fn_len,_tcslen((*it)->get_filename())))) &&
-	  (f->get_signature() == (*it)->get_signature()))
-      {
-	// Unless these results from different matching files (such as
-	// what happens in sigcompare mode). That being said, we have to
-	// be careful to avoid NULL values such as when working in 
-	// normal pretty print mode.
-	if (!f->has_match_file() ||
-	    f->get_match_file() == (*it)->get_match_file())
-	  continue;
-      }
-    }
+    match_build_index(s);
 
-    int score =  fuzzy_compare(f->get_signature().c_str(), 
-			       (*it)->get_signature().c_str());
-    if (-1 == score)
-      print_error(s, "%s: Bad hashes in comparison", __progname);
-    else
+    // Only the candidates are scored, but they are visited in the
+    // same order as the full scan below would visit them.
+    s->index->candidates(f, candidates);
+
+    std::vector<size_t>::const_iterator it;
+    for (it = candidates.begin() ; it != candidates.end() ; ++it)
+      if (match_compare_one(s, f, s->all_files[*it], scores, counts, out))
+	status = true;
+
+    counts.skipped += s->all_files.size() - candidates.size();
+  }
+  else
+  {
+    std::vector<Filedata* >::const_iterator it;
+    for (it = s->all_files.begin() ; it != s->all_files.end() ; ++it)
     {
-      if (score > s->threshold || MODE(mode_display_all))
-      {
-	handle_match(s,f,(*it),score);
+      if (match_compare_one(s, f, *it, scores, counts, out))
 	status = true;
-      }
     }
   }
+
+  if (s->stats != NULL)
+  {
+    s->stats->comparisons          += counts.compared;
+    s->stats->comparisons_rejected += counts.rejected;
+    s->stats->comparisons_skipped  += counts.skipped;
+    s->stats->matches              += counts.matched;
+  }
   
   return status;
 }
@@ -357,37 +741,294 @@ bool match_add(state *s, Filedata * f) {
   if (NULL == s)
     return true;
 
+  // Identical signatures share an id, so they are only scored once
+  size_t id = s->signature_ids.size();
+  id = s->signature_ids.insert(std::make_pair(f, id)).first->second;
+  f->set_signature_id(id);
+
   s->all_files.push_back(f);
+  if (s->index)
+    s->index->insert(f, s->all_files.size() - 1);
 
   return false;
 }
 
 
-bool match_load(state *s, const char *fn) {
+// Files of known hashes are split into pieces of at least this many
+// bytes, which are parsed in parallel
+#define LOAD_PIECE_SIZE  (1 << 20)
+
+/// A range of lines from a file of known hashes and what we found there
+typedef struct
+{
+  /// Index of the file, and its name in the state's arena
+  size_t file;
+  const char * name;
+  /// Byte range to parse
+  off_t start, end;
+  /// Error number if the file could not be read again, or zero
+  int error;
+  /// True once the piece has been parsed
+  bool parsed;
+
+  /// The known hashes parsed from this piece, allocated in arena
+  Arena * arena;
+  std::vector<Filedata *> entries;
+  /// Number of lines in the piece, and the line number of each
+  /// bad line, counting from the start of the piece. For the binary
+  /// format, these are records.
+  uint64_t lines;
+  std::vector<uint64_t> bad_lines;
+  /// True if the piece is in the binary format
+  bool binary;
+} load_piece_t;
+
+
+/// Parse every line from r into p
+static void load_parse(sig_reader_t *r, load_piece_t *p)
+{
+  const char * line;
+  size_t len;
+
+  if (r->binary)
+  {
+    Filedata * f;
+    while (sig_reader_record(r, *p->arena, p->name, &f))
+    {
+      p->lines++;
+      if (f)
+	p->entries.push_back(f);
+      else
+	p->bad_lines.push_back(p->lines);
+    }
+
+    p->parsed = true;
+    return;
+  }
+
+  while (sig_reader_line(r, &line, &len))
+  {
+    p->lines++;
+
+    Filedata * f = Filedata::parse(*p->arena, line, len, p->name);
+    if (f)
+      p->entries.push_back(f);
+    else if (len > 0)
+      // We don't display errors on blank lines.
+      p->bad_lines.push_back(p->lines);
+  }
+
+  p->parsed = true;
+}
+
+
+/// Parse the pieces, taking the next one from next until none are left
+static void load_worker(RunStats * stats,
+			char **fn,
+			std::vector<load_piece_t *>& pieces,
+			std::atomic<size_t>& next)
+{
+  StatsPhase phase(stats, PHASE_LOAD);
+  sig_reader_t r;
+  r.buffer = NULL;
+
+  size_t i;
+  while ((i = next++) < pieces.size())
+  {
+    load_piece_t * p = pieces[i];
+    if (p->parsed)
+      continue;
+
+    // errno is saved right away, before fclose can change it
+    FILE * handle = fopen(fn[p->file], "rb");
+    if (NULL == handle)
+    {
+      p->error = errno;
+      continue;
+    }
+    if (fseeko(handle, p->start, SEEK_SET))
+    {
+      p->error = errno;
+      fclose(handle);
+      continue;
+    }
+
+    sig_reader_init(&r, handle, p->end - p->start);
+    load_parse(&r, p);
+    // A read error looks like the end of the piece to the reader
+    if (ferror(handle))
+      p->error = EIO;
+    fclose(handle);
+  }
+
+  free(r.buffer);
+}
+
+
+/// Returns the offset of the first line which starts at or after pos,
+/// or end if there isn't one
+static off_t load_boundary(FILE * handle, off_t pos, off_t end)
+{
+  char buffer[4096];
+
+  // If the byte before pos is a newline, pos starts a line
+  --pos;
+  if (fseeko(handle, pos, SEEK_SET))
+    return end;
+
+  while (pos < end)
+  {
+    size_t got = fread(buffer, 1, sizeof(buffer), handle);
+    if (0 == got)
+      break;
+
+    const char * nl = (const char *)memchr(buffer, '\n', got);
+    if (nl)
+      return pos + (nl - buffer) + 1;
+    pos += got;
+  }
+
+  return end;
+}
+
+
+/// Divide the file of known hashes we just opened into pieces. Anything
+/// other than a regular file, such as a pipe, is parsed right away, as is
+/// a file in the binary format, whose records can't be told apart
+/// without reading all of the ones before them, and a compressed file,
+/// which is parsed while another thread decompresses it.
+static void load_plan(state *s,
+		      size_t file,
+		      std::vector<load_piece_t *>& pieces)
+{
+  FILE * handle = s->known.handle;
+  struct stat sb;
+  off_t start = -1, end = -1;
+  if (0 == fstat(fileno(handle), &sb) && S_ISREG(sb.st_mode))
+  {
+    start = ftello(handle);
+    end = sb.st_size;
+  }
+
+  if (start < 0 || end < start || s->known.binary || s->known.decompressor)
+  {
+    load_piece_t * p = new load_piece_t();
+    p->file   = file;
+    p->name   = s->known_fn;
+    p->arena  = new Arena;
+    p->binary = s->known.binary;
+    load_parse(&s->known, p);
+    pieces.push_back(p);
+    return;
+  }
+
+  // The header has been read, along with whatever else fit in the buffer
+  start -= s->known.len - s->known.pos;
+
+  off_t size = (end - start) / s->threads;
+  if (size < LOAD_PIECE_SIZE)
+    size = LOAD_PIECE_SIZE;
+
+  while (start < end)
+  {
+    load_piece_t * p = new load_piece_t();
+    p->file  = file;
+    p->name  = s->known_fn;
+    p->start = start;
+    p->end   = (end - start > size ?
+		load_boundary(handle, start + size, end) : end);
+    p->arena = new Arena;
+    pieces.push_back(p);
+
+    start = p->end;
+  }
+}
+
+
+bool match_load(state *s, char **fn, int count)
+{
   if (NULL == s || NULL == fn)
     return true;
-  
-  if (sig_file_open(s,fn))
-    return true;
 
-  bool status;
+  StatsPhase phase(s->stats, PHASE_LOAD);
+  bool status = true;
+  std::vector<load_piece_t *> pieces;
+
+  for (int i = 0 ; i < count ; ++i)
+  {
+    if (sig_file_open(s,fn[i]))
+      continue;
+    status = false;
+
+    load_plan(s, i, pieces);
+    sig_file_close(s);
+  }
+
+  std::atomic<size_t> next(0);
+  unsigned int threads = s->threads;
+  if (threads > pieces.size())
+    threads = (unsigned int)pieces.size();
+
+  if (threads <= 1)
+    load_worker(s->stats, fn, pieces, next);
+  else
+  {
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0 ; i < threads ; ++i)
+      workers.push_back(std::thread(load_worker,
+				    s->stats,
+				    fn,
+				    std::ref(pieces),
+				    std::ref(next)));
+    for (unsigned int i = 0 ; i < threads ; ++i)
+      workers[i].join();
+  }
 
-  do {
-    Filedata * f; 
-    status = sig_file_next(s,&f);
-    if (!status) {
-      if (match_add(s,f)) {
+  // Add the known hashes in the order they appear in the files, so that
+  // everything is displayed in the same order as when reading them
+  // one line at a time. The header is the first line of each file.
+  uint64_t line_number = 0;
+  size_t file = (size_t)count;
+  for (size_t i = 0 ; i < pieces.size() ; ++i)
+  {
+    load_piece_t * p = pieces[i];
+    if (p->file != file)
+    {
+      file = p->file;
+      line_number = 1;
+    }
+
+    if (p->error)
+      print_error(s, "%s: %s", fn[p->file], strerror(p->error));
+
+    std::vector<uint64_t>::const_iterator bad;
+    for (bad = p->bad_lines.begin() ; bad != p->bad_lines.end() ; ++bad)
+      if (p->binary)
+	print_error(s, "%s: Bad record %llu", p->name, *bad);
+      else
+	print_error(s,
+		    "%s: Bad hash in line %llu", 
+		    p->name, 
+		    line_number + *bad);
+    line_number += p->lines;
+
+    std::vector<Filedata *>::const_iterator it;
+    for (it = p->entries.begin() ; it != p->entries.end() ; ++it)
+    {
+      if (match_add(s,*it)) {
 	// One bad hash doesn't mean this load was a failure.
 	// We don't change the return status because match_add failed.
-	print_error(s, "%s: unable to insert hash", fn);
+	print_error(s, "%s: unable to insert hash", fn[p->file]);
 	break;
       }
     }
-  } while (!sig_file_end(s));
 
-  sig_file_close(s);
+    s->arena.absorb(*p->arena);
+    delete p->arena;
+    delete p;
+  }
 
-  return false;
+  return status;
 }
 
 
@@ -396,17 +1037,24 @@ bool match_compare_unknown(state *s, const char * fn)
   if (NULL == s || NULL == fn)
     return true;
 
+  // Reading the unknowns is loading; comparing them is timed on its own
+  StatsPhase phase(s->stats, PHASE_LOAD);
+
   if (sig_file_open(s,fn))
     return true;
 
   bool status;
+
+  // Each unknown is only needed until it has been compared
+  Arena arena;
   
   do
   {
     Filedata *f;
-    status = sig_file_next(s,&f);
+    status = sig_file_next(s,arena,&f);
     if (!status)
       match_compare(s,f);
+    arena.clear();
   } while (!sig_file_end(s));
 
   sig_file_close(s);
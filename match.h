@@ -7,22 +7,67 @@
 
 #include "ssdeep.h"
 #include "filedata.h"
+#include "output.h"
+
+// *********************************************************************
+// Signature file functions
+// *********************************************************************
+
+/// Open a file of known hashes and determine if it's valid
+///
+/// @return Returns false success, true on error
+bool sig_file_open(state *s, const char * fn);
+
+/// Read the next entry in the file of known hashes into f, which is
+/// allocated in arena
+///
+/// @return Returns true if there is no entry to read or on error.
+bool sig_file_next(state *s, Arena& arena, Filedata ** f);
+
+/// Returns true once the whole file of known hashes has been read
+bool sig_file_end(state *s);
+
+bool sig_file_close(state *s);
+
 
 // *********************************************************************
 // Matching functions
 // *********************************************************************
 
+/// @brief Score the file f against the known file k
+///
+/// @return Returns the score if the match should be displayed, -1 if
+/// it should not (including when the two are the same file)
+/// @param s State variable
+/// @param f Filedata structure for the file.
+/// @param k Filedata structure for the known file
+int match_score(state *s, Filedata * f, Filedata * k);
+
+/// Display a match between a and b with the given score on out
+void handle_match(state *s, Filedata *a, Filedata *b, int score,
+		  Output& out = stdout_output());
+
 /// @brief Match the file f against the set of knowns
 ///
 /// @return Returns false if there are no matches, true if at least one match
 /// @param s State variable
 /// @param f Filedata structure for the file.
-bool match_compare(state *s, Filedata * f);
+/// @param out Where to display the matches
+bool match_compare(state *s, Filedata * f, Output& out = stdout_output());
 
-/// @brief Load a file of known hashes
+/// @brief Build the index of the known files, if one is in use and
+/// it hasn't been built yet. match_compare does this on first use, so
+/// this only needs to be called before comparing from several threads.
+void match_build_index(state *s);
+
+/// @brief Load the files of known hashes fn[0..count-1]
 ///
-/// @return Returns false on success, true on error
-bool match_load(state *s, const char *fn);
+/// The files are parsed in parallel, using up to s->threads threads,
+/// but the hashes are added in the same order as reading the files one
+/// after the other would add them.
+///
+/// @return Returns false if at least one file was loaded, true otherwise
+bool match_load(state *s, char **fn, int count);
 
 /// @brief Add a single new hash to the set of known hashes
 ///
@@ -39,6 +84,26 @@ bool match_compare_unknown(state *s, const char * fn);
 /// Display the results of clustering operations
 void display_clusters(const state *s);
 
+/// @brief Compare the signature files fn[0..count-1] against each other
+/// without holding all of them in memory at once
+///
+/// Produces the same output as loading the files with match_load
+/// and calling find_matches_in_known in pretty matching mode, using no
+/// more than roughly s->memory_budget bytes of memory plus temporary files.
+/// @return Returns false on success, true on error
+bool match_sharded(state *s, char **fn, int count);
+
+/// @brief Answer queries against the set of known hashes on the Unix
+/// domain socket path until interrupted
+///
+/// Each line received is a signature or the path of a file to hash. The
+/// answer is what -m would display for it, followed by a blank line.
+/// On SIGHUP the files of known hashes are loaded again. The known
+/// hashes already in s are served until then, and s remains the
+/// caller's.
+/// @return Returns false on success, true on error
+bool serve(state *s, const char *path);
+
 
 
 #endif   // ifndef __MATCH_H
@@ -0,0 +1,78 @@
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+/// @file output.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <stdio.h>
+#include <string.h>
+#include "tchar-local.h"
+
+/// The size of the buffer of an Output
+#define OUTPUT_BUFFER_SIZE  (1 << 16)
+
+/// @brief Buffered writer for results
+///
+/// Collects the text of many results and hands it to its stream with
+/// a single fwrite when the buffer is full or flush is called. When the
+/// stream is a terminal, each line is written as soon as it's complete.
+/// An Output must only be used by one thread at a time.
+class Output
+{
+ public:
+  explicit Output(FILE * stream);
+  ~Output() { flush(); }
+
+  void write(const char * s, size_t len)
+  {
+    if (len > OUTPUT_BUFFER_SIZE - m_len)
+    {
+      write_slow(s, len);
+      return;
+    }
+    memcpy(m_buffer + m_len, s, len);
+    m_len += len;
+  }
+
+  void text(const char * s) { write(s, strlen(s)); }
+
+  void put(char c)
+  {
+    if (OUTPUT_BUFFER_SIZE == m_len)
+      flush();
+    m_buffer[m_len++] = c;
+  }
+
+  void number(unsigned int n);
+
+  /// Writes the filename fn. If escape_quotes is set, quotation marks
+  /// are preceded by a backslash, as in the CSV output.
+  void filename(const TCHAR * fn, bool escape_quotes);
+
+  /// Ends the current line
+  void newline(void);
+
+  /// Hands everything in the buffer to the stream
+  void flush(void);
+
+ private:
+  Output(const Output&);
+  Output& operator=(const Output&);
+
+  void write_slow(const char * s, size_t len);
+
+  FILE * m_stream;
+  /// True if each line is written as soon as it's complete
+  bool   m_line_buffered;
+  size_t m_len;
+  char   m_buffer[OUTPUT_BUFFER_SIZE];
+};
+
+/// Returns the calling thread's Output for standard output. Anything
+/// written to stdout or stderr by other means must call flush on it first
+/// to keep the output in order.
+Output& stdout_output(void);
+
+#endif  // ifndef __OUTPUT_H
@@ -0,0 +1,832 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#include "pipeline.h"
+#include "stats.h"
+#include "spamsum.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_EVENTFD_H)
+# define USE_IO_URING
+# include <linux/io_uring.h>
+# include <poll.h>
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+#endif
+
+#ifdef HAVE_LINUX_FIEMAP_H
+# include <linux/fs.h>
+# include <linux/fiemap.h>
+# include <sys/ioctl.h>
+#endif
+
+#include <algorithm>
+
+// How many files can be waiting to be displayed before submit waits
+// for the oldest one
+#define PIPELINE_WINDOW  1024
+
+// How many files the io_uring reader reads at once, and how much of
+// each it asks for at a time
+#define PIPELINE_DEPTH      64
+#define PIPELINE_READ_SIZE  (1 << 17)
+
+// How many files are sorted into disk order at a time, and how much of
+// each one the kernel is asked to read ahead
+#define PIPELINE_BATCH      128
+#define PIPELINE_READAHEAD  (1 << 18)
+
+
+struct HashPipeline::job_t : hash_job_t
+{
+  /// True once the result can be displayed
+  bool done;
+  /// True if the file has been opened by schedule, which stored the
+  /// result of hash_job_open in fd
+  bool opened;
+  int  fd;
+  /// Where the file starts on its device
+  uint64_t location;
+};
+
+
+/// Returns a number which puts the files on one device in the order
+/// they are on the disk
+static uint64_t disk_location(int fd, const _tstat_t * sb)
+{
+#if defined(HAVE_LINUX_FIEMAP_H) && defined(FS_IOC_FIEMAP)
+  // Room for the header and the first extent
+  uint64_t buffer[(sizeof(struct fiemap) +
+		   sizeof(struct fiemap_extent)) / sizeof(uint64_t) + 1];
+  struct fiemap * map = (struct fiemap *)buffer;
+
+  memset(buffer, 0, sizeof(buffer));
+  map->fm_length       = FIEMAP_MAX_OFFSET;
+  map->fm_extent_count = 1;
+  if (0 == ioctl(fd, FS_IOC_FIEMAP, map) && map->fm_mapped_extents > 0)
+    return map->fm_extents[0].fe_physical;
+#else
+  (void)fd;
+#endif
+
+  // Without the extents, files whose inodes were allocated together
+  // are usually near each other
+  return (uint64_t)sb->st_ino;
+}
+
+
+
+/// A file being read by the io_uring reader
+struct HashPipeline::slot_t
+{
+  job_t              * job;
+  int                  fd;
+  /// Where the next read starts
+  uint64_t             offset;
+  /// The result of the last read: the number of bytes, or -errno
+  ssize_t              result;
+  /// True if the file can't be read at an offset, so a worker has to
+  /// read all of it
+  bool                 sync;
+  FuzzyEngine          engine;
+  unsigned char      * buffer;
+#ifdef USE_IO_URING
+  struct iovec         iov;
+#endif
+};
+
+
+#ifdef USE_IO_URING
+
+// The user_data of the poll on the eventfd which wakes the reader
+#define RING_WAKEUP  (~(uint64_t)0)
+
+/// @brief An io_uring instance
+///
+/// Only the system calls are used, so there's no need for liburing.
+/// Apart from wake, the functions must all be called on one thread.
+class HashPipeline::Ring
+{
+ public:
+  Ring();
+  ~Ring();
+
+  /// Creates the ring with room for entries requests
+  ///
+  /// @return Returns false on success, true on error
+  bool setup(unsigned int entries);
+
+  /// Queues a read of the next part of the file of slot
+  void read(slot_t * slot);
+
+  /// Submits the queued requests. If wait is set, also waits until at
+  /// least one request has completed or wake has been called.
+  void enter(bool wait);
+
+  /// Returns the next completed read, or NULL if there are none
+  struct io_uring_cqe * completion(void);
+
+  /// Frees the completion returned by completion
+  void seen(void);
+
+  /// Makes the next enter return. May be called on any thread.
+  void wake(void);
+
+ private:
+  Ring(const Ring&);
+  Ring& operator=(const Ring&);
+
+  int    m_fd;
+  /// The eventfd which wake writes to
+  int    m_event;
+
+  void * m_sq_ring;
+  void * m_cq_ring;
+  size_t m_sq_ring_size, m_cq_ring_size;
+  struct io_uring_sqe * m_sqes;
+  size_t m_sqes_size;
+
+  unsigned * m_sq_head, * m_sq_tail, * m_sq_mask, * m_sq_entries, * m_sq_array;
+  unsigned * m_cq_head, * m_cq_tail, * m_cq_mask;
+  struct io_uring_cqe * m_cqes;
+
+  /// Our copy of the tail of the submission queue, and the number of
+  /// requests in it which haven't been submitted
+  unsigned m_tail, m_unsubmitted;
+
+  struct io_uring_sqe * next_sqe(void);
+
+  /// Queues the poll on m_event
+  void poll_wakeup(void);
+};
+
+
+HashPipeline::Ring::Ring() :
+  m_fd(-1), m_event(-1), m_sq_ring(NULL), m_cq_ring(NULL), m_sqes(NULL),
+  m_tail(0), m_unsubmitted(0)
+{
+}
+
+
+HashPipeline::Ring::~Ring()
+{
+  if (m_sqes != NULL)
+    munmap(m_sqes, m_sqes_size);
+  if (m_cq_ring != NULL && m_cq_ring != m_sq_ring)
+    munmap(m_cq_ring, m_cq_ring_size);
+  if (m_sq_ring != NULL)
+    munmap(m_sq_ring, m_sq_ring_size);
+  if (m_event >= 0)
+    close(m_event);
+  if (m_fd >= 0)
+    close(m_fd);
+}
+
+
+bool HashPipeline::Ring::setup(unsigned int entries)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  // Kernels without io_uring, or which don't let us use it, fail here
+  m_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (m_fd < 0)
+    return true;
+
+  m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (m_cq_ring_size > m_sq_ring_size)
+      m_sq_ring_size = m_cq_ring_size;
+    m_cq_ring_size = m_sq_ring_size;
+  }
+
+  void * ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+  if (MAP_FAILED == ring)
+    return true;
+  m_sq_ring = ring;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring = m_sq_ring;
+  else
+    ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+  if (MAP_FAILED == ring)
+    return true;
+  m_cq_ring = ring;
+
+  m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE,
+	      MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+  if (MAP_FAILED == ring)
+    return true;
+  m_sqes = (struct io_uring_sqe *)ring;
+
+  char * sq = (char *)m_sq_ring;
+  m_sq_head    = (unsigned *)(sq + p.sq_off.head);
+  m_sq_tail    = (unsigned *)(sq + p.sq_off.tail);
+  m_sq_mask    = (unsigned *)(sq + p.sq_off.ring_mask);
+  m_sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+  m_sq_array   = (unsigned *)(sq + p.sq_off.array);
+
+  char * cq = (char *)m_cq_ring;
+  m_cq_head = (unsigned *)(cq + p.cq_off.head);
+  m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  m_cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  m_tail = *m_sq_tail;
+
+  m_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_event < 0)
+    return true;
+  poll_wakeup();
+
+  return false;
+}
+
+
+struct io_uring_sqe * HashPipeline::Ring::next_sqe(void)
+{
+  // The ring has room for a read from every slot and the poll
+  if (m_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= *m_sq_entries)
+    internal_error("%s: io_uring submission queue is full", __progname);
+
+  unsigned i = m_tail & *m_sq_mask;
+  struct io_uring_sqe * sqe = &m_sqes[i];
+  memset(sqe, 0, sizeof(*sqe));
+  m_sq_array[i] = i;
+  ++m_tail;
+  ++m_unsubmitted;
+  return sqe;
+}
+
+
+void HashPipeline::Ring::poll_wakeup(void)
+{
+  struct io_uring_sqe * sqe = next_sqe();
+  sqe->opcode      = IORING_OP_POLL_ADD;
+  sqe->fd          = m_event;
+  sqe->poll_events = POLLIN;
+  sqe->user_data   = RING_WAKEUP;
+}
+
+
+void HashPipeline::Ring::read(slot_t * slot)
+{
+  slot->iov.iov_base = slot->buffer;
+  slot->iov.iov_len  = PIPELINE_READ_SIZE;
+
+  struct io_uring_sqe * sqe = next_sqe();
+  sqe->opcode    = IORING_OP_READV;
+  sqe->fd        = slot->fd;
+  sqe->off       = slot->offset;
+  sqe->addr      = (uint64_t)(uintptr_t)&slot->iov;
+  sqe->len       = 1;
+  sqe->user_data = (uint64_t)(uintptr_t)slot;
+}
+
+
+void HashPipeline::Ring::enter(bool wait)
+{
+  __atomic_store_n(m_sq_tail, m_tail, __ATOMIC_RELEASE);
+
+  while (m_unsubmitted > 0 || wait)
+  {
+    unsigned int min_complete = (wait ? 1 : 0);
+    int n = (int)syscall(__NR_io_uring_enter,
+			 m_fd,
+			 m_unsubmitted,
+			 min_complete,
+			 wait ? IORING_ENTER_GETEVENTS : 0,
+			 NULL,
+			 0);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+	continue;
+      // The completions have to be collected before there's room for more
+      if (EAGAIN == errno || EBUSY == errno)
+	return;
+      fatal_error("%s: io_uring: %s", __progname, strerror(errno));
+    }
+
+    // The kernel only waits once everything has been submitted
+    m_unsubmitted -= n;
+    if (0 == m_unsubmitted)
+      return;
+  }
+}
+
+
+struct io_uring_cqe * HashPipeline::Ring::completion(void)
+{
+  for (;;)
+  {
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+      return NULL;
+
+    struct io_uring_cqe * cqe = &m_cqes[head & *m_cq_mask];
+    if (cqe->user_data != RING_WAKEUP)
+      return cqe;
+
+    uint64_t value;
+    if (::read(m_event, &value, sizeof(value)) < 0)
+    {
+      // Nothing to do; the count is only there to end the poll
+    }
+    seen();
+    poll_wakeup();
+  }
+}
+
+
+void HashPipeline::Ring::seen(void)
+{
+  __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+void HashPipeline::Ring::wake(void)
+{
+  uint64_t one = 1;
+  if (write(m_event, &one, sizeof(one)) < 0)
+  {
+    // The count can only overflow if the reader is already awake
+  }
+}
+
+#else   // ifdef USE_IO_URING
+
+class HashPipeline::Ring
+{
+};
+
+#endif  // ifdef USE_IO_URING/else
+
+
+HashPipeline::HashPipeline(state *s) :
+  m_state(s),
+  m_owner(std::this_thread::get_id()),
+  m_finishing(false),
+  m_stopping(false),
+  m_locality(s->locality),
+  m_ring(NULL),
+  m_reader_waiting(false)
+{
+}
+
+
+HashPipeline * HashPipeline::create(state *s)
+{
+  HashPipeline * p = new HashPipeline(s);
+
+#ifdef USE_IO_URING
+  Ring * ring = new Ring;
+  if (ring->setup(2 * PIPELINE_DEPTH))
+    delete ring;
+  else
+  {
+    p->m_ring = ring;
+    for (unsigned int i = 0 ; i < PIPELINE_DEPTH ; ++i)
+    {
+      slot_t * slot = new slot_t;
+      slot->job    = NULL;
+      slot->fd     = -1;
+      slot->buffer = new unsigned char[PIPELINE_READ_SIZE];
+      p->m_slots.push_back(slot);
+    }
+  }
+#endif
+
+  // Without io_uring a single worker would only read one file at a
+  // time, which is no better than doing it ourselves, unless the files
+  // are to be put in order first
+  if (NULL == p->m_ring && s->threads < 2 && !s->locality)
+  {
+    delete p;
+    return NULL;
+  }
+
+  if (p->m_ring != NULL)
+    p->m_threads.push_back(std::thread(&HashPipeline::reader, p));
+  for (unsigned int i = 0 ; i < s->threads ; ++i)
+    p->m_threads.push_back(std::thread(&HashPipeline::worker, p));
+
+  return p;
+}
+
+
+HashPipeline::~HashPipeline()
+{
+  drain();
+
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_stopping = true;
+  }
+  m_work.notify_all();
+  wake_reader();
+
+  for (size_t i = 0 ; i < m_threads.size() ; ++i)
+    m_threads[i].join();
+
+  for (size_t i = 0 ; i < m_free.size() ; ++i)
+    delete m_free[i];
+  for (size_t i = 0 ; i < m_slots.size() ; ++i)
+  {
+    delete[] m_slots[i]->buffer;
+    delete m_slots[i];
+  }
+  delete m_ring;
+}
+
+
+void HashPipeline::submit(const TCHAR * fn)
+{
+  bool wake;
+
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    job_t * job;
+    if (m_free.empty())
+      job = new job_t;
+    else
+    {
+      job = m_free.back();
+      m_free.pop_back();
+    }
+
+    job->fn.assign(fn);
+    job->done   = false;
+    job->opened = false;
+    m_window.push_back(job);
+
+    if (m_locality)
+    {
+      m_batch.push_back(job);
+      wake = false;
+    }
+    else
+    {
+      m_queue.push_back(job);
+      wake = m_reader_waiting;
+      m_reader_waiting = false;
+    }
+  }
+
+  if (m_locality)
+  {
+    if (m_batch.size() >= PIPELINE_BATCH)
+      schedule();
+  }
+  else if (NULL == m_ring)
+    m_work.notify_one();
+  else if (wake)
+    wake_reader();
+
+  // Every file in the window may be open while it waits to be read
+  retire(m_locality ? 2 * PIPELINE_BATCH : PIPELINE_WINDOW);
+}
+
+
+bool HashPipeline::disk_order(const job_t * a, const job_t * b)
+{
+  if (a->sb.st_dev != b->sb.st_dev)
+    return (a->sb.st_dev < b->sb.st_dev);
+  return (a->location < b->location);
+}
+
+
+void HashPipeline::schedule(void)
+{
+  std::vector<job_t *> ready;
+
+  for (size_t i = 0 ; i < m_batch.size() ; ++i)
+  {
+    job_t * job = m_batch[i];
+    job->opened = true;
+    job->fd = hash_job_open(m_state, job);
+    if (job->fd < 0)
+      mark_done(job);
+    else
+    {
+      job->location = disk_location(job->fd, &job->sb);
+      ready.push_back(job);
+    }
+  }
+  m_batch.clear();
+
+  std::stable_sort(ready.begin(), ready.end(), disk_order);
+
+#ifdef HAVE_POSIX_FADVISE
+  // The kernel can sort these reads as well, and they'll be done by the
+  // time the workers get to most of the small files
+  for (size_t i = 0 ; i < ready.size() ; ++i)
+    if (S_ISREG(ready[i]->sb.st_mode))
+      posix_fadvise(ready[i]->fd, 0, PIPELINE_READAHEAD, POSIX_FADV_WILLNEED);
+#endif
+
+  bool wake;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_queue.insert(m_queue.end(), ready.begin(), ready.end());
+    wake = m_reader_waiting;
+    m_reader_waiting = false;
+  }
+
+  if (NULL == m_ring)
+    m_work.notify_all();
+  else if (wake)
+    wake_reader();
+}
+
+
+void HashPipeline::drain(void)
+{
+  if (m_finishing || std::this_thread::get_id() != m_owner)
+    return;
+  retire(0);
+}
+
+
+void HashPipeline::display_done(void)
+{
+  if (m_finishing || std::this_thread::get_id() != m_owner)
+    return;
+
+  // A batch which isn't full yet may have to wait a long time for more
+  if (!m_batch.empty())
+    schedule();
+  retire((size_t)-1);
+}
+
+
+void HashPipeline::retire(size_t limit)
+{
+  std::unique_lock<std::mutex> lock(m_lock);
+
+  while (!m_window.empty())
+  {
+    job_t * job = m_window.front();
+    if (!job->done)
+    {
+      if (m_window.size() <= limit)
+	return;
+      // The job may not have been started yet
+      if (!m_batch.empty())
+      {
+	lock.unlock();
+	schedule();
+	lock.lock();
+	continue;
+      }
+      m_done.wait(lock);
+      continue;
+    }
+
+    m_window.pop_front();
+    lock.unlock();
+
+    // Displaying the result can print an error, which calls drain
+    m_finishing = true;
+    if (0 == job->open_error)
+      hash_job_announce(m_state, job);
+    hash_job_finish(m_state, job);
+    m_finishing = false;
+
+    lock.lock();
+    m_free.push_back(job);
+  }
+}
+
+
+void HashPipeline::mark_done(job_t * job)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    job->done = true;
+  }
+  m_done.notify_one();
+}
+
+
+void HashPipeline::wake_reader(void)
+{
+#ifdef USE_IO_URING
+  if (m_ring != NULL)
+    m_ring->wake();
+#endif
+}
+
+
+void HashPipeline::return_slot(slot_t * slot)
+{
+  bool wake;
+
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_returned.push_back(slot);
+    wake = m_reader_waiting;
+    m_reader_waiting = false;
+  }
+
+  if (wake)
+    wake_reader();
+}
+
+
+void HashPipeline::worker(void)
+{
+  StatsPhase phase(m_state->stats, PHASE_HASH);
+  std::unique_lock<std::mutex> lock(m_lock);
+
+  for (;;)
+  {
+    if (m_ring != NULL && !m_chunks.empty())
+    {
+      slot_t * slot = m_chunks.front();
+      m_chunks.pop_front();
+      lock.unlock();
+
+      hash_chunk(slot);
+    }
+    else if (NULL == m_ring && !m_queue.empty())
+    {
+      job_t * job = m_queue.front();
+      m_queue.pop_front();
+      lock.unlock();
+
+      int fd = job->opened ? job->fd : hash_job_open(m_state, job);
+      if (fd >= 0)
+	hash_job_read(m_state, job, fd);
+      mark_done(job);
+    }
+    else if (m_stopping)
+      return;
+    else
+    {
+      m_work.wait(lock);
+      continue;
+    }
+
+    lock.lock();
+  }
+}
+
+
+void HashPipeline::hash_chunk(slot_t * slot)
+{
+  job_t * job = slot->job;
+
+  if (slot->sync)
+    hash_job_read(m_state, job, slot->fd);
+  else
+  {
+    if (slot->result > 0)
+    {
+      slot->engine.update(slot->buffer, slot->result);
+      job->length  += slot->result;
+      slot->offset += slot->result;
+      return_slot(slot);
+      return;
+    }
+    else if (slot->result < 0)
+      job->read_error = (int)-slot->result;
+    else if (slot->engine.digest(job->sum))
+      job->read_error = errno;
+
+    hash_job_close(m_state, job, slot->fd);
+  }
+
+  slot->job = NULL;
+  slot->fd  = -1;
+  mark_done(job);
+  return_slot(slot);
+}
+
+
+void HashPipeline::reader(void)
+{
+  StatsPhase phase(m_state->stats, PHASE_HASH);
+#ifdef USE_IO_URING
+  std::vector<slot_t *> idle(m_slots), returned, ready;
+  std::vector<job_t *> starting;
+  // Slots which aren't idle
+  size_t busy = 0;
+
+  for (;;)
+  {
+    bool wait = false;
+
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+
+      m_reader_waiting = false;
+      while (starting.size() < idle.size() && !m_queue.empty())
+      {
+	starting.push_back(m_queue.front());
+	m_queue.pop_front();
+      }
+      returned.swap(m_returned);
+
+      if (starting.empty() && returned.empty())
+      {
+	if (m_stopping && 0 == busy)
+	  return;
+	m_reader_waiting = true;
+	wait = true;
+      }
+    }
+
+    for (size_t i = 0 ; i < starting.size() ; ++i)
+    {
+      job_t * job = starting[i];
+      int fd = job->opened ? job->fd : hash_job_open(m_state, job);
+      if (fd < 0)
+      {
+	mark_done(job);
+	continue;
+      }
+
+      slot_t * slot = idle.back();
+      idle.pop_back();
+      ++busy;
+
+      slot->job    = job;
+      slot->fd     = fd;
+      slot->offset = 0;
+
+      // Pipes and the like can't be read at an offset, and could block
+      // forever, so they're read by a worker
+      slot->sync = !S_ISREG(job->sb.st_mode);
+#ifdef S_ISBLK
+      if (S_ISBLK(job->sb.st_mode))
+	slot->sync = false;
+#endif
+
+      if (!slot->sync)
+      {
+	slot->engine.reset();
+	if (S_ISREG(job->sb.st_mode) &&
+	    slot->engine.set_total_input_length((uint_least64_t)job->sb.st_size))
+	  slot->result = -errno;
+	else
+	{
+	  m_ring->read(slot);
+	  continue;
+	}
+      }
+
+      ready.push_back(slot);
+    }
+    starting.clear();
+
+    for (size_t i = 0 ; i < returned.size() ; ++i)
+    {
+      if (NULL == returned[i]->job)
+      {
+	idle.push_back(returned[i]);
+	--busy;
+      }
+      else
+	m_ring->read(returned[i]);
+    }
+    returned.clear();
+
+    m_ring->enter(wait);
+
+    struct io_uring_cqe * cqe;
+    while ((cqe = m_ring->completion()) != NULL)
+    {
+      slot_t * slot = (slot_t *)(uintptr_t)cqe->user_data;
+      slot->result = cqe->res;
+      m_ring->seen();
+
+      if (-EINTR == slot->result || -EAGAIN == slot->result)
+	m_ring->read(slot);
+      else
+	ready.push_back(slot);
+    }
+
+    if (!ready.empty())
+    {
+      {
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_chunks.insert(m_chunks.end(), ready.begin(), ready.end());
+      }
+      if (ready.size() > 1)
+	m_work.notify_all();
+      else
+	m_work.notify_one();
+      ready.clear();
+    }
+  }
+#endif
+}
@@ -0,0 +1,162 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+/// @file pipeline.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ssdeep.h"
+#include "cache.h"
+
+/// A file to hash and, once it has been hashed, the result
+typedef struct hash_job
+{
+  /// The name of the file, as it was given to hash_file
+  std::basic_string<TCHAR> fn;
+  /// The errno value if the file couldn't be opened, otherwise zero
+  int         open_error;
+  /// The errno value if the file couldn't be read, otherwise zero
+  int         read_error;
+  _tstat_t    sb;
+  /// Number of bytes read from the file
+  uint64_t    length;
+  char        sum[FUZZY_MAX_RESULT];
+  /// The file as it was when it was opened, if its hash can be cached
+  bool        cacheable;
+  cache_key_t key;
+} hash_job_t;
+
+
+// Hashing a file is split into these steps so that the reading can be
+// done on other threads. They're in engine.cpp.
+
+/// Opens the file of job and fills in its status. If its hash is in
+/// the cache, it's copied into job->sum.
+///
+/// @return Returns the descriptor of the file if it has to be read,
+/// otherwise -1. job->open_error is set if the file couldn't be opened.
+int hash_job_open(const state *s, hash_job_t *job);
+
+/// Reads the file open on fd into job->sum and closes it
+void hash_job_read(const state *s, hash_job_t *job, int fd);
+
+/// Closes the file of job after it's been read, caching its hash
+void hash_job_close(const state *s, hash_job_t *job, int fd);
+
+/// Shows the file being hashed in verbose mode
+void hash_job_announce(state *s, const hash_job_t *job);
+
+/// Displays the result of job, or the error which stopped it
+///
+/// @return Returns false on success, true on error
+bool hash_job_finish(state *s, hash_job_t *job);
+
+
+/// @brief Hashes files on other threads
+///
+/// Files given to submit are opened and read by other threads while the
+/// caller goes on looking for more of them. Where the kernel has io_uring
+/// the reads of many files are queued at once and the data is hashed by a
+/// pool of worker threads as it arrives; elsewhere each worker reads its
+/// own files. The results are displayed on the thread which created the
+/// pipeline, in the order the files were submitted, so the output is the
+/// same as hashing one file at a time.
+///
+/// With s->locality the files are collected into batches, which are
+/// sorted by where the files are on the disk before they are read, and
+/// the kernel is asked to start reading each file of a batch at once.
+class HashPipeline
+{
+ public:
+  /// Returns a new pipeline for s, or NULL if hashing on other threads
+  /// wouldn't help
+  static HashPipeline * create(state *s);
+
+  /// Finishes every file and stops the threads
+  ~HashPipeline();
+
+  /// Starts hashing the file fn. The results of files which are done
+  /// are displayed; if too many are waiting, this waits for the oldest.
+  void submit(const TCHAR * fn);
+
+  /// Waits for every file submitted so far and displays the results.
+  /// Anything else written to stdout or stderr must call this first,
+  /// to keep the output in order. Does nothing on other threads, or
+  /// while a result is being displayed.
+  void drain(void);
+
+  /// Displays the results of the files which are done, without waiting
+  /// for any others
+  void display_done(void);
+
+ private:
+  HashPipeline(state *s);
+  HashPipeline(const HashPipeline&);
+  HashPipeline& operator=(const HashPipeline&);
+
+  struct job_t;
+  struct slot_t;
+  class Ring;
+
+  state           * m_state;
+  std::thread::id   m_owner;
+  /// True while a result is being displayed
+  bool              m_finishing;
+
+  std::mutex              m_lock;
+  /// Signalled when there's work for the worker threads
+  std::condition_variable m_work;
+  /// Signalled when a job is done
+  std::condition_variable m_done;
+  bool                    m_stopping;
+
+  /// Every job which hasn't been displayed yet, in the order submitted
+  std::deque<job_t *>  m_window;
+  /// The jobs which haven't been started yet
+  std::deque<job_t *>  m_queue;
+  /// Jobs which can be used again
+  std::vector<job_t *> m_free;
+
+  /// True if the files are read in disk order
+  bool                 m_locality;
+  /// The jobs which will be sorted into disk order next. Only used by
+  /// the thread which created the pipeline.
+  std::vector<job_t *> m_batch;
+
+  /// The io_uring reader, or NULL if each worker reads its own files
+  Ring                 * m_ring;
+  std::vector<slot_t *>  m_slots;
+  /// Slots whose data is waiting to be hashed
+  std::deque<slot_t *>   m_chunks;
+  /// Slots handed back to the reader by the workers
+  std::vector<slot_t *>  m_returned;
+  /// True while the reader is waiting for something to do
+  bool                   m_reader_waiting;
+
+  std::vector<std::thread> m_threads;
+
+  /// Displays the results of the jobs at the front of the window which
+  /// are done. Waits for them while there are more than limit.
+  void retire(size_t limit);
+
+  void mark_done(job_t * job);
+
+  /// Opens the files of m_batch and queues them in disk order
+  void schedule(void);
+  static bool disk_order(const job_t * a, const job_t * b);
+
+  void worker(void);
+  void reader(void);
+  void hash_chunk(slot_t * slot);
+  void return_slot(slot_t * slot);
+  void wake_reader(void);
+};
+
+#endif  // ifndef __PIPELINE_H
@@ -0,0 +1,180 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#include "progress.h"
+#include "stats.h"
+#include <algorithm>
+
+// How often the line is updated, in milliseconds
+#define PROGRESS_INTERVAL_MS  1000
+
+#define BYTES_PER_MB  1000000.0
+
+
+ProgressReporter::ProgressReporter(state *s) :
+  m_state(s),
+  m_stats(s->stats),
+  m_stopping(false),
+  m_shown(false),
+  m_start(std::chrono::steady_clock::now()),
+  m_comparing(false),
+  m_total(0),
+  m_measured(false),
+  m_stop_measuring(false)
+{
+  if (NULL == m_stats)
+    internal_error("%s: Progress reported without statistics", __progname);
+
+  m_thread = std::thread(&ProgressReporter::run, this);
+}
+
+
+ProgressReporter::~ProgressReporter()
+{
+  m_stop_measuring = true;
+  if (m_measurer.joinable())
+    m_measurer.join();
+
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stopping = true;
+  }
+  m_wake.notify_all();
+  m_thread.join();
+
+  erase();
+}
+
+
+void ProgressReporter::erase(void)
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  if (!m_shown)
+    return;
+
+  fprintf(stderr, "%s\r", BLANK_LINE);
+  fflush(stderr);
+  m_shown = false;
+}
+
+
+void ProgressReporter::measure(TCHAR **inputs, int count)
+{
+  state *s = m_state;
+
+  // Only files we hash have a size worth adding up. A list of files
+  // isn't known until it has been read.
+  if (MODE(mode_compare_unknown) || MODE(mode_sigcompare) ||
+      s->list_file != NULL || count <= 0 || m_measurer.joinable())
+    return;
+
+  for (int i = 0 ; i < count ; ++i)
+    m_inputs.push_back(inputs[i]);
+  m_measurer = std::thread(&ProgressReporter::measure_inputs, this);
+}
+
+
+void ProgressReporter::measure_inputs(void)
+{
+  uint64_t total = 0;
+  std::vector<std::basic_string<TCHAR> >::const_iterator it;
+  for (it = m_inputs.begin() ; it != m_inputs.end() && !m_stop_measuring ; ++it)
+    total += measure_files(m_state, it->c_str(), m_stop_measuring);
+
+  m_total = total;
+  m_measured = true;
+}
+
+
+void ProgressReporter::run(void)
+{
+  std::unique_lock<std::mutex> lock(m_lock);
+  while (!m_stopping)
+  {
+    m_wake.wait_for(lock, std::chrono::milliseconds(PROGRESS_INTERVAL_MS));
+    if (!m_stopping)
+      show();
+  }
+}
+
+
+/// Formats seconds as hours, minutes and seconds
+static void format_time(char *buffer, size_t size, double seconds)
+{
+  unsigned long t = (unsigned long)seconds;
+  snprintf(buffer, size, "%lu:%02lu:%02lu", t / 3600, t / 60 % 60, t % 60);
+}
+
+
+void ProgressReporter::show(void)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - m_start).count();
+  if (elapsed <= 0)
+    return;
+
+  uint64_t files       = m_stats->files_hashed + m_stats->files_failed;
+  uint64_t bytes       = m_stats->bytes_read;
+  uint64_t comparisons = m_stats->comparisons + m_stats->comparisons_skipped;
+  uint64_t matches     = m_stats->matches;
+
+  if (!m_comparing && comparisons > 0)
+  {
+    m_comparing = true;
+    m_compare_start = now;
+  }
+
+  // The line has to fit in BLANK_LINE, so that it can be erased
+  char line[sizeof(BLANK_LINE)];
+  size_t len = 0;
+  int n;
+
+  if (files > 0 || !m_comparing)
+  {
+    n = snprintf(line, sizeof(line),
+		 "%llu files (%.1f/s, %.1f MB/s)",
+		 (unsigned long long)files,
+		 files / elapsed,
+		 bytes / BYTES_PER_MB / elapsed);
+    if (n > 0)
+      len = std::min((size_t)n, sizeof(line) - 1);
+
+    uint64_t total = m_total;
+    if (m_measured && total > 0 && bytes > 0 && bytes < total)
+    {
+      char eta[32];
+      format_time(eta, sizeof(eta), (total - bytes) / (bytes / elapsed));
+      n = snprintf(line + len, sizeof(line) - len,
+		   ", %u%% ETA %s",
+		   (unsigned int)(bytes * 100 / total),
+		   eta);
+      if (n > 0)
+	len = std::min(len + n, sizeof(line) - 1);
+    }
+  }
+
+  if (m_comparing)
+  {
+    double compare_elapsed =
+      std::chrono::duration<double>(now - m_compare_start).count();
+    if (compare_elapsed <= 0)
+      compare_elapsed = elapsed;
+
+    n = snprintf(line + len, sizeof(line) - len,
+		 "%s%llu matches (%.1f/s)",
+		 len ? ", " : "",
+		 (unsigned long long)matches,
+		 matches / compare_elapsed);
+    if (n > 0)
+      len = std::min(len + n, sizeof(line) - 1);
+  }
+
+  // Pad the line to cover whatever was shown before
+  memset(line + len, ' ', sizeof(line) - 1 - len);
+  line[sizeof(line) - 1] = 0;
+
+  fprintf(stderr, "%s\r", line);
+  fflush(stderr);
+  m_shown = true;
+}
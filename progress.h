@@ -0,0 +1,79 @@
+#ifndef __PROGRESS_H
+#define __PROGRESS_H
+
+/// @file progress.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ssdeep.h"
+
+/// @brief Shows how a long run is going on stderr
+///
+/// A thread wakes up every second and rewrites one line with the number
+/// of files hashed so far and the rate at which they're read. Another
+/// thread adds up the sizes of the files to hash first, so that the line
+/// can also show how long the rest should take. While signatures are
+/// being compared, it shows how many matches are found per second.
+///
+/// Everything it shows comes from the counters of s->stats, so the
+/// threads doing the work never format any text.
+class ProgressReporter
+{
+ public:
+  /// Starts showing the progress of s. Requires s->stats.
+  ProgressReporter(state *s);
+
+  /// Stops the threads and erases the line
+  ~ProgressReporter();
+
+  /// Starts adding up the sizes of the files to hash, which are the
+  /// count files and directories in inputs
+  void measure(TCHAR **inputs, int count);
+
+  /// Erases the line, if it's being shown, so that something else can be
+  /// written to stderr. It's shown again at the next update.
+  void erase(void);
+
+ private:
+  ProgressReporter(const ProgressReporter&);
+  ProgressReporter& operator=(const ProgressReporter&);
+
+  state    * m_state;
+  RunStats * m_stats;
+
+  std::mutex              m_lock;
+  std::condition_variable m_wake;
+  bool                    m_stopping;
+  /// True while the line is on the screen
+  bool                    m_shown;
+
+  std::chrono::steady_clock::time_point m_start;
+  /// When the first comparison was seen, for the rate of matches
+  std::chrono::steady_clock::time_point m_compare_start;
+  bool                                  m_comparing;
+
+  /// The files and directories being measured
+  std::vector<std::basic_string<TCHAR> > m_inputs;
+  /// Total size of the files to hash, once m_measured is set
+  std::atomic<uint64_t> m_total;
+  std::atomic<bool>     m_measured;
+  std::atomic<bool>     m_stop_measuring;
+
+  std::thread m_thread;
+  std::thread m_measurer;
+
+  void run(void);
+  void measure_inputs(void);
+  /// Writes the line. Must be called with m_lock held.
+  void show(void);
+};
+
+#endif  // ifndef __PROGRESS_H
@@ -0,0 +1,590 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#include "match.h"
+#include "lsh.h"
+#include "stats.h"
+
+// ------------------------------------------------------------------
+// RESIDENT QUERY SERVER
+// ------------------------------------------------------------------
+//
+// The known hashes are loaded once and queries are answered from them
+// until we are told to stop. The main thread polls the listening socket
+// and every idle connection. A connection with something to read is
+// handed to one of the worker threads, which answers all of the complete
+// lines it has received and hands the connection back.
+//
+// The known hashes are kept in a snapshot which is shared by every query
+// being answered. Reloading builds a new snapshot on a separate thread
+// and swaps it in once it's ready; queries in flight keep using the old
+// one, which goes away when the last of them is done.
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H) && \
+  defined(HAVE_POLL_H) && defined(HAVE_OPEN_MEMSTREAM) && !defined(_WIN32)
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// How much we read from a connection at once
+#define SERVE_READ_SIZE  (1 << 16)
+
+// Connections which send a longer line than this are dropped
+#define SERVE_MAX_QUERY  (1 << 20)
+
+
+typedef std::shared_ptr<state> snapshot_t;
+
+
+typedef struct
+{
+  int          fd;
+  /// Data received which doesn't make up a complete line yet
+  std::string  input;
+} connection_t;
+
+
+typedef struct
+{
+  /// Holds the options for every snapshot, but no known hashes
+  const state * options;
+
+  std::mutex               lock;
+  std::condition_variable  work;
+  std::condition_variable  reload;
+
+  /// All of these are protected by lock
+  snapshot_t                  current;
+  std::deque<connection_t *>  ready;
+  std::vector<connection_t *> done;
+  bool                        reload_requested;
+  bool                        stopping;
+
+  /// Written to when there is a connection in done
+  int wakeup[2];
+} server_t;
+
+
+// Written to by the signal handler, so that the main loop sees signals
+static int signal_pipe[2] = { -1, -1 };
+
+
+static void handle_signal(int sig)
+{
+  int saved = errno;
+  char c = (SIGHUP == sig) ? 'h' : 't';
+  if (write(signal_pipe[1], &c, 1) < 0)
+  {
+    // Nothing we can do about it here
+  }
+  errno = saved;
+}
+
+
+static void free_snapshot(state *s)
+{
+  delete s->index;
+  free(s->known.buffer);
+  delete s;
+}
+
+
+// The first snapshot is the caller's state, which is still theirs
+// once we return
+static void keep_snapshot(state *s)
+{
+  (void)s;
+}
+
+
+/// Returns a new state with the options of s but without any known hashes
+static state * copy_options(const state *s)
+{
+  state * n = new state();
+
+  n->mode        = s->mode;
+  n->threshold   = s->threshold;
+  n->lsh_bands   = s->lsh_bands;
+  n->lsh_rows    = s->lsh_rows;
+  n->threads     = s->threads;
+  n->known_files = s->known_files;
+  n->serve_path  = s->serve_path;
+  n->stats       = s->stats;
+
+  return n;
+}
+
+
+/// @return Returns false on success, true on error
+static bool write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+	continue;
+      return true;
+    }
+    buf += n;
+    len -= n;
+  }
+  return false;
+}
+
+
+/// Answer the query in line, which is len characters long, on out
+static void serve_query(state *s,
+			Arena& arena,
+			const char *line,
+			size_t len,
+			Output& out)
+{
+  if (len > 0 && '\r' == line[len - 1])
+    --len;
+
+  if (len > 0)
+  {
+    Filedata * f = NULL;
+
+    // Anything which doesn't look like a signature is a path
+    if (isdigit((unsigned char)line[0]))
+      f = Filedata::parse(arena, line, len);
+
+    if (NULL == f)
+    {
+      std::string path(line, len);
+      char sum[FUZZY_MAX_RESULT];
+      StatsPhase phase(s->stats, PHASE_HASH);
+
+      if (fuzzy_hash_filename(path.c_str(), sum))
+      {
+	if (s->stats != NULL)
+	  ++s->stats->files_failed;
+	out.text(path.c_str());
+	out.write(": ", 2);
+	out.text(strerror(errno));
+	out.newline();
+      }
+      else
+      {
+	if (s->stats != NULL)
+	  ++s->stats->files_hashed;
+	try {
+	  f = Filedata::create(arena, path.c_str(), sum);
+	}
+	catch (const std::bad_alloc&) {
+	  out.text(path.c_str());
+	  out.text(": Unable to create Filedata object");
+	  out.newline();
+	}
+      }
+    }
+
+    if (f != NULL)
+      match_compare(s, f, out);
+    arena.clear();
+  }
+
+  out.newline();
+}
+
+
+/// Read what's waiting on c and answer every complete line
+///
+/// @return Returns false if the connection should be kept, true
+/// if it should be closed
+static bool serve_connection(server_t *srv, connection_t *c, Arena& arena)
+{
+  char buffer[SERVE_READ_SIZE];
+  bool closing = false;
+
+  for (;;)
+  {
+    ssize_t n = recv(c->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n > 0)
+    {
+      c->input.append(buffer, n);
+      continue;
+    }
+    if (n < 0 && EINTR == errno)
+      continue;
+    if (0 == n || (EAGAIN != errno && EWOULDBLOCK != errno))
+      closing = true;
+    break;
+  }
+
+  size_t start = 0, end;
+  bool last = closing && !c->input.empty() && '\n' != c->input.back();
+  if (std::string::npos == c->input.find('\n') && !last)
+    return closing || c->input.size() > SERVE_MAX_QUERY;
+
+  snapshot_t s;
+  {
+    std::lock_guard<std::mutex> guard(srv->lock);
+    s = srv->current;
+  }
+
+  char * response = NULL;
+  size_t response_len = 0;
+  FILE * stream = open_memstream(&response, &response_len);
+  if (NULL == stream)
+    fatal_error("%s: Out of memory", __progname);
+  Output out(stream);
+
+  while ((end = c->input.find('\n', start)) != std::string::npos)
+  {
+    serve_query(s.get(), arena, c->input.data() + start, end - start, out);
+    start = end + 1;
+  }
+
+  // The client may not end its last query with a newline
+  if (last)
+  {
+    serve_query(s.get(), arena, c->input.data() + start,
+		c->input.size() - start, out);
+    start = c->input.size();
+  }
+
+  c->input.erase(0, start);
+
+  out.flush();
+  if (fclose(stream))
+    fatal_error("%s: Out of memory", __progname);
+  if (write_all(c->fd, response, response_len))
+    closing = true;
+  free(response);
+
+  return closing || c->input.size() > SERVE_MAX_QUERY;
+}
+
+
+static void serve_worker(server_t *srv)
+{
+  Arena arena;
+
+  for (;;)
+  {
+    connection_t * c;
+    {
+      std::unique_lock<std::mutex> guard(srv->lock);
+      srv->work.wait(guard, [srv] {
+	  return srv->stopping || !srv->ready.empty(); });
+      if (srv->ready.empty())
+	return;
+      c = srv->ready.front();
+      srv->ready.pop_front();
+    }
+
+    if (serve_connection(srv, c, arena))
+    {
+      close(c->fd);
+      delete c;
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(srv->lock);
+      srv->done.push_back(c);
+    }
+    char w = 'w';
+    if (write(srv->wakeup[1], &w, 1) < 0)
+    {
+      // The pipe is full, so the main loop will wake up anyway
+    }
+  }
+}
+
+
+static void serve_reloader(server_t *srv)
+{
+  std::unique_lock<std::mutex> guard(srv->lock);
+
+  for (;;)
+  {
+    srv->reload.wait(guard, [srv] {
+	return srv->stopping || srv->reload_requested; });
+    if (srv->stopping)
+      return;
+    srv->reload_requested = false;
+    guard.unlock();
+
+    state * s = copy_options(srv->options);
+    bool failed = match_load(s, &s->known_files[0], (int)s->known_files.size());
+    if (!failed)
+      match_build_index(s);
+
+    guard.lock();
+    if (failed)
+    {
+      print_error(s, "%s: No matching files loaded, keeping the old ones",
+		  __progname);
+      free_snapshot(s);
+    }
+    else
+    {
+      srv->current = snapshot_t(s, free_snapshot);
+      if (MODE(mode_verbose))
+	print_error(s, "%s: Loaded %zu known hashes", __progname,
+		    s->all_files.size());
+    }
+  }
+}
+
+
+/// Opens the listening socket at path, replacing a stale one
+///
+/// @return Returns the socket, or -1 on error
+static int serve_listen(state *s, const char *path)
+{
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    print_error(s, "%s: Socket path is too long", path);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    print_error(s, "%s: %s", path, strerror(errno));
+    return -1;
+  }
+
+  // A socket left behind by a server which is gone can be replaced,
+  // but one with a server listening on it can not
+  struct stat sb;
+  if (0 == lstat(path, &sb) && S_ISSOCK(sb.st_mode))
+  {
+    if (0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+      print_error(s, "%s: Another server is listening", path);
+      close(fd);
+      return -1;
+    }
+
+    close(fd);
+    unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+      print_error(s, "%s: %s", path, strerror(errno));
+      return -1;
+    }
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(fd, SOMAXCONN) ||
+      fcntl(fd, F_SETFL, O_NONBLOCK))
+  {
+    print_error(s, "%s: %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+static bool make_pipe(int fds[2])
+{
+  if (pipe(fds))
+    return true;
+  return (fcntl(fds[0], F_SETFL, O_NONBLOCK) ||
+	  fcntl(fds[1], F_SETFL, O_NONBLOCK));
+}
+
+
+static void drain(int fd)
+{
+  char buffer[256];
+  while (read(fd, buffer, sizeof(buffer)) > 0)
+    ;
+}
+
+
+static void close_pipe(int fds[2])
+{
+  close(fds[0]);
+  close(fds[1]);
+  fds[0] = fds[1] = -1;
+}
+
+
+bool serve(state *s, const char *path)
+{
+  if (NULL == s || NULL == path)
+    return true;
+
+  server_t srv;
+  srv.options          = copy_options(s);
+  srv.reload_requested = false;
+  srv.stopping         = false;
+
+  // Every query can now be answered at the same time
+  match_build_index(s);
+  srv.current = snapshot_t(s, keep_snapshot);
+
+  if (make_pipe(srv.wakeup) || make_pipe(signal_pipe))
+    fatal_error("%s: Unable to create pipe: %s", __progname, strerror(errno));
+
+  int listener = serve_listen(s, path);
+  if (listener < 0)
+  {
+    close_pipe(srv.wakeup);
+    close_pipe(signal_pipe);
+    delete srv.options;
+    return true;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGHUP, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0 ; i < s->threads ; ++i)
+    workers.push_back(std::thread(serve_worker, &srv));
+  std::thread reloader(serve_reloader, &srv);
+
+  // Connections waiting for something to read
+  std::vector<connection_t *> idle;
+  std::vector<struct pollfd> fds;
+  bool running = true;
+
+  while (running)
+  {
+    fds.clear();
+    struct pollfd p;
+    p.events  = POLLIN;
+    p.revents = 0;
+    p.fd = listener;
+    fds.push_back(p);
+    p.fd = signal_pipe[0];
+    fds.push_back(p);
+    p.fd = srv.wakeup[0];
+    fds.push_back(p);
+    for (size_t i = 0 ; i < idle.size() ; ++i)
+    {
+      p.fd = idle[i]->fd;
+      fds.push_back(p);
+    }
+
+    if (poll(&fds[0], fds.size(), -1) < 0)
+    {
+      if (EINTR == errno)
+	continue;
+      fatal_error("%s: %s", __progname, strerror(errno));
+    }
+
+    // Hand the connections with something to read over to the workers.
+    // Those are done before anything is added to idle below.
+    {
+      std::lock_guard<std::mutex> guard(srv.lock);
+      size_t kept = 0;
+      for (size_t i = 0 ; i < idle.size() ; ++i)
+      {
+	if (fds[i + 3].revents)
+	  srv.ready.push_back(idle[i]);
+	else
+	  idle[kept++] = idle[i];
+      }
+      if (kept != idle.size())
+	srv.work.notify_all();
+      idle.resize(kept);
+    }
+
+    if (fds[1].revents)
+    {
+      char buffer[64];
+      ssize_t n;
+      while ((n = read(signal_pipe[0], buffer, sizeof(buffer))) > 0)
+      {
+	std::lock_guard<std::mutex> guard(srv.lock);
+	for (ssize_t i = 0 ; i < n ; ++i)
+	{
+	  if ('h' == buffer[i])
+	  {
+	    srv.reload_requested = true;
+	    srv.reload.notify_one();
+	  }
+	  else
+	    running = false;
+	}
+      }
+    }
+
+    if (fds[2].revents)
+    {
+      drain(srv.wakeup[0]);
+      std::lock_guard<std::mutex> guard(srv.lock);
+      idle.insert(idle.end(), srv.done.begin(), srv.done.end());
+      srv.done.clear();
+    }
+
+    if (fds[0].revents)
+    {
+      int fd;
+      while ((fd = accept(listener, NULL, NULL)) >= 0)
+      {
+	connection_t * c = new connection_t;
+	c->fd = fd;
+	idle.push_back(c);
+      }
+    }
+  }
+
+  close(listener);
+  unlink(path);
+
+  {
+    std::lock_guard<std::mutex> guard(srv.lock);
+    srv.stopping = true;
+    srv.work.notify_all();
+    srv.reload.notify_all();
+  }
+  for (size_t i = 0 ; i < workers.size() ; ++i)
+    workers[i].join();
+  reloader.join();
+
+  idle.insert(idle.end(), srv.done.begin(), srv.done.end());
+  for (size_t i = 0 ; i < idle.size() ; ++i)
+  {
+    close(idle[i]->fd);
+    delete idle[i];
+  }
+  close_pipe(srv.wakeup);
+  close_pipe(signal_pipe);
+  delete srv.options;
+
+  return false;
+}
+
+#else
+
+bool serve(state *s, const char *path)
+{
+  (void)path;
+  print_error(s, "%s: Serving is not supported on this platform", __progname);
+  return true;
+}
+
+#endif
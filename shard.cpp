@@ -0,0 +1,510 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#include "match.h"
+#include "stats.h"
+#include <algorithm>
+#include <queue>
+
+// ------------------------------------------------------------------
+// OUT OF CORE SIGNATURE COMPARISON
+// ------------------------------------------------------------------
+//
+// Two signatures can only be similar if their block sizes are equal or
+// differ by a factor of two. We put every signature with a block size in
+// [2^i, 2^(i+1)) into the temporary file (shard) i, so each shard only has
+// to be compared with itself and its two neighbors. Each shard is read in
+// chunks which fit into half of the memory budget, and the neighboring
+// shards are streamed past every chunk.
+//
+// The matches are produced out of order. They are collected in memory,
+// sorted and spilled to temporary files (runs) whenever they exceed a
+// quarter of the memory budget, and the runs are finally merged to print
+// the matches in exactly the order find_matches_in_known would have.
+
+#define NUM_SHARDS  (sizeof(unsigned long) * CHAR_BIT)
+
+// Spilled runs are merged this many at a time, once that many runs
+// of the same size have been written
+#define RUN_FANIN   16
+
+// Rough estimate of the bookkeeping overhead for each entry in memory.
+// The strings themselves live in an arena, which only adds padding.
+#define ENTRY_OVERHEAD  32
+
+
+typedef struct
+{
+  /// Position of the entry in the concatenation of all input files
+  uint64_t   seq;
+  /// Index of the file of known hashes the entry came from
+  uint32_t   match_file;
+  Filedata * f;
+} shard_entry_t;
+
+
+typedef struct
+{
+  uint64_t seq_a, seq_b;
+  int score;
+  /// The two entries, as written by write_entry
+  std::string data;
+} shard_match_t;
+
+
+static bool match_less(const shard_match_t& a, const shard_match_t& b)
+{
+  if (a.seq_a != b.seq_a)
+    return a.seq_a < b.seq_a;
+  return a.seq_b < b.seq_b;
+}
+
+
+static unsigned int shard_of(const Filedata * f)
+{
+  unsigned long block_size = strtoul(f->get_signature(), NULL, 10);
+  unsigned int shard = 0;
+
+  while (block_size > 1)
+  {
+    block_size >>= 1;
+    ++shard;
+  }
+
+  return shard;
+}
+
+
+// Serialize the entry into the string out. The match file is stored as
+// an index into the list of input files.
+static void write_entry(std::string& out,
+			uint64_t seq,
+			uint32_t match_file,
+			const Filedata * f)
+{
+  uint32_t sig_len = (uint32_t)f->get_signature_length();
+  uint32_t fn_len  = (uint32_t)(f->get_filename_length() * sizeof(TCHAR));
+
+  out.append((const char *)&seq, sizeof(seq));
+  out.append((const char *)&match_file, sizeof(match_file));
+  out.append((const char *)&sig_len, sizeof(sig_len));
+  out.append((const char *)&fn_len, sizeof(fn_len));
+  out.append(f->get_signature(), sig_len);
+  out.append((const char *)f->get_filename(), fn_len);
+}
+
+
+// Deserialize an entry from data, starting at pos, into arena. Advances
+// pos past the entry. Returns NULL if the data is truncated.
+static Filedata * read_entry(Arena& arena,
+			     const std::string& data,
+			     size_t& pos,
+			     char **fn,
+			     uint64_t *seq,
+			     uint32_t *match_file)
+{
+  uint32_t sig_len, fn_len;
+  const size_t header = sizeof(*seq) + 3 * sizeof(uint32_t);
+
+  if (data.size() - pos < header)
+    return NULL;
+
+  memcpy(seq, data.data() + pos, sizeof(*seq));
+  pos += sizeof(*seq);
+  memcpy(match_file, data.data() + pos, sizeof(*match_file));
+  pos += sizeof(*match_file);
+  memcpy(&sig_len, data.data() + pos, sizeof(sig_len));
+  pos += sizeof(sig_len);
+  memcpy(&fn_len, data.data() + pos, sizeof(fn_len));
+  pos += sizeof(fn_len);
+
+  if (data.size() - pos < (size_t)sig_len + fn_len)
+    return NULL;
+
+  // The entry was valid enough to be loaded, so it isn't checked again
+  const char * sig = data.data() + pos;
+  pos += sig_len;
+  const TCHAR * name = (const TCHAR *)(data.data() + pos);
+  pos += fn_len;
+
+  return Filedata::create(arena,
+			  name,
+			  fn_len / sizeof(TCHAR),
+			  sig,
+			  sig_len,
+			  fn[*match_file]);
+}
+
+
+// Reads a length prefixed record from handle into data.
+// Returns false at the end of the file.
+static bool read_record(FILE * handle, std::string& data)
+{
+  uint32_t len;
+
+  if (fread(&len, sizeof(len), 1, handle) != 1)
+    return false;
+
+  data.resize(len);
+  if (len > 0 && fread(&data[0], len, 1, handle) != 1)
+    internal_error("%s: Truncated temporary file", __progname);
+
+  return true;
+}
+
+
+static void write_record(FILE * handle, const std::string& data)
+{
+  uint32_t len = (uint32_t)data.size();
+
+  if (fwrite(&len, sizeof(len), 1, handle) != 1 ||
+      (len > 0 && fwrite(data.data(), len, 1, handle) != 1))
+    fatal_error("%s: Unable to write temporary file: %s",
+		__progname, strerror(errno));
+}
+
+
+static void write_match(FILE * handle, const shard_match_t& m)
+{
+  std::string rec;
+  int32_t score = m.score;
+
+  rec.append((const char *)&m.seq_a, sizeof(m.seq_a));
+  rec.append((const char *)&m.seq_b, sizeof(m.seq_b));
+  rec.append((const char *)&score, sizeof(score));
+  rec.append(m.data);
+  write_record(handle, rec);
+}
+
+
+static bool read_match(FILE * handle, shard_match_t& m)
+{
+  std::string rec;
+  int32_t score;
+  const size_t header = sizeof(m.seq_a) + sizeof(m.seq_b) + sizeof(score);
+
+  if (!read_record(handle, rec))
+    return false;
+  if (rec.size() < header)
+    internal_error("%s: Truncated temporary file", __progname);
+
+  memcpy(&m.seq_a, rec.data(), sizeof(m.seq_a));
+  memcpy(&m.seq_b, rec.data() + sizeof(m.seq_a), sizeof(m.seq_b));
+  memcpy(&score, rec.data() + sizeof(m.seq_a) + sizeof(m.seq_b), sizeof(score));
+  m.score = score;
+  m.data = rec.substr(header);
+
+  return true;
+}
+
+
+static FILE * temporary_file(void)
+{
+  FILE * handle = tmpfile();
+  if (NULL == handle)
+    fatal_error("%s: Unable to create temporary file: %s",
+		__progname, strerror(errno));
+  return handle;
+}
+
+
+// Display one match. The blank line between files which had matches
+// is displayed in the same way as find_matches_in_known does.
+static void display_match(state *s,
+			  char **fn,
+			  const shard_match_t& m,
+			  bool *have_last,
+			  uint64_t *last)
+{
+  uint64_t seq;
+  uint32_t match_file;
+  size_t pos = 0;
+
+  if (*have_last && *last != m.seq_a)
+    print_status("");
+  *have_last = true;
+  *last = m.seq_a;
+
+  static thread_local Arena arena;
+  Filedata * a = read_entry(arena, m.data, pos, fn, &seq, &match_file);
+  Filedata * b = read_entry(arena, m.data, pos, fn, &seq, &match_file);
+  if (NULL == a || NULL == b)
+    internal_error("%s: Corrupt temporary file", __progname);
+
+  handle_match(s, a, b, m.score);
+
+  arena.clear();
+}
+
+
+// Merge the sorted runs. If out is NULL, the matches are displayed.
+// Otherwise they are written to out, which becomes a new run.
+static void merge_runs(state *s,
+		       char **fn,
+		       std::vector<FILE *>& runs,
+		       FILE * out,
+		       bool *have_last,
+		       uint64_t *last)
+{
+  typedef std::pair<uint64_t, uint64_t> key_t;
+  typedef std::pair<key_t, size_t> head_t;
+  std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t> > heads;
+  std::vector<shard_match_t> current(runs.size());
+
+  for (size_t i = 0 ; i < runs.size() ; ++i)
+  {
+    rewind(runs[i]);
+    if (read_match(runs[i], current[i]))
+      heads.push(head_t(key_t(current[i].seq_a, current[i].seq_b), i));
+  }
+
+  while (!heads.empty())
+  {
+    size_t i = heads.top().second;
+    heads.pop();
+
+    if (NULL == out)
+      display_match(s, fn, current[i], have_last, last);
+    else
+      write_match(out, current[i]);
+
+    if (read_match(runs[i], current[i]))
+      heads.push(head_t(key_t(current[i].seq_a, current[i].seq_b), i));
+  }
+
+  for (size_t i = 0 ; i < runs.size() ; ++i)
+    fclose(runs[i]);
+  runs.clear();
+}
+
+
+// Sort the matches collected in memory and write them to a new run.
+// The level of each run is the number of times its matches have been
+// merged, so that merging only ever combines runs of a similar size and
+// each match is rewritten a logarithmic number of times.
+static void spill_matches(state *s,
+			  char **fn,
+			  std::vector<shard_match_t>& matches,
+			  std::vector<FILE *>& runs,
+			  std::vector<unsigned int>& levels)
+{
+  std::sort(matches.begin(), matches.end(), match_less);
+
+  FILE * run = temporary_file();
+  std::vector<shard_match_t>::const_iterator it;
+  for (it = matches.begin() ; it != matches.end() ; ++it)
+    write_match(run, *it);
+  matches.clear();
+
+  runs.push_back(run);
+  levels.push_back(0);
+
+  // Combine runs so we don't run out of file handles
+  while (runs.size() >= RUN_FANIN &&
+	 levels[levels.size() - RUN_FANIN] == levels.back())
+  {
+    unsigned int level = levels.back() + 1;
+    std::vector<FILE *> last(runs.end() - RUN_FANIN, runs.end());
+    runs.resize(runs.size() - RUN_FANIN);
+    levels.resize(levels.size() - RUN_FANIN);
+
+    FILE * combined = temporary_file();
+    merge_runs(s, fn, last, combined, NULL, NULL);
+    runs.push_back(combined);
+    levels.push_back(level);
+  }
+}
+
+
+// Read entries from the shard until their estimated size exceeds budget.
+// Returns false if there was nothing left to read.
+static bool load_chunk(Arena& arena,
+		       char **fn,
+		       FILE * shard,
+		       uint64_t budget,
+		       std::vector<shard_entry_t>& chunk)
+{
+  std::string data;
+  uint64_t used = 0;
+
+  // Always make progress, however small the budget is
+  while ((chunk.empty() || used < budget) && read_record(shard, data))
+  {
+    shard_entry_t e;
+    size_t pos = 0;
+
+    e.f = read_entry(arena, data, pos, fn, &e.seq, &e.match_file);
+    if (NULL == e.f)
+      internal_error("%s: Corrupt temporary file", __progname);
+    chunk.push_back(e);
+
+    used += sizeof(Filedata) + data.size() + ENTRY_OVERHEAD;
+  }
+
+  return !chunk.empty();
+}
+
+
+bool match_sharded(state *s, char **fn, int count)
+{
+  if (NULL == s || NULL == fn)
+    return true;
+
+  std::vector<FILE *> shards(NUM_SHARDS, (FILE *)NULL);
+  std::vector<uint64_t> shard_sizes(NUM_SHARDS, 0);
+  uint64_t seq = 0;
+
+  // Entries are only kept in memory while they're needed
+  Arena arena, chunk_arena;
+
+  // Partition the input by block size
+  {
+    StatsPhase phase(s->stats, PHASE_LOAD);
+    for (int i = 0 ; i < count ; ++i)
+    {
+      if (sig_file_open(s, fn[i]))
+	continue;
+
+      do {
+	Filedata * f;
+	if (!sig_file_next(s, arena, &f))
+	{
+	  unsigned int k = shard_of(f);
+	  if (NULL == shards[k])
+	    shards[k] = temporary_file();
+
+	  std::string data;
+	  write_entry(data, seq++, (uint32_t)i, f);
+	  write_record(shards[k], data);
+	  ++shard_sizes[k];
+	  arena.clear();
+	}
+      } while (!sig_file_end(s));
+
+      sig_file_close(s);
+    }
+  }
+
+  StatsPhase phase(s->stats, PHASE_COMPARE);
+
+  std::vector<shard_match_t> matches;
+  std::vector<FILE *> runs;
+  std::vector<unsigned int> levels;
+  uint64_t matches_size = 0;
+
+  for (unsigned int k = 0 ; k < NUM_SHARDS ; ++k)
+  {
+    if (NULL == shards[k])
+      continue;
+
+    rewind(shards[k]);
+
+    std::vector<shard_entry_t> chunk;
+    while (load_chunk(chunk_arena,
+		      fn,
+		      shards[k],
+		      s->memory_budget / 2,
+		      chunk))
+    {
+      off_t resume = ftello(shards[k]);
+
+      // When displaying all matches, even the files which cannot
+      // possibly match are displayed, so every shard has to be visited.
+      unsigned int first = 0, last = NUM_SHARDS - 1;
+      if (!MODE(mode_display_all))
+      {
+	first = (k > 0 ? k - 1 : 0);
+	last  = (k + 1 < NUM_SHARDS ? k + 1 : k);
+      }
+
+      if (s->stats != NULL)
+      {
+	// The files in the other shards are too different to compare
+	uint64_t others = 0;
+	for (unsigned int j = 0 ; j < NUM_SHARDS ; ++j)
+	  if (j < first || j > last)
+	    others += shard_sizes[j];
+	s->stats->comparisons_skipped += others * chunk.size();
+      }
+
+      for (unsigned int j = first ; j <= last ; ++j)
+      {
+	if (NULL == shards[j])
+	  continue;
+
+	rewind(shards[j]);
+
+	std::string data;
+	while (read_record(shards[j], data))
+	{
+	  shard_entry_t b;
+	  size_t pos = 0;
+
+	  b.f = read_entry(arena, data, pos, fn, &b.seq, &b.match_file);
+	  if (NULL == b.f)
+	    internal_error("%s: Corrupt temporary file", __progname);
+
+	  std::vector<shard_entry_t>::const_iterator a;
+	  for (a = chunk.begin() ; a != chunk.end() ; ++a)
+	  {
+	    int score = match_score(s, a->f, b.f);
+	    if (-1 == score)
+	      continue;
+	    if (s->stats != NULL)
+	      ++s->stats->matches;
+
+	    shard_match_t m;
+	    m.seq_a = a->seq;
+	    m.seq_b = b.seq;
+	    m.score = score;
+	    write_entry(m.data, a->seq, a->match_file, a->f);
+	    write_entry(m.data, b.seq, b.match_file, b.f);
+	    matches_size += sizeof(m) + m.data.size();
+	    matches.push_back(m);
+
+	    if (matches_size > s->memory_budget / 4)
+	    {
+	      spill_matches(s, fn, matches, runs, levels);
+	      matches_size = 0;
+	    }
+	  }
+
+	  arena.clear();
+	}
+      }
+
+      chunk.clear();
+      chunk_arena.clear();
+      if (fseeko(shards[k], resume, SEEK_SET))
+	fatal_error("%s: Unable to read temporary file: %s",
+		    __progname, strerror(errno));
+    }
+  }
+
+  for (unsigned int k = 0 ; k < NUM_SHARDS ; ++k)
+    if (shards[k])
+      fclose(shards[k]);
+
+  bool have_last = false;
+  uint64_t last = 0;
+
+  if (runs.empty())
+  {
+    std::sort(matches.begin(), matches.end(), match_less);
+    std::vector<shard_match_t>::const_iterator it;
+    for (it = matches.begin() ; it != matches.end() ; ++it)
+      display_match(s, fn, *it, &have_last, &last);
+  }
+  else
+  {
+    if (!matches.empty())
+      spill_matches(s, fn, matches, runs, levels);
+    merge_runs(s, fn, runs, NULL, &have_last, &last);
+  }
+
+  if (have_last)
+    print_status("");
+
+  return false;
+}
@@ -0,0 +1,668 @@
+#ifndef __SPAMSUM_H
+#define __SPAMSUM_H
+
+/// @file spamsum.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fuzzy.h"
+
+// libfuzzy's engine, with its parameters as template arguments
+//
+// fuzzy.c has to work for any values of its parameters, with whatever C
+// compiler it is given. Here they are compile-time constants, which lets
+// the engine keep the window of the rolling hash in a register, compute
+// the partial FNV hashes of four block sizes at once, and check for the
+// end of a piece with a multiplication instead of a division. With the
+// values of fuzzy.h it gives the same digests and scores as libfuzzy,
+// which make check verifies.
+
+#if FUZZY_ENABLE_STATS
+# define SPAMSUM_COUNT(counter) \
+  ((void)__atomic_fetch_add(&s_stats.counter, 1, __ATOMIC_RELAXED))
+#else
+# define SPAMSUM_COUNT(counter) ((void)0)
+#endif
+
+
+/// The partial FNV hash of c added to h. Only the low six bits of the
+/// full hash are kept, which is what sum_table.h in libfuzzy holds.
+constexpr unsigned char spamsum_sum_hash(unsigned int h, unsigned int c)
+{
+  return (unsigned char)(((h * 0x01000193u) ^ c) & 0x3f);
+}
+
+
+/// Improves x, an inverse of m modulo 2^32, by steps steps of Newton's
+/// method, each of which doubles the number of bits it's right in
+constexpr uint32_t spamsum_newton(uint32_t m, uint32_t x, int steps)
+{
+  return (0 == steps) ? x : spamsum_newton(m, x * (2u - m * x), steps - 1);
+}
+
+/// Returns the inverse of the odd number m modulo 2^32. m is its own
+/// inverse in the lowest three bits.
+constexpr uint32_t spamsum_inverse(uint32_t m)
+{
+  return spamsum_newton(m, m, 4);
+}
+
+
+/// @brief Computes and compares fuzzy hashes like libfuzzy does
+///
+/// Length is SPAMSUM_LENGTH, Window is the size of the window of the
+/// rolling hash, MinBlockSize the smallest block size and NumBlockhashes
+/// the number of block sizes. An object hashes one input at a time, like
+/// a struct fuzzy_state, and is used again after calling reset().
+template <unsigned int Length,
+	  unsigned int Window,
+	  unsigned int MinBlockSize,
+	  unsigned int NumBlockhashes>
+class Spamsum
+{
+  static_assert(Length >= 2 && Length <= 64,
+		"Each character of a hash must have a bit in a 64 bit word");
+  static_assert(Window >= 1 && Window <= 8,
+		"The window of the rolling hash is kept in a 64 bit word");
+  static_assert(MinBlockSize % 2 == 1,
+		"The end of a piece is found with the inverse of the block size");
+  static_assert((uint32_t)(spamsum_inverse(MinBlockSize) * MinBlockSize) == 1,
+		"The inverse of the block size is wrong");
+  static_assert(((uint64_t)MinBlockSize << (NumBlockhashes - 1)) <= UINT32_MAX,
+		"Block sizes must fit in 32 bits");
+
+ public:
+  /// The result of digest() is at most this long, including the NUL
+  static const size_t max_result = 2 * Length + 20;
+
+  static uint32_t block_size(unsigned int index)
+  {
+    return (uint32_t)MinBlockSize << index;
+  }
+
+  static uint_least64_t total_size_max(void)
+  {
+    return (uint_least64_t)block_size(NumBlockhashes - 1) * Length;
+  }
+
+  Spamsum() { reset(); }
+
+  /// Starts hashing a new input
+  void reset(void)
+  {
+    m_bhstart = 0;
+    m_bhend = 1;
+    m_bhendlimit = NumBlockhashes - 1;
+    memset(m_sums, 0, sizeof(m_sums));
+    set_sum(H(0), HASH_INIT);
+    set_sum(HALFH(0), HASH_INIT);
+    m_bh[0].digest[0] = '\0';
+    m_bh[0].halfdigest = '\0';
+    m_bh[0].dindex = 0;
+    m_total_size = 0;
+    m_fixed_size = 0;
+    m_reduce_border = (uint_least64_t)MinBlockSize * Length;
+    m_size_fixed = false;
+    m_need_lasth = false;
+    m_lasth = 0;
+    m_rollmask = 0;
+    memset(&m_roll, 0, sizeof(m_roll));
+  }
+
+  /// As fuzzy_set_total_input_length
+  ///
+  /// @return Returns false on success, true on error, with errno set
+  bool set_total_input_length(uint_least64_t total)
+  {
+    unsigned int bi = 0;
+    if (total > total_size_max())
+    {
+      errno = EOVERFLOW;
+      return true;
+    }
+    if (m_size_fixed && m_fixed_size != total)
+    {
+      errno = EINVAL;
+      return true;
+    }
+    m_size_fixed = true;
+    m_fixed_size = total;
+    while ((uint_least64_t)block_size(bi) * Length < total)
+    {
+      ++bi;
+      if (bi == NumBlockhashes - 2)
+	break;
+    }
+    m_bhendlimit = bi + 1;
+    return false;
+  }
+
+  /// Hashes the next size bytes of the input
+  void update(const unsigned char * buffer, size_t size)
+  {
+    if (size > total_size_max() || total_size_max() - size < m_total_size)
+      m_total_size = total_size_max() + 1;
+    else
+      m_total_size += size;
+
+    while (size > 0)
+    {
+      size_t n;
+      switch (m_need_lasth ? 0 : WORD(HALFH(m_bhend - 1)) - WORD(H(m_bhstart)) + 1)
+      {
+      case 1:  n = hash_piece<1>(buffer, size); break;
+      case 2:  n = hash_piece<2>(buffer, size); break;
+      case 3:  n = hash_piece<3>(buffer, size); break;
+      case 4:  n = hash_piece<4>(buffer, size); break;
+      default: n = hash_piece_any(buffer, size); break;
+      }
+      buffer += n;
+      size -= n;
+    }
+  }
+
+  /// As fuzzy_digest without any flags. result must hold max_result bytes.
+  ///
+  /// @return Returns false on success, true on error, with errno set
+  bool digest(char * result) const
+  {
+    unsigned int bi = m_bhstart;
+    uint32_t h = m_roll.h1 + m_roll.h2 + m_roll.h3;
+    char ch;
+
+    if (m_total_size > total_size_max())
+    {
+      errno = EOVERFLOW;
+      return true;
+    }
+    if (m_size_fixed && m_fixed_size != m_total_size)
+    {
+      errno = EINVAL;
+      return true;
+    }
+
+    // The block size the size of the input suggests, and then the
+    // largest one with enough of a hash
+    while ((uint_least64_t)block_size(bi) * Length < m_total_size)
+      ++bi;
+    if (bi >= m_bhend)
+      bi = m_bhend - 1;
+    while (bi > m_bhstart && m_bh[bi].dindex < Length / 2)
+      --bi;
+
+    result += sprintf(result, "%lu:", (unsigned long)block_size(bi));
+
+    memcpy(result, m_bh[bi].digest, m_bh[bi].dindex);
+    result += m_bh[bi].dindex;
+    ch = (h != 0) ? b64()[sum(H(bi))] : m_bh[bi].digest[m_bh[bi].dindex];
+    if (ch != '\0')
+      *result++ = ch;
+    *result++ = ':';
+
+    if (bi < m_bhend - 1)
+    {
+      ++bi;
+      size_t sz = m_bh[bi].dindex;
+      if (sz > Length / 2 - 1)
+	sz = Length / 2 - 1;
+      memcpy(result, m_bh[bi].digest, sz);
+      result += sz;
+      ch = (h != 0) ? b64()[sum(HALFH(bi))] : m_bh[bi].halfdigest;
+      if (ch != '\0')
+	*result++ = ch;
+    }
+    else if (h != 0)
+      *result++ = b64()[(0 == bi) ? sum(H(bi)) : m_lasth];
+
+    *result = '\0';
+    return false;
+  }
+
+  /// As fuzzy_compare
+  static int compare(const char * sig1, const char * sig2);
+
+  /// Adds the work counted with --enable-stats to stats
+  static void add_stats(struct fuzzy_stats * stats)
+  {
+#if FUZZY_ENABLE_STATS
+    for (unsigned int i = 0 ; i < NumBlockhashes && i < FUZZY_NUM_BLOCKHASHES ; ++i)
+      stats->triggers[i] += __atomic_load_n(&s_stats.triggers[i], __ATOMIC_RELAXED);
+    stats->forks       += __atomic_load_n(&s_stats.forks, __ATOMIC_RELAXED);
+    stats->reductions  += __atomic_load_n(&s_stats.reductions, __ATOMIC_RELAXED);
+    stats->substring_rejections +=
+      __atomic_load_n(&s_stats.substring_rejections, __ATOMIC_RELAXED);
+    stats->edit_distances +=
+      __atomic_load_n(&s_stats.edit_distances, __ATOMIC_RELAXED);
+#else
+    (void)stats;
+#endif
+  }
+
+ private:
+  static const unsigned char HASH_INIT = 0x27;
+
+  static const char * b64(void)
+  {
+    return "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  }
+
+  // The partial FNV hashes are kept in 16 bit lanes, four to a word. A
+  // hash is less than 64, so multiplying a word by the FNV prime, which
+  // only matters modulo 256, multiplies each lane without carrying into
+  // the next one. The hashes of block size i are in lanes H(i) and
+  // HALFH(i), so the two to four block sizes being computed most of the
+  // time fit in one or two words.
+  static const unsigned int LANES = 4;
+  static const unsigned int WORDS = (2 * NumBlockhashes + LANES - 1) / LANES;
+
+  static unsigned int H(unsigned int i)        { return 2 * i; }
+  static unsigned int HALFH(unsigned int i)    { return 2 * i + 1; }
+  static unsigned int WORD(unsigned int lane)  { return lane / LANES; }
+  static unsigned int SHIFT(unsigned int lane) { return 16 * (lane % LANES); }
+
+  unsigned char sum(unsigned int lane) const
+  {
+    return (unsigned char)(m_sums[WORD(lane)] >> SHIFT(lane)) & 0x3f;
+  }
+
+  void set_sum(unsigned int lane, unsigned char h)
+  {
+    uint64_t& w = m_sums[WORD(lane)];
+    w = (w & ~((uint64_t)0xffff << SHIFT(lane))) | ((uint64_t)h << SHIFT(lane));
+  }
+
+  /// Adds c to the hashes in each lane of w
+  static uint64_t sum_hash(uint64_t w, unsigned char c)
+  {
+    return ((w * 0x93) ^ (c * UINT64_C(0x0001000100010001))) &
+      UINT64_C(0x003f003f003f003f);
+  }
+
+  struct blockhash
+  {
+    unsigned int dindex;
+    char         digest[Length];
+    char         halfdigest;
+  };
+
+  uint_least64_t   m_total_size;
+  uint_least64_t   m_fixed_size;
+  uint_least64_t   m_reduce_border;
+  unsigned int     m_bhstart, m_bhend, m_bhendlimit;
+  bool             m_size_fixed;
+  bool             m_need_lasth;
+  unsigned char    m_lasth;
+  uint32_t         m_rollmask;
+  uint64_t         m_sums[WORDS];
+  struct blockhash m_bh[NumBlockhashes];
+
+  /// The rolling hash. The window holds the last Window bytes, the
+  /// latest in the lowest byte.
+  struct roll
+  {
+    uint64_t window;
+    uint32_t h1, h2, h3;
+  };
+
+  struct roll m_roll;
+
+#if FUZZY_ENABLE_STATS
+  static struct fuzzy_stats s_stats;
+#endif
+
+  /// Adds c to the rolling hash r
+  ///
+  /// @return Returns the rolling hash plus one
+  static uint32_t roll_hash(struct roll& r, unsigned char c)
+  {
+    r.h2 -= r.h1;
+    r.h2 += Window * (uint32_t)c;
+    r.h1 += (uint32_t)c;
+    r.h1 -= (uint32_t)(r.window >> (8 * (Window - 1))) & 0xff;
+    r.window = (r.window << 8) | c;
+    r.h3 <<= 5;
+    r.h3 ^= c;
+    return r.h1 + r.h2 + r.h3 + 1;
+  }
+
+  /// Returns true if a piece of the input ends where the rolling hash
+  /// plus one is horg. h is then horg divided by MinBlockSize.
+  bool ends_piece(uint32_t horg, uint32_t * h) const
+  {
+    // When horg is a multiple of MinBlockSize, multiplying it by the
+    // inverse of MinBlockSize divides it. Anything else gives a larger
+    // number, and zero never ends a piece. Both tests are made, so that
+    // there's only one branch, which is seldom taken.
+    *h = horg * spamsum_inverse(MinBlockSize);
+    return (*h - 1 < UINT32_MAX / MinBlockSize) & !(*h & m_rollmask);
+  }
+
+  /// Hashes buffer up to the end of the next piece, with the rolling hash
+  /// and the Words words of hashes being computed in local variables
+  ///
+  /// @return Returns the number of bytes hashed
+  template <unsigned int Words>
+  size_t hash_piece(const unsigned char * buffer, size_t size)
+  {
+    uint64_t * sums = m_sums + WORD(H(m_bhstart));
+    uint64_t w[Words];
+    struct roll r = m_roll;
+    uint32_t q = 0;
+    bool ended = false;
+    size_t n = 0;
+
+    for (unsigned int k = 0 ; k < Words ; ++k)
+      w[k] = sums[k];
+
+    while (n < size && !ended)
+    {
+      unsigned char c = buffer[n++];
+      uint32_t horg = roll_hash(r, c);
+      for (unsigned int k = 0 ; k < Words ; ++k)
+	w[k] = sum_hash(w[k], c);
+      ended = ends_piece(horg, &q);
+    }
+
+    for (unsigned int k = 0 ; k < Words ; ++k)
+      sums[k] = w[k];
+    m_roll = r;
+    if (ended)
+      end_piece(q >> m_bhstart);
+    return n;
+  }
+
+  /// As hash_piece, for any number of words and the last hash
+  size_t hash_piece_any(const unsigned char * buffer, size_t size)
+  {
+    unsigned int first = WORD(H(m_bhstart)), last = WORD(HALFH(m_bhend - 1));
+    uint32_t q = 0;
+    bool ended = false;
+    size_t n = 0;
+
+    while (n < size && !ended)
+    {
+      unsigned char c = buffer[n++];
+      uint32_t horg = roll_hash(m_roll, c);
+      for (unsigned int k = first ; k <= last ; ++k)
+	m_sums[k] = sum_hash(m_sums[k], c);
+      if (m_need_lasth)
+	m_lasth = spamsum_sum_hash(m_lasth, c);
+      ended = ends_piece(horg, &q);
+    }
+
+    if (ended)
+      end_piece(q >> m_bhstart);
+    return n;
+  }
+
+  /// Ends a piece of the input at each block size h says it ends at
+  void end_piece(uint32_t h)
+  {
+    unsigned int i = m_bhstart;
+    do
+    {
+      SPAMSUM_COUNT(triggers[i]);
+      if (0 == m_bh[i].dindex)
+	try_fork_blockhash();
+      m_bh[i].digest[m_bh[i].dindex] = b64()[sum(H(i))];
+      m_bh[i].halfdigest = b64()[sum(HALFH(i))];
+      if (m_bh[i].dindex < Length - 1)
+      {
+	// The last piece of a full hash takes in the rest of the input
+	m_bh[i].digest[++(m_bh[i].dindex)] = '\0';
+	set_sum(H(i), HASH_INIT);
+	if (m_bh[i].dindex < Length / 2)
+	{
+	  set_sum(HALFH(i), HASH_INIT);
+	  m_bh[i].halfdigest = '\0';
+	}
+      }
+      else
+	try_reduce_blockhash();
+      if (h & 1)
+	break;
+      h >>= 1;
+    } while (++i < m_bhend);
+  }
+
+  void try_fork_blockhash(void)
+  {
+    unsigned int last = m_bhend - 1;
+    if (m_bhend <= m_bhendlimit)
+    {
+      SPAMSUM_COUNT(forks);
+      set_sum(H(last + 1), sum(H(last)));
+      set_sum(HALFH(last + 1), sum(HALFH(last)));
+      m_bh[last + 1].digest[0] = '\0';
+      m_bh[last + 1].halfdigest = '\0';
+      m_bh[last + 1].dindex = 0;
+      ++m_bhend;
+    }
+    else if (m_bhend == NumBlockhashes && !m_need_lasth)
+    {
+      m_need_lasth = true;
+      m_lasth = sum(H(last));
+    }
+  }
+
+  void try_reduce_blockhash(void)
+  {
+    if (m_bhend - m_bhstart < 2)
+      return;
+    if (m_reduce_border >= (m_size_fixed ? m_fixed_size : m_total_size))
+      return;
+    if (m_bh[m_bhstart + 1].dindex < Length / 2)
+      return;
+    SPAMSUM_COUNT(reductions);
+    ++m_bhstart;
+    m_reduce_border *= 2;
+    m_rollmask = m_rollmask * 2 + 1;
+  }
+
+  static bool copy_eliminate_sequences(char * out,
+				       unsigned int * len,
+				       const char ** in,
+				       char end);
+  static bool has_common_substring(const uint64_t * parray,
+				   const char * s2,
+				   size_t s2len);
+  static uint32_t score_strings(const char * s1, size_t s1len,
+				const char * s2, size_t s2len,
+				unsigned long block_size);
+};
+
+
+#if FUZZY_ENABLE_STATS
+template <unsigned int L, unsigned int W, unsigned int M, unsigned int N>
+struct fuzzy_stats Spamsum<L, W, M, N>::s_stats;
+#endif
+
+
+/// Copies the part of a hash up to end, or the end of the string, leaving
+/// out the fourth and later characters of runs of the same character
+///
+/// @return Returns false on success, true if the part is too long
+template <unsigned int L, unsigned int W, unsigned int M, unsigned int N>
+bool Spamsum<L, W, M, N>::copy_eliminate_sequences(char * out,
+						   unsigned int * len,
+						   const char ** in,
+						   char end)
+{
+  unsigned int n = 0;
+  const char * p = *in;
+
+  for ( ; *p && *p != end ; ++p)
+  {
+    if (n >= 3 && *p == out[n - 1] && *p == out[n - 2] && *p == out[n - 3])
+      continue;
+    if (n == L)
+      return true;
+    out[n++] = *p;
+  }
+
+  *in  = p;
+  *len = n;
+  return false;
+}
+
+
+/// Returns true if s2 and the string parray was made from have a substring
+/// of Window characters in common
+template <unsigned int L, unsigned int W, unsigned int M, unsigned int N>
+bool Spamsum<L, W, M, N>::has_common_substring(const uint64_t * parray,
+					       const char * s2,
+					       size_t s2len)
+{
+  // Both strings are reversed, so that parray can be used as it is
+  size_t l = s2len - W;
+  for (;;)
+  {
+    const unsigned char * ch = (const unsigned char *)s2 + l;
+    uint64_t d = parray[*ch];
+    size_t r = l + (W - 1);
+    while (d)
+    {
+      ++l;
+      d = (d << 1) & parray[*++ch];
+      if (l == r && d != 0)
+	return true;
+    }
+    // A match can't start within Window of a mismatch
+    if (l < W)
+      return false;
+    l -= W;
+  }
+}
+
+
+template <unsigned int L, unsigned int W, unsigned int M, unsigned int N>
+uint32_t Spamsum<L, W, M, N>::score_strings(const char * s1, size_t s1len,
+					    const char * s2, size_t s2len,
+					    unsigned long block_size)
+{
+  uint64_t parray[256];
+  uint32_t score;
+
+  if (s1len < W || s2len < W)
+  {
+    SPAMSUM_COUNT(substring_rejections);
+    return 0;
+  }
+
+  memset(parray, 0, sizeof(parray));
+  for (size_t i = 0 ; i < s1len ; ++i)
+    parray[(unsigned char)s1[i]] |= (uint64_t)1 << i;
+
+  if (!has_common_substring(parray, s2, s2len))
+  {
+    SPAMSUM_COUNT(substring_rejections);
+    return 0;
+  }
+
+  // The edit distance, counting insertions and deletions only, from the
+  // length of the longest common subsequence computed in parallel
+  SPAMSUM_COUNT(edit_distances);
+  uint64_t h = ~(uint64_t)0;
+  for (size_t i = 0 ; i < s2len ; ++i)
+  {
+    uint64_t p = h & parray[(unsigned char)s2[i]];
+    h = (h + p) | (h - p);
+  }
+#if defined(__GNUC__)
+  size_t llcs = (size_t)__builtin_popcountll(~h);
+#else
+  size_t llcs = 0;
+  for (uint64_t x = ~h ; x ; x &= x - 1)
+    ++llcs;
+#endif
+  score = (uint32_t)(s1len + s2len - 2 * llcs);
+
+  // Scaled to the lengths, out of 100, where 100 is a perfect match
+  score = (score * L) / (uint32_t)(s1len + s2len);
+  score = (100 * score) / L;
+  score = 100 - score;
+
+  // Small block sizes don't get to claim a large match
+  if (block_size >= (99 + W) / W * M)
+    return score;
+  uint32_t minlen = (uint32_t)(s1len < s2len ? s1len : s2len);
+  if (score > block_size / M * minlen)
+    score = block_size / M * minlen;
+  return score;
+}
+
+
+template <unsigned int L, unsigned int W, unsigned int M, unsigned int N>
+int Spamsum<L, W, M, N>::compare(const char * sig1, const char * sig2)
+{
+  char s1b1[L], s1b2[L], s2b1[L], s2b2[L];
+  unsigned int s1b1len, s1b2len, s2b1len, s2b2len;
+  unsigned long block_size1, block_size2;
+  char * end;
+
+  if (NULL == sig1 || NULL == sig2)
+    return -1;
+
+  errno = 0;
+  block_size1 = strtoul(sig1, &end, 10);
+  if (end == sig1 || *end != ':' || (ULONG_MAX == block_size1 && ERANGE == errno))
+    return -1;
+  sig1 = end + 1;
+  errno = 0;
+  block_size2 = strtoul(sig2, &end, 10);
+  if (end == sig2 || *end != ':' || (ULONG_MAX == block_size2 && ERANGE == errno))
+    return -1;
+  sig2 = end + 1;
+
+  // Hashes with no block size in common can't be compared, but aren't
+  // malformed either
+  if (block_size1 != block_size2 &&
+      (block_size1 > ULONG_MAX / 2 || block_size1 * 2 != block_size2) &&
+      (block_size1 % 2 == 1 || block_size1 / 2 != block_size2))
+    return 0;
+
+  if (copy_eliminate_sequences(s1b1, &s1b1len, &sig1, ':') || !*sig1++ ||
+      copy_eliminate_sequences(s1b2, &s1b2len, &sig1, ',') ||
+      copy_eliminate_sequences(s2b1, &s2b1len, &sig2, ':') || !*sig2++ ||
+      copy_eliminate_sequences(s2b2, &s2b2len, &sig2, ','))
+    return -1;
+
+  if (block_size1 == block_size2 &&
+      s1b1len == s2b1len && s1b2len == s2b2len &&
+      !memcmp(s1b1, s2b1, s1b1len) && !memcmp(s1b2, s2b2, s1b2len))
+    return 100;
+
+  if (block_size1 <= ULONG_MAX / 2)
+  {
+    if (block_size1 == block_size2)
+    {
+      uint32_t score1 = score_strings(s1b1, s1b1len, s2b1, s2b1len, block_size1);
+      uint32_t score2 = score_strings(s1b2, s1b2len, s2b2, s2b2len, block_size1 * 2);
+      return (int)(score1 > score2 ? score1 : score2);
+    }
+    if (block_size1 * 2 == block_size2)
+      return (int)score_strings(s2b1, s2b1len, s1b2, s1b2len, block_size2);
+    return (int)score_strings(s1b1, s1b1len, s2b2, s2b2len, block_size1);
+  }
+
+  if (block_size1 == block_size2)
+    return (int)score_strings(s1b1, s1b1len, s2b1, s2b1len, block_size1);
+  if (block_size1 % 2 == 0 && block_size1 / 2 == block_size2)
+    return (int)score_strings(s1b1, s1b1len, s2b2, s2b2len, block_size1);
+  return 0;
+}
+
+
+/// The engine with the values libfuzzy uses
+typedef Spamsum<SPAMSUM_LENGTH, 7, 3, FUZZY_NUM_BLOCKHASHES> FuzzyEngine;
+
+#undef SPAMSUM_COUNT
+
+#endif  // ifndef __SPAMSUM_H
@@ -11,21 +11,33 @@
 
 #include "main.h"
 
+#include <atomic>
 #include <string>
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 #include "fuzzy.h"
 #include "tchar-local.h"
 #include "filedata.h"
 
+class LshIndex;
+class HashCache;
+class HashPipeline;
+class RunStats;
+class ProgressReporter;
+class Decompressor;
+
 // This is a kludge, but it works.
 #define __progname "ssdeep"
 
 #define SSDEEPV1_0_HEADER        "ssdeep,1.0--blocksize:hash:hash,filename"
 #define SSDEEPV1_1_HEADER        "ssdeep,1.1--blocksize:hash:hash,filename"
 #define OUTPUT_FILE_HEADER     SSDEEPV1_1_HEADER
+/// The header of the binary format, described in FILEFORMAT. The records
+/// start right after its newline.
+#define SSDEEPV2_0_HEADER        "ssdeep,2.0--binary"
 
 // We print a warning for files smaller than this size
 #define SSDEEP_MIN_FILE_SIZE   4096
@@ -72,17 +84,101 @@ typedef struct _filedata_t
 } filedata_t;
 
 
+/// Buffered reader for a file of known hashes, or a part of one
+typedef struct {
+  FILE     * handle;
+  /// Decompresses the data of handle, or NULL if it isn't compressed
+  Decompressor * decompressor;
+  /// The unread data runs from pos to len
+  char     * buffer;
+  size_t     buffer_size, pos, len;
+  /// Number of bytes of the file which are still to be read
+  uint64_t   remaining;
+  /// True once all of the data to be read is in the buffer
+  bool       eof;
+  /// True if the file is in the binary format, whose records are read
+  /// instead of lines
+  bool       binary;
+} sig_reader_t;
+
+
 typedef struct {
   uint64_t  mode;
 
   bool       first_file_processed;
 
+  /// Storage for the known hashes and anything else which lives
+  /// as long as the program does
+  Arena arena;
+
   // Known hashes
   std::vector<Filedata *> all_files;
 
+  /// Maps each distinct signature in all_files to its signature id
+  std::unordered_map<const Filedata *,
+		     size_t,
+		     FiledataSignatureHash,
+		     FiledataSignatureEqual> signature_ids;
+
   // Known clusters
   std::set< std::set<Filedata *> * > all_clusters;
 
+  /// Number of bands and rows per band of the LSH index. When lsh_bands
+  /// is zero every known hash is compared against every file.
+  unsigned int lsh_bands, lsh_rows;
+  /// Candidate index over all_files, built on first use
+  LshIndex * index;
+
+  /// Approximate memory limit for comparing signature files, in bytes.
+  /// When zero, all signatures are loaded into all_files.
+  uint64_t memory_budget;
+
+  /// Number of threads to use when there is work to divide up
+  unsigned int threads;
+
+  /// Files of known hashes given with -m or -k
+  std::vector<char *> known_files;
+
+  /// Unix domain socket to answer queries on, or NULL
+  const char * serve_path;
+
+  /// Hashes of files from earlier runs, or NULL
+  HashCache * cache;
+
+  /// Hashes files on other threads, or NULL to hash them one at a time
+  HashPipeline * pipeline;
+
+  /// Read files in the order they are on the disk instead of the order
+  /// they are found in
+  bool locality;
+
+  /// Hash the members of tar, tar.gz and zip archives instead of the
+  /// archives themselves
+  bool archives;
+
+  /// Write the hashes in the binary format instead of as text
+  bool binary;
+
+  /// File listing the files to hash, "-" for standard input, or NULL
+  const char * list_file;
+
+  /// Only regular files of at least min_size and at most max_size bytes
+  /// are hashed
+  uint64_t min_size, max_size;
+
+  /// If there are any include patterns, only files matching one of them
+  /// are hashed. Files matching an exclude pattern are never hashed.
+  std::vector<std::basic_string<TCHAR> > include_patterns;
+  std::vector<std::basic_string<TCHAR> > exclude_patterns;
+
+  /// Counters and timers for --stats and --progress, or NULL
+  RunStats * stats;
+  /// Write the statistics out at the end of the run
+  bool print_stats;
+
+  /// Shows how the run is going, or NULL
+  ProgressReporter * progress;
+
   /// Display files who score above the threshold
   uint8_t   threshold;
 
@@ -94,10 +190,10 @@ typedef struct {
 
   /// Current line number in file of known hashes
   uint64_t line_number;
-  /// File handle to file of known hashes
-  FILE     * known_handle;
-  /// Filename of known hashes
-  char     * known_fn;
+  /// File of known hashes
+  sig_reader_t known;
+  /// Filename of known hashes, kept in the arena
+  const char * known_fn;
 
 } state;
 
@@ -171,6 +267,11 @@ bool process_win32(state *s, TCHAR *fn);
 bool process_normal(state *s, TCHAR *fn);
 bool process_stdin(state *s);
 
+/// Adds up the sizes of the files under fn which would be hashed, to
+/// estimate how long hashing them will take. Displays nothing, and
+/// stops early once stop is true.
+uint64_t measure_files(const state *s, const TCHAR *fn, const std::atomic<bool>& stop);
+
 
 // *********************************************************************
 // Fuzzy Hashing Engine
@@ -186,6 +287,12 @@ void try_msg(void);
 
 bool expanded_path(TCHAR *p);
 
+/// Sets every option in s to its default, as before the command line
+/// is read
+///
+/// @return Returns false on success, true on error
+bool initialize_state(state *s);
+
 void sanity_check(state *s, bool condition, const char *msg);
 
 // The basename function kept misbehaving on OS X, so I rewrote it.
@@ -209,6 +316,14 @@ void shift_string(char *fn, size_t start, size_t new_start);
 
 bool remove_escaped_quotes(char * str);
 
+// Parses a size such as 4096, 64k, 512M or 2G into result.
+// Returns false on success, true on error.
+bool parse_size(const char *str, uint64_t *result);
+
+// Returns true if str matches the shell wildcard pattern, where * matches
+// any characters, ? matches one and [...] matches one of a set.
+bool glob_match(const TCHAR *pattern, const TCHAR *str);
+
 void prepare_filename(state *s, TCHAR *fn);
 
 // Returns the size of the given file, in bytes.
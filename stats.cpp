@@ -0,0 +1,178 @@
+// SSDEEP
+// $Id$
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+
+#include "ssdeep.h"
+#include "stats.h"
+#include "output.h"
+#include "spamsum.h"
+#include <chrono>
+
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
+#define NSEC_PER_SEC  1000000000ull
+
+static const char * const phase_names[PHASE_COUNT] = {
+  "load", "walk", "hash", "compare"
+};
+
+/// The innermost phase on this thread
+static thread_local StatsPhase * current_phase = NULL;
+
+
+static uint64_t wall_time(void)
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>
+    (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/// Returns the CPU time used by this thread, or zero if we can't tell
+static uint64_t thread_cpu_time(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+  if (0 == clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#endif
+  return 0;
+}
+
+
+RunStats::RunStats() :
+  files_hashed(0),
+  files_skipped(0),
+  files_failed(0),
+  bytes_read(0),
+  comparisons(0),
+  comparisons_rejected(0),
+  comparisons_skipped(0),
+  matches(0),
+  m_main(std::this_thread::get_id()),
+  m_start(wall_time())
+{
+  for (int i = 0 ; i < PHASE_COUNT ; ++i)
+  {
+    m_wall[i] = 0;
+    m_cpu[i]  = 0;
+  }
+}
+
+
+void RunStats::report(void)
+{
+  double cpu = 0;
+  unsigned long long peak_rss = 0;
+
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+  struct rusage ru;
+  if (0 == getrusage(RUSAGE_SELF, &ru))
+  {
+    cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+      ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+# ifdef __APPLE__
+    peak_rss = (unsigned long long)ru.ru_maxrss;
+# else
+    peak_rss = (unsigned long long)ru.ru_maxrss * 1024;
+# endif
+  }
+#endif
+
+  stdout_output().flush();
+  fflush(stdout);
+
+  fprintf(stderr, "{\"wall\":%.6f,\"cpu\":%.6f,\"peak_rss\":%llu,\"phases\":{",
+	  (double)(wall_time() - m_start) / NSEC_PER_SEC,
+	  cpu,
+	  peak_rss);
+  for (int i = 0 ; i < PHASE_COUNT ; ++i)
+    fprintf(stderr, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}",
+	    i ? "," : "",
+	    phase_names[i],
+	    (double)m_wall[i] / NSEC_PER_SEC,
+	    (double)m_cpu[i] / NSEC_PER_SEC);
+  fprintf(stderr,
+	  "},\"files_hashed\":%llu,\"files_skipped\":%llu,"
+	  "\"files_failed\":%llu,\"bytes_read\":%llu,"
+	  "\"comparisons\":%llu,\"comparisons_rejected\":%llu,"
+	  "\"comparisons_skipped\":%llu,\"matches\":%llu",
+	  (unsigned long long)files_hashed,
+	  (unsigned long long)files_skipped,
+	  (unsigned long long)files_failed,
+	  (unsigned long long)bytes_read,
+	  (unsigned long long)comparisons,
+	  (unsigned long long)comparisons_rejected,
+	  (unsigned long long)comparisons_skipped,
+	  (unsigned long long)matches);
+
+  // The library only counts its work if it was built to, and then so
+  // does FuzzyEngine, which files are hashed and compared with
+  struct fuzzy_stats fs;
+  if (0 == fuzzy_get_stats(&fs))
+  {
+    FuzzyEngine::add_stats(&fs);
+    fprintf(stderr, ",\"fuzzy\":{\"triggers\":[");
+    for (int i = 0 ; i < FUZZY_NUM_BLOCKHASHES ; ++i)
+      fprintf(stderr, "%s%llu", i ? "," : "", (unsigned long long)fs.triggers[i]);
+    fprintf(stderr,
+	    "],\"forks\":%llu,\"reductions\":%llu,"
+	    "\"substring_rejections\":%llu,\"edit_distances\":%llu}",
+	    (unsigned long long)fs.forks,
+	    (unsigned long long)fs.reductions,
+	    (unsigned long long)fs.substring_rejections,
+	    (unsigned long long)fs.edit_distances);
+  }
+
+  fprintf(stderr, "}%s", NEWLINE);
+}
+
+
+StatsPhase::StatsPhase(RunStats * stats, phase_t phase) :
+  m_stats(stats), m_phase(phase)
+{
+  if (NULL == m_stats)
+    return;
+
+  m_main  = (std::this_thread::get_id() == m_stats->m_main);
+  m_outer = current_phase;
+  if (m_outer != NULL)
+    m_outer->charge();
+
+  m_wall = m_main ? wall_time() : 0;
+  m_cpu  = thread_cpu_time();
+  current_phase = this;
+}
+
+
+StatsPhase::~StatsPhase()
+{
+  if (NULL == m_stats)
+    return;
+
+  charge();
+  current_phase = m_outer;
+
+  // The outer phase starts again now
+  if (m_outer != NULL)
+  {
+    m_outer->m_wall = m_wall;
+    m_outer->m_cpu  = m_cpu;
+  }
+}
+
+
+void StatsPhase::charge(void)
+{
+  uint64_t cpu = thread_cpu_time();
+  m_stats->m_cpu[m_phase] += cpu - m_cpu;
+  m_cpu = cpu;
+
+  if (m_main)
+  {
+    uint64_t wall = wall_time();
+    m_stats->m_wall[m_phase] += wall - m_wall;
+    m_wall = wall;
+  }
+}
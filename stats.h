@@ -0,0 +1,95 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+/// @file stats.h
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details
+
+// $Id$
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+/// The parts of a run which are timed separately
+typedef enum
+{
+  PHASE_LOAD,
+  PHASE_WALK,
+  PHASE_HASH,
+  PHASE_COMPARE,
+  PHASE_COUNT
+} phase_t;
+
+/// @brief What a run did and where its time went, for --stats
+///
+/// The counters may be updated from several threads at once.
+class RunStats
+{
+ public:
+  /// Starts the clock for the whole run. Must be created on the main
+  /// thread.
+  RunStats();
+
+  std::atomic<uint64_t> files_hashed;
+  /// Files which were left out because of their size or name
+  std::atomic<uint64_t> files_skipped;
+  std::atomic<uint64_t> files_failed;
+  std::atomic<uint64_t> bytes_read;
+
+  /// Pairs of signatures which were compared, and how many of those were
+  /// rejected by their block sizes before comparing the hashes
+  std::atomic<uint64_t> comparisons;
+  std::atomic<uint64_t> comparisons_rejected;
+  /// Pairs which didn't need to be compared, because the LSH index left
+  /// them out or an identical signature had already been scored
+  std::atomic<uint64_t> comparisons_skipped;
+  /// Pairs of signatures which matched
+  std::atomic<uint64_t> matches;
+
+  /// Writes everything to stderr as a JSON object
+  void report(void);
+
+ private:
+  RunStats(const RunStats&);
+  RunStats& operator=(const RunStats&);
+
+  friend class StatsPhase;
+
+  std::thread::id m_main;
+  uint64_t        m_start;
+  /// Wall-clock time on the main thread and CPU time on all threads
+  /// for each phase, in nanoseconds
+  std::atomic<uint64_t> m_wall[PHASE_COUNT];
+  std::atomic<uint64_t> m_cpu[PHASE_COUNT];
+};
+
+
+/// @brief Charges the time until it is destroyed to a phase
+///
+/// Phases nest, and the time spent in an inner phase isn't charged to the
+/// outer one. Wall-clock time is only counted on the main thread, where
+/// the phases add up to the length of the run; CPU time is counted on
+/// every thread. Does nothing if stats is NULL.
+class StatsPhase
+{
+ public:
+  StatsPhase(RunStats * stats, phase_t phase);
+  ~StatsPhase();
+
+ private:
+  StatsPhase(const StatsPhase&);
+  StatsPhase& operator=(const StatsPhase&);
+
+  RunStats   * m_stats;
+  phase_t      m_phase;
+  bool         m_main;
+  /// The phase this one is inside of, on this thread
+  StatsPhase * m_outer;
+  /// When the time not yet charged to this phase started
+  uint64_t     m_wall, m_cpu;
+
+  /// Charges the time since m_wall and m_cpu and restarts them
+  void charge(void);
+};
+
+#endif  // ifndef __STATS_H
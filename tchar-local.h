@@ -50,6 +50,8 @@
 
 #define  _tgetcwd   getcwd
 #define  _tfopen    fopen
+#define  _topen     open
+#define  _fstat     fstat
 #define  _fgetts    fgets
 
 #define  _topendir  opendir
@@ -61,6 +63,7 @@
 #define  _tcslen    strlen
 #define  _tcsnicmp  strncasecmp
 #define  _tcsncmp   strncmp
+#define  _tcschr    strchr
 #define  _tcsrchr   strrchr
 #define  _tmemmove  memmove
 #define  _tcsdup    strdup
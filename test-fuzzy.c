@@ -0,0 +1,806 @@
+/* Regression tests for the fuzzy hashing library
+ * Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+ *
+ * A corpus is made from a seeded random number generator, so that it is
+ * the same on every machine: random data, text with edited variants,
+ * data with little information in it, and sizes on both sides of the
+ * block size boundaries. Every entry is hashed in each of the ways the
+ * library offers, which must all give the same digest, and every pair of
+ * digests is scored both by fuzzy_compare and by a plain implementation
+ * of the scoring rules here, which must agree. Then the whole corpus is
+ * hashed and scored again by several threads at once, which must get the
+ * same results as a single thread did.
+ *
+ * The digests, and the scores of the entries which are related, are
+ * written to standard output. test-fuzzy.sh compares them with the ones
+ * in test-fuzzy.exp, so that a change to the engine which changes any of
+ * them is caught.
+ *
+ * With --write DIR the corpus is written to DIR instead, one file per
+ * entry, for testing ssdeep itself.
+ */
+
+// $Id$
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "fuzzy.h"
+#include "edit_dist.h"
+
+#define SEED  UINT64_C(0x5eed5eed5eed5eed)
+
+#define ROLLING_WINDOW  7
+#define MIN_BLOCKSIZE   3
+
+#define FUZZY_BS(index)  ((uint_least64_t)MIN_BLOCKSIZE << (index))
+#define FUZZY_TOTAL_SIZE_MAX \
+  (FUZZY_BS(FUZZY_NUM_BLOCKHASHES - 1) * SPAMSUM_LENGTH)
+
+// The largest block size boundary the corpus has data around
+#define EDGE_INDEX_MAX  13
+
+#define MAX_ENTRIES  128
+
+// Number of pairs of made up signatures to score
+#define RANDOM_PAIRS  20000
+
+// Most pieces an entry is cut into to hash it with fuzzy_hash_iov
+#define MAX_IOV  16
+
+// Number of threads hashing and scoring the corpus at once
+#define STRESS_THREADS  8
+
+typedef struct
+{
+  char            name[32];
+  unsigned char * data;
+  size_t          size;
+  char            digest[FUZZY_MAX_RESULT];
+} entry_t;
+
+static entry_t entries[MAX_ENTRIES];
+static size_t  num_entries = 0;
+static int     failures = 0;
+
+
+static uint64_t rng_state = SEED;
+
+/// xorshift64*, which is the same everywhere and good enough for this
+static uint64_t rng_next(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+static size_t rng_below(size_t n)
+{
+  return (size_t)(rng_next() % n);
+}
+
+
+static void fail(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "test-fuzzy: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  ++failures;
+}
+
+
+static void *xmalloc(size_t size)
+{
+  void *p = malloc(size ? size : 1);
+  if (NULL == p)
+  {
+    fprintf(stderr, "test-fuzzy: Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+static entry_t *add_entry(const char *name, size_t size)
+{
+  if (num_entries == MAX_ENTRIES)
+  {
+    fprintf(stderr, "test-fuzzy: Too many entries\n");
+    exit(EXIT_FAILURE);
+  }
+
+  entry_t *e = &entries[num_entries++];
+  snprintf(e->name, sizeof(e->name), "%s", name);
+  e->data = xmalloc(size);
+  e->size = size;
+  return e;
+}
+
+
+static void fill_random(unsigned char *p, size_t size)
+{
+  size_t i;
+  for (i = 0; i < size; ++i)
+    p[i] = (unsigned char)rng_next();
+}
+
+
+/// Fills p with words separated by spaces and newlines, which is more like
+/// the data fuzzy hashing is used on than random bytes are
+static void fill_text(unsigned char *p, size_t size)
+{
+  static const char *words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as",
+    "was", "with", "be", "by", "on", "not", "he", "this", "are", "or",
+    "his", "from", "at", "which", "but", "have", "an", "had", "they",
+    "you", "were", "their", "one", "all", "we", "can", "her", "has",
+    "there", "been", "if", "more", "when", "will", "would", "who", "so",
+    "no", "hash", "block", "signature", "file", "piece", "rolling",
+    "window", "digest", "score", "match", "known", "fuzzy", "size", "data"
+  };
+  size_t i = 0;
+
+  while (i < size)
+  {
+    const char *w = words[rng_below(sizeof(words) / sizeof(words[0]))];
+    size_t len = strlen(w);
+    if (len > size - i)
+      len = size - i;
+    memcpy(p + i, w, len);
+    i += len;
+    if (i < size)
+      p[i++] = (rng_below(12) ? ' ' : '\n');
+  }
+}
+
+
+static entry_t *add_copy(const char *name, const entry_t *from)
+{
+  entry_t *e = add_entry(name, from->size);
+  memcpy(e->data, from->data, from->size);
+  return e;
+}
+
+
+static void make_corpus(void)
+{
+  static const size_t random_sizes[] = {
+    0, 1, 6, 7, 8, 63, 64, 65, 100, 1000, 4096, 10000, 65536, 100000,
+    1048576
+  };
+  char name[32];
+  size_t i;
+  entry_t *e;
+
+  for (i = 0; i < sizeof(random_sizes) / sizeof(random_sizes[0]); ++i)
+  {
+    snprintf(name, sizeof(name), "random-%zu", random_sizes[i]);
+    e = add_entry(name, random_sizes[i]);
+    fill_random(e->data, e->size);
+  }
+
+  // The block size of a digest depends on whether the input is larger
+  // than FUZZY_BS(i) * SPAMSUM_LENGTH. The three entries around each
+  // boundary share their data, so their scores are worth pinning too.
+  for (i = 0; i <= EDGE_INDEX_MAX; ++i)
+  {
+    size_t size = (size_t)FUZZY_BS(i) * SPAMSUM_LENGTH;
+    entry_t *above;
+
+    snprintf(name, sizeof(name), "edge-%zu-above", i);
+    above = add_entry(name, size + 1);
+    fill_text(above->data, above->size);
+
+    snprintf(name, sizeof(name), "edge-%zu", i);
+    e = add_copy(name, above);
+    e->size = size;
+
+    snprintf(name, sizeof(name), "edge-%zu-below", i);
+    e = add_copy(name, above);
+    e->size = size - 1;
+  }
+
+  e = add_entry("zeros", 100000);
+  memset(e->data, 0, e->size);
+
+  e = add_entry("pattern", 50000);
+  for (i = 0; i < e->size; ++i)
+    e->data[i] = "abc"[i % 3];
+
+  // A text and edited versions of it
+  entry_t *text = add_entry("text", 200000);
+  fill_text(text->data, text->size);
+
+  e = add_copy("text-flip", text);
+  e->data[e->size / 2] ^= 0x20;
+
+  e = add_copy("text-scatter", text);
+  for (i = 0; i < 100; ++i)
+    e->data[rng_below(e->size)] = (unsigned char)rng_next();
+
+  e = add_entry("text-insert", text->size + 1000);
+  memcpy(e->data, text->data, text->size / 3);
+  fill_text(e->data + text->size / 3, 1000);
+  memcpy(e->data + text->size / 3 + 1000,
+	 text->data + text->size / 3,
+	 text->size - text->size / 3);
+
+  e = add_entry("text-delete", text->size - 5000);
+  memcpy(e->data, text->data, text->size * 2 / 3);
+  memcpy(e->data + text->size * 2 / 3,
+	 text->data + text->size * 2 / 3 + 5000,
+	 text->size - text->size * 2 / 3 - 5000);
+
+  e = add_copy("text-half", text);
+  e->size = text->size / 2;
+
+  e = add_entry("text-append", text->size + 20000);
+  memcpy(e->data, text->data, text->size);
+  fill_text(e->data + text->size, 20000);
+
+  e = add_entry("text-double", text->size * 2);
+  memcpy(e->data, text->data, text->size);
+  memcpy(e->data + text->size, text->data, text->size);
+
+  e = add_entry("text-tail", text->size - 10000);
+  memcpy(e->data, text->data + 10000, e->size);
+
+  e = add_entry("text-swap", text->size);
+  memcpy(e->data, text->data + text->size / 2, text->size - text->size / 2);
+  memcpy(e->data + text->size - text->size / 2, text->data, text->size / 2);
+}
+
+
+/// Feeds data to state in pieces of random sizes
+static bool update_pieces(struct fuzzy_state *state,
+			  const unsigned char *data,
+			  size_t size)
+{
+  while (size > 0)
+  {
+    size_t n = 1 + rng_below(size < 100000 ? size : 100000);
+    if (fuzzy_update(state, data, n) < 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+
+static void check_digest(const entry_t *e, const char *how, const char *digest)
+{
+  if (strcmp(e->digest, digest))
+    fail("%s: %s gives %s instead of %s", e->name, how, digest, e->digest);
+}
+
+
+/// Hashes e in every way there is, which must all give the same digest
+static void hash_entry(entry_t *e, struct fuzzy_state *reused)
+{
+  char digest[FUZZY_MAX_RESULT];
+  struct fuzzy_state *state, *clone;
+  FILE *handle;
+
+  if (fuzzy_hash_buf(e->data, (uint32_t)e->size, e->digest))
+  {
+    fail("%s: fuzzy_hash_buf failed", e->name);
+    return;
+  }
+
+  if (fuzzy_hash_buffer(e->data, e->size, digest))
+    fail("%s: fuzzy_hash_buffer failed", e->name);
+  else
+    check_digest(e, "fuzzy_hash_buffer", digest);
+
+  // In pieces of random sizes, some of them empty
+  {
+    struct fuzzy_iovec iov[MAX_IOV];
+    size_t n = 1 + rng_below(MAX_IOV), done = 0, i;
+    for (i = 0; i < n; ++i)
+    {
+      iov[i].base = e->data + done;
+      iov[i].len = (i == n - 1 ? e->size - done : rng_below(e->size - done + 1));
+      done += iov[i].len;
+    }
+    if (fuzzy_hash_iov(iov, n, digest))
+      fail("%s: fuzzy_hash_iov failed", e->name);
+    else
+      check_digest(e, "fuzzy_hash_iov", digest);
+  }
+
+  // Without knowing the size first
+  state = fuzzy_new();
+  if (NULL == state)
+  {
+    fail("%s: fuzzy_new failed", e->name);
+    return;
+  }
+  if (!update_pieces(state, e->data, e->size) ||
+      fuzzy_digest(state, digest, 0) < 0)
+    fail("%s: Streaming failed", e->name);
+  else
+    check_digest(e, "Streaming", digest);
+  fuzzy_free(state);
+
+  // Knowing the size first, with a state used for every entry
+  fuzzy_reset(reused);
+  if (fuzzy_set_total_input_length(reused, e->size) < 0 ||
+      !update_pieces(reused, e->data, e->size) ||
+      fuzzy_digest(reused, digest, 0) < 0)
+    fail("%s: Hashing with a fixed size failed", e->name);
+  else
+    check_digest(e, "Hashing with a fixed size", digest);
+
+  // One byte at a time, for the entries small enough to be quick
+  if (e->size <= 100000)
+  {
+    size_t i;
+    state = fuzzy_new();
+    for (i = 0; i < e->size; ++i)
+      fuzzy_update(state, e->data + i, 1);
+    if (fuzzy_digest(state, digest, 0) < 0)
+      fail("%s: Hashing one byte at a time failed", e->name);
+    else
+      check_digest(e, "Hashing one byte at a time", digest);
+    fuzzy_free(state);
+  }
+
+  // A copy of a state half way through goes on the same way
+  state = fuzzy_new();
+  fuzzy_update(state, e->data, e->size / 2);
+  clone = fuzzy_clone(state);
+  if (NULL == clone)
+    fail("%s: fuzzy_clone failed", e->name);
+  else
+  {
+    fuzzy_update(clone, e->data + e->size / 2, e->size - e->size / 2);
+    if (fuzzy_digest(clone, digest, 0) < 0)
+      fail("%s: Hashing a copy of a state failed", e->name);
+    else
+      check_digest(e, "Hashing a copy of a state", digest);
+    fuzzy_free(clone);
+  }
+  fuzzy_free(state);
+
+  // Files, which are read with and without their size
+  handle = tmpfile();
+  if (NULL == handle ||
+      fwrite(e->data, 1, e->size, handle) != e->size ||
+      fflush(handle))
+    fail("%s: Unable to write a temporary file", e->name);
+  else
+  {
+    rewind(handle);
+    if (fuzzy_hash_stream(handle, digest))
+      fail("%s: fuzzy_hash_stream failed", e->name);
+    else
+      check_digest(e, "fuzzy_hash_stream", digest);
+
+    if (fuzzy_hash_file(handle, digest))
+      fail("%s: fuzzy_hash_file failed", e->name);
+    else
+      check_digest(e, "fuzzy_hash_file", digest);
+  }
+  if (handle)
+    fclose(handle);
+}
+
+
+/// Copies the part of sig up to end into out, leaving out the fourth and
+/// later characters of any run of the same character
+///
+/// @return Returns the length of the part, or -1 if it's too long
+static int eliminate_sequences(char *out, const char **sig, char end)
+{
+  int len = 0;
+  for (; **sig && **sig != end; ++*sig)
+  {
+    char c = **sig;
+    if (len >= 3 && out[len - 1] == c && out[len - 2] == c && out[len - 3] == c)
+      continue;
+    if (len == SPAMSUM_LENGTH)
+      return -1;
+    out[len++] = c;
+  }
+  return len;
+}
+
+
+static bool common_substring(const char *s1, int len1, const char *s2, int len2)
+{
+  int i, j;
+  for (i = 0; i + ROLLING_WINDOW <= len1; ++i)
+    for (j = 0; j + ROLLING_WINDOW <= len2; ++j)
+      if (!memcmp(s1 + i, s2 + j, ROLLING_WINDOW))
+	return true;
+  return false;
+}
+
+
+static uint32_t reference_score_strings(const char *s1, int len1,
+					const char *s2, int len2,
+					unsigned long block_size)
+{
+  uint32_t score, minlen = (uint32_t)(len1 < len2 ? len1 : len2);
+
+  if (!common_substring(s1, len1, s2, len2))
+    return 0;
+
+  score = (uint32_t)edit_distn(s1, len1, s2, len2);
+  score = score * SPAMSUM_LENGTH / (uint32_t)(len1 + len2);
+  score = 100 * score / SPAMSUM_LENGTH;
+  score = 100 - score;
+
+  // Small block sizes don't get to claim a large match
+  if (block_size >= (99 + ROLLING_WINDOW) / ROLLING_WINDOW * MIN_BLOCKSIZE)
+    return score;
+  if (score > block_size / MIN_BLOCKSIZE * minlen)
+    score = block_size / MIN_BLOCKSIZE * minlen;
+  return score;
+}
+
+
+/// The rules fuzzy_compare follows, without any of the ways it has of
+/// following them faster
+static int reference_compare(const char *sig1, const char *sig2)
+{
+  char a1[SPAMSUM_LENGTH], a2[SPAMSUM_LENGTH];
+  char b1[SPAMSUM_LENGTH], b2[SPAMSUM_LENGTH];
+  int a1len, a2len, b1len, b2len;
+  unsigned long bs1, bs2;
+  char *end;
+
+  bs1 = strtoul(sig1, &end, 10);
+  if (end == sig1 || *end != ':')
+    return -1;
+  sig1 = end + 1;
+  bs2 = strtoul(sig2, &end, 10);
+  if (end == sig2 || *end != ':')
+    return -1;
+  sig2 = end + 1;
+
+  if (bs1 != bs2 && bs1 * 2 != bs2 && bs2 * 2 != bs1)
+    return 0;
+
+  if ((a1len = eliminate_sequences(a1, &sig1, ':')) < 0 || !*sig1++ ||
+      (a2len = eliminate_sequences(a2, &sig1, ',')) < 0 ||
+      (b1len = eliminate_sequences(b1, &sig2, ':')) < 0 || !*sig2++ ||
+      (b2len = eliminate_sequences(b2, &sig2, ',')) < 0)
+    return -1;
+
+  if (bs1 == bs2 && a1len == b1len && a2len == b2len &&
+      !memcmp(a1, b1, a1len) && !memcmp(a2, b2, a2len))
+    return 100;
+
+  if (bs1 == bs2)
+  {
+    uint32_t first  = reference_score_strings(a1, a1len, b1, b1len, bs1);
+    uint32_t second = reference_score_strings(a2, a2len, b2, b2len, bs1 * 2);
+    return (int)(first > second ? first : second);
+  }
+  if (bs1 * 2 == bs2)
+    return (int)reference_score_strings(b1, b1len, a2, a2len, bs2);
+  return (int)reference_score_strings(a1, a1len, b2, b2len, bs1);
+}
+
+
+static int check_compare(const char *sig1, const char *sig2)
+{
+  int score = fuzzy_compare(sig1, sig2);
+  int expected = reference_compare(sig1, sig2);
+  if (score != expected)
+    fail("%s and %s score %d instead of %d", sig1, sig2, score, expected);
+  return score;
+}
+
+
+/// Makes up a signature from a few characters, so that pairs of them often
+/// have something in common and runs of the same character
+static void random_signature(char *sig)
+{
+  static const char b64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t symbols = 2 + rng_below(6), offset = rng_below(64 - symbols);
+  size_t len1 = rng_below(SPAMSUM_LENGTH + 8), len2 = rng_below(SPAMSUM_LENGTH / 2 + 1);
+  size_t i;
+
+  sig += sprintf(sig, "%lu:", (unsigned long)FUZZY_BS(rng_below(4)));
+  for (i = 0; i < len1; ++i)
+    *sig++ = b64[offset + rng_below(symbols)];
+  *sig++ = ':';
+  for (i = 0; i < len2; ++i)
+    *sig++ = b64[offset + rng_below(symbols)];
+  *sig = 0;
+}
+
+
+static void check_api(void)
+{
+  char digest[FUZZY_MAX_RESULT];
+  struct fuzzy_state *state = fuzzy_new();
+
+  if (fuzzy_set_total_input_length(state, FUZZY_TOTAL_SIZE_MAX) < 0)
+    fail("The largest size was refused");
+  fuzzy_reset(state);
+  errno = 0;
+  if (fuzzy_set_total_input_length(state, FUZZY_TOTAL_SIZE_MAX + 1) != -1 ||
+      errno != EOVERFLOW)
+    fail("A size larger than the largest was accepted");
+
+  // The data must be as long as promised
+  fuzzy_reset(state);
+  fuzzy_set_total_input_length(state, 100);
+  fuzzy_update(state, entries[0].data, 0);
+  errno = 0;
+  if (fuzzy_digest(state, digest, 0) != -1 || errno != EINVAL)
+    fail("Hashing less data than promised succeeded");
+
+  fuzzy_reset(state);
+  fuzzy_set_total_input_length(state, 100);
+  errno = 0;
+  if (fuzzy_set_total_input_length(state, 200) != -1 || errno != EINVAL)
+    fail("The size was changed after it was set");
+
+  // fuzzy_reset gives the same state as fuzzy_new, even after an error
+  fuzzy_reset(state);
+  if (fuzzy_digest(state, digest, 0) < 0 || strcmp(digest, "3::"))
+    fail("A reset state has the digest %s", digest);
+  fuzzy_free(state);
+
+  // Pieces which add up to too much are refused before they are read
+  {
+    struct fuzzy_iovec iov[2];
+    iov[0].base = iov[1].base = entries[0].data;
+    iov[0].len = iov[1].len = SIZE_MAX;
+    errno = 0;
+    if (fuzzy_hash_iov(iov, 2, digest) != -1 || errno != EOVERFLOW)
+      fail("Hashing more data than the largest size succeeded");
+  }
+
+  if (fuzzy_compare(NULL, "3:abc:def") != -1 ||
+      fuzzy_compare("3:abc:def", NULL) != -1)
+    fail("Comparing with NULL didn't fail");
+  if (check_compare("3:abc", "3:abc:def") != -1 ||
+      check_compare("x:abc:def", "3:abc:def") != -1)
+    fail("Comparing a bad signature didn't fail");
+  if (check_compare("3:abcdefgh:ijk", "3:abcdefgh:ijk") != 100)
+    fail("Identical signatures don't score 100");
+}
+
+
+#ifdef HAVE_PTHREAD_H
+typedef struct
+{
+  pthread_t thread;
+  size_t    index;
+  size_t    mismatches;
+} stress_t;
+
+// The scores of every pair of entries, from a single thread
+static int stress_scores[MAX_ENTRIES][MAX_ENTRIES];
+
+
+/// Hashes and scores the corpus, starting at a different entry and
+/// feeding the data in pieces of a different size in every thread
+static void *stress_thread(void *arg)
+{
+  stress_t *self = arg;
+  struct fuzzy_state *state = fuzzy_new();
+  size_t piece = 4096 + self->index * 1237;
+  size_t n, i, j;
+
+  for (n = 0; n < num_entries; ++n)
+  {
+    const entry_t *e;
+    char digest[FUZZY_MAX_RESULT];
+
+    i = (n + self->index * num_entries / STRESS_THREADS) % num_entries;
+    e = &entries[i];
+
+    if ((i + self->index) % 2)
+    {
+      if (fuzzy_hash_buf(e->data, (uint32_t)e->size, digest))
+	digest[0] = 0;
+    }
+    else
+    {
+      size_t done;
+      fuzzy_reset(state);
+      for (done = 0; done < e->size; done += piece)
+	fuzzy_update(state, e->data + done,
+		     e->size - done < piece ? e->size - done : piece);
+      if (fuzzy_digest(state, digest, 0) < 0)
+	digest[0] = 0;
+    }
+    if (strcmp(digest, e->digest))
+      ++self->mismatches;
+
+    for (j = 0; j < num_entries; ++j)
+      if (fuzzy_compare(e->digest, entries[j].digest) != stress_scores[i][j])
+	++self->mismatches;
+  }
+
+  fuzzy_free(state);
+  return NULL;
+}
+#endif
+
+
+/// Checks that threads hashing and scoring at once don't disturb each other
+static void check_threads(void)
+{
+#ifdef HAVE_PTHREAD_H
+  stress_t threads[STRESS_THREADS];
+  size_t i, j, started;
+
+  for (i = 0; i < num_entries; ++i)
+    for (j = 0; j < num_entries; ++j)
+      stress_scores[i][j] = fuzzy_compare(entries[i].digest, entries[j].digest);
+
+  for (started = 0; started < STRESS_THREADS; ++started)
+  {
+    threads[started].index = started;
+    threads[started].mismatches = 0;
+    if (pthread_create(&threads[started].thread, NULL,
+		       stress_thread, &threads[started]))
+    {
+      fail("Unable to start a thread");
+      break;
+    }
+  }
+
+  for (i = 0; i < started; ++i)
+  {
+    pthread_join(threads[i].thread, NULL);
+    if (threads[i].mismatches)
+      fail("Thread %zu got %zu results which differ from a single thread's",
+	   i, threads[i].mismatches);
+  }
+#endif
+}
+
+
+static int write_corpus(const char *dir)
+{
+  size_t i, fn_size = strlen(dir) + sizeof(entries[0].name) + 1;
+  char *fn = xmalloc(fn_size);
+
+  for (i = 0; i < num_entries; ++i)
+  {
+    FILE *handle;
+    snprintf(fn, fn_size, "%s/%s", dir, entries[i].name);
+    handle = fopen(fn, "wb");
+    if (NULL == handle ||
+	fwrite(entries[i].data, 1, entries[i].size, handle) != entries[i].size ||
+	fclose(handle))
+    {
+      fprintf(stderr, "test-fuzzy: %s: %s\n", fn, strerror(errno));
+      free(fn);
+      return EXIT_FAILURE;
+    }
+  }
+
+  free(fn);
+  return EXIT_SUCCESS;
+}
+
+
+static const entry_t *find_entry(const char *name)
+{
+  size_t i;
+  for (i = 0; i < num_entries; ++i)
+    if (!strcmp(entries[i].name, name))
+      return &entries[i];
+  return NULL;
+}
+
+
+static void print_score(const char *name1, const char *name2)
+{
+  const entry_t *a = find_entry(name1), *b = find_entry(name2);
+  printf("score %s %s %d\n", a->name, b->name, check_compare(a->digest, b->digest));
+}
+
+
+int main(int argc, char **argv)
+{
+  static const char *variants[] = {
+    "text-flip", "text-scatter", "text-insert", "text-delete", "text-half",
+    "text-append", "text-double", "text-tail", "text-swap"
+  };
+  struct fuzzy_state *reused;
+  char name1[32], name2[32];
+  size_t i, j;
+
+  make_corpus();
+
+  if (3 == argc && !strcmp(argv[1], "--write"))
+    return write_corpus(argv[2]);
+  if (argc != 1)
+  {
+    fprintf(stderr, "Usage: test-fuzzy [--write DIR]\n");
+    return EXIT_FAILURE;
+  }
+
+  reused = fuzzy_new();
+  for (i = 0; i < num_entries; ++i)
+  {
+    hash_entry(&entries[i], reused);
+    printf("digest %s %s\n", entries[i].name, entries[i].digest);
+  }
+  fuzzy_free(reused);
+
+  // The other ways of writing a digest, for a few entries
+  for (i = 0; i < num_entries; ++i)
+  {
+    char digest[FUZZY_MAX_RESULT];
+    struct fuzzy_state *state;
+    const entry_t *e = &entries[i];
+
+    if (strncmp(e->name, "text", 4) && strcmp(e->name, "zeros") &&
+	strcmp(e->name, "pattern"))
+      continue;
+
+    state = fuzzy_new();
+    fuzzy_update(state, e->data, e->size);
+    if (fuzzy_digest(state, digest, FUZZY_FLAG_ELIMSEQ) == 0)
+      printf("digest-elimseq %s %s\n", e->name, digest);
+    if (fuzzy_digest(state, digest, FUZZY_FLAG_NOTRUNC) == 0)
+      printf("digest-notrunc %s %s\n", e->name, digest);
+    fuzzy_free(state);
+  }
+
+  for (i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i)
+  {
+    print_score("text", variants[i]);
+    print_score(variants[i], "text");
+  }
+  for (i = 0; i <= EDGE_INDEX_MAX; ++i)
+  {
+    snprintf(name1, sizeof(name1), "edge-%zu-below", i);
+    snprintf(name2, sizeof(name2), "edge-%zu", i);
+    print_score(name1, name2);
+    snprintf(name1, sizeof(name1), "edge-%zu-above", i);
+    print_score(name2, name1);
+  }
+
+  // Every pair of digests is scored the same way by the reference
+  for (i = 0; i < num_entries; ++i)
+    for (j = 0; j < num_entries; ++j)
+      check_compare(entries[i].digest, entries[j].digest);
+
+  for (i = 0; i < RANDOM_PAIRS; ++i)
+  {
+    char sig1[FUZZY_MAX_RESULT + 16], sig2[FUZZY_MAX_RESULT + 16];
+    random_signature(sig1);
+    random_signature(sig2);
+    check_compare(sig1, sig2);
+  }
+
+  check_api();
+  check_threads();
+
+  for (i = 0; i < num_entries; ++i)
+    free(entries[i].data);
+
+  if (failures)
+    fprintf(stderr, "test-fuzzy: %d failures\n", failures);
+  return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
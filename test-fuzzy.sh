@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Checks that the digests and scores of the corpus made by test-fuzzy
+# are still the ones in test-fuzzy.exp. If a change to the library is
+# meant to change them, regenerate the file with
+#
+#   ./test-fuzzy > $srcdir/test-fuzzy.exp
+#
+# and say why in the commit; every signature stored so far changes with it.
+#
+# test-fuzzy also hashes and scores the corpus from several threads at
+# once. To look for data races in the library too, build it with
+# ThreadSanitizer:
+#
+#   ./configure CC=clang CXX=clang++ CFLAGS="-g -O1 -fsanitize=thread" \
+#     CXXFLAGS="-g -O1 -fsanitize=thread" LDFLAGS=-fsanitize=thread
+#   make check
+#
+# $Id$
+
+srcdir=${srcdir:-.}
+
+./test-fuzzy > test-fuzzy.out || exit 1
+if ! diff -u "$srcdir/test-fuzzy.exp" test-fuzzy.out; then
+  echo "test-fuzzy.sh: The digests or scores have changed" >&2
+  exit 1
+fi
+rm -f test-fuzzy.out
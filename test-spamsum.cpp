@@ -0,0 +1,129 @@
+// Checks that FuzzyEngine gives the same results as libfuzzy
+// Copyright (C) 2026 The ssdeep Project. See COPYING for details.
+//
+// Hashes each of the files named on the command line with fuzzy_hash_buf
+// and with FuzzyEngine, feeding the engine the data in pieces of several
+// sizes and reusing it from one file to the next, and then scores every
+// pair of the digests with fuzzy_compare and FuzzyEngine::compare. Any
+// difference is a failure. test-spamsum.sh runs it on the corpus made by
+// test-fuzzy.
+
+// $Id$
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "spamsum.h"
+
+static int failures = 0;
+
+static bool read_file(const char * fn, std::vector<unsigned char>& data)
+{
+  FILE * handle = fopen(fn, "rb");
+  if (NULL == handle)
+    return true;
+
+  unsigned char buffer[65536];
+  size_t got;
+  data.clear();
+  while ((got = fread(buffer, 1, sizeof(buffer), handle)) > 0)
+    data.insert(data.end(), buffer, buffer + got);
+
+  bool status = (ferror(handle) != 0);
+  fclose(handle);
+  return status;
+}
+
+
+/// Hashes data with engine, piece bytes at a time, into digest
+static bool hash_engine(FuzzyEngine& engine,
+			const std::vector<unsigned char>& data,
+			size_t piece,
+			char * digest)
+{
+  engine.reset();
+  if (engine.set_total_input_length(data.size()))
+    return true;
+  for (size_t i = 0 ; i < data.size() ; i += piece)
+    engine.update(data.data() + i,
+		  (piece < data.size() - i) ? piece : data.size() - i);
+  return engine.digest(digest);
+}
+
+
+int main(int argc, char **argv)
+{
+  static const size_t pieces[] = { 1, 7, 64, 4093, SIZE_MAX };
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: test-spamsum FILES\n");
+    return EXIT_FAILURE;
+  }
+
+  FuzzyEngine engine;
+  std::vector<std::string> digests;
+  std::vector<unsigned char> data;
+
+  for (int i = 1 ; i < argc ; ++i)
+  {
+    if (read_file(argv[i], data))
+    {
+      fprintf(stderr, "test-spamsum: %s: %s\n", argv[i], strerror(errno));
+      return EXIT_FAILURE;
+    }
+
+    char expected[FUZZY_MAX_RESULT];
+    if (fuzzy_hash_buf(data.data(), (uint32_t)data.size(), expected))
+    {
+      fprintf(stderr, "test-spamsum: %s: fuzzy_hash_buf failed\n", argv[i]);
+      ++failures;
+      continue;
+    }
+    digests.push_back(expected);
+
+    for (size_t j = 0 ; j < sizeof(pieces) / sizeof(pieces[0]) ; ++j)
+    {
+      char digest[FUZZY_MAX_RESULT];
+      if (hash_engine(engine, data, pieces[j], digest))
+      {
+	fprintf(stderr, "test-spamsum: %s: FuzzyEngine failed\n", argv[i]);
+	++failures;
+      }
+      else if (strcmp(digest, expected))
+      {
+	fprintf(stderr,
+		"test-spamsum: %s: FuzzyEngine gives %s in pieces of %zu, "
+		"fuzzy_hash_buf gives %s\n",
+		argv[i], digest, pieces[j], expected);
+	++failures;
+      }
+    }
+  }
+
+  for (size_t i = 0 ; i < digests.size() ; ++i)
+    for (size_t j = 0 ; j < digests.size() ; ++j)
+    {
+      const char * a = digests[i].c_str(), * b = digests[j].c_str();
+      int expected = fuzzy_compare(a, b), score = FuzzyEngine::compare(a, b);
+      if (score != expected)
+      {
+	fprintf(stderr,
+		"test-spamsum: FuzzyEngine scores %s and %s as %d, "
+		"fuzzy_compare as %d\n",
+		a, b, score, expected);
+	++failures;
+      }
+    }
+
+  if (failures)
+    fprintf(stderr, "test-spamsum: %d failures\n", failures);
+  return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+#
+# Checks that FuzzyEngine, which ssdeep hashes and compares with, gives
+# the same digests and scores as libfuzzy for the corpus made by
+# test-fuzzy.
+#
+# $Id$
+
+DIR=test-spamsum.dir
+
+rm -rf $DIR
+mkdir $DIR || exit 1
+./test-fuzzy --write $DIR || exit 1
+./test-spamsum $DIR/* || exit 1
+rm -rf $DIR
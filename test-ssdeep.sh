@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+# Checks that ssdeep gives the digests and scores pinned in test-fuzzy.exp
+# for the corpus made by test-fuzzy, and that the ways of running it which
+# shouldn't change its output don't.
+#
+# $Id$
+
+srcdir=${srcdir:-.}
+EXPECTED="$srcdir/test-fuzzy.exp"
+DIR=test-ssdeep.dir
+
+# ssdeep isn't built with --enable-libonly
+test -x ./ssdeep || exit 77
+
+fail()
+{
+  echo "test-ssdeep.sh: $*" >&2
+  exit 1
+}
+
+rm -rf $DIR
+mkdir $DIR $DIR/corpus || exit 1
+./test-fuzzy --write $DIR/corpus || fail "Unable to write the corpus"
+
+# The digests, in the order and format of ssdeep -b
+sed -n 's/^digest \([^ ]*\) \(.*\)$/\2,"\1"/p' "$EXPECTED" | sort > $DIR/expected
+test -s $DIR/expected || fail "No digests in $EXPECTED"
+
+./ssdeep -s -b -r $DIR/corpus > $DIR/plain || fail "ssdeep failed"
+sed 1d $DIR/plain | sort > $DIR/digests
+diff -u $DIR/expected $DIR/digests || fail "ssdeep gives different digests"
+
+# Hashing on several threads, in disk order or from a list must give the
+# same output
+./ssdeep -s -b -r --threads=1 $DIR/corpus | sed 1d | sort > $DIR/threads-1
+./ssdeep -s -b -r --threads=4 $DIR/corpus | sed 1d | sort > $DIR/threads-4
+./ssdeep -s -b -r --locality $DIR/corpus | sed 1d | sort > $DIR/locality
+ls $DIR/corpus/* > $DIR/list
+./ssdeep -s -b -f $DIR/list | sed 1d | sort > $DIR/listed
+for out in threads-1 threads-4 locality listed
+do
+  cmp -s $DIR/digests $DIR/$out || fail "The output of $out is different"
+done
+
+# The members of archives of the corpus have the same digests as the
+# files, whichever archivers are there to make them
+cut -d, -f1 $DIR/digests > $DIR/sums
+(cd $DIR && tar cf corpus.tar corpus) 2>/dev/null && archives="corpus.tar"
+(cd $DIR && gzip -c corpus.tar > corpus.tar.gz) 2>/dev/null &&
+  archives="$archives corpus.tar.gz"
+(cd $DIR && zip -q -r corpus.zip corpus) 2>/dev/null && archives="$archives corpus.zip"
+for archive in $archives
+do
+  ./ssdeep -s --archives $DIR/$archive | sed 1d | cut -d, -f1 | sort |
+    cmp -s $DIR/sums - || fail "The members of $archive have different digests"
+done
+
+# The scores of the edited texts against the original
+./ssdeep -s -b $DIR/corpus/text > $DIR/text.sig || fail "ssdeep failed"
+sed -n 's/^score text \(text-[^ ]*\) \(.*\)$/\1 matches TEXT:text (\2)/p' \
+  "$EXPECTED" | sort > $DIR/expected-scores
+(cd $DIR/corpus && ../../ssdeep -s -b -a -m ../text.sig text-*) |
+  sed 's/ \.\.\/text\.sig:/ TEXT:/' | sort > $DIR/scores
+diff -u $DIR/expected-scores $DIR/scores || fail "ssdeep gives different scores"
+
+# Known hashes in the binary format give the same scores
+./ssdeep -s -b --binary $DIR/corpus/text > $DIR/text.bin || fail "ssdeep failed"
+(cd $DIR/corpus && ../../ssdeep -s -b -a -m ../text.bin text-*) |
+  sed 's/ \.\.\/text\.bin:/ TEXT:/' | sort > $DIR/binary-scores
+cmp -s $DIR/scores $DIR/binary-scores ||
+  fail "Known hashes in the binary format give different scores"
+
+# So do compressed known hashes, whichever compressors are there. A build
+# without their libraries refuses them.
+for compress in gzip zstd
+do
+  $compress -c $DIR/text.sig > $DIR/text.sig.z 2>/dev/null || continue
+  ./ssdeep -s -m $DIR/text.sig.z $DIR/corpus/text > /dev/null || continue
+  (cd $DIR/corpus && ../../ssdeep -s -b -a -m ../text.sig.z text-*) |
+    sed 's/ \.\.\/text\.sig\.z:/ TEXT:/' | sort > $DIR/$compress-scores
+  cmp -s $DIR/scores $DIR/$compress-scores ||
+    fail "Known hashes compressed with $compress give different scores"
+done
+
+# A server writes the statistics when it's stopped, after a reload has
+# replaced the known hashes it started with. Anything on stderr before
+# then means it couldn't start, as where serving isn't supported.
+./ssdeep --stats -m $DIR/text.sig --serve=$DIR/sock 2> $DIR/serve-stats &
+pid=$!
+tries=0
+while ! test -S $DIR/sock && ! test -s $DIR/serve-stats && test $tries -lt 30
+do
+  sleep 1
+  tries=$((tries + 1))
+done
+if test -S $DIR/sock
+then
+  kill -HUP $pid
+  sleep 1
+  kill -TERM $pid
+  wait $pid || fail "ssdeep --serve failed"
+  grep -q '"wall"' $DIR/serve-stats ||
+    fail "ssdeep --serve didn't write its statistics"
+else
+  kill $pid 2>/dev/null
+  wait $pid
+fi
+
+rm -rf $DIR
@@ -2,17 +2,33 @@
 /* $Id$ */
 
 #include "ssdeep.h"
+#include "output.h"
+#include "pipeline.h"
+#include "progress.h"
 #include <stdarg.h>
 
 void print_status(const char *fmt, ...)
 {
+  Output& out = stdout_output();
+  char buffer[1024];
   va_list ap;
   
   va_start(ap,fmt); 
-  vprintf(fmt,ap); 
+  int len = vsnprintf(buffer, sizeof(buffer), fmt, ap);
   va_end(ap); 
+
+  if (len >= (int)sizeof(buffer))
+  {
+    std::vector<char> big(len + 1);
+    va_start(ap,fmt);
+    vsnprintf(&big[0], big.size(), fmt, ap);
+    va_end(ap);
+    out.write(&big[0], len);
+  }
+  else if (len > 0)
+    out.write(buffer, len);
   
-  printf ("%s", NEWLINE);
+  out.newline();
 }
 
 
@@ -24,6 +40,12 @@ void print_error(const state *s, const char *fmt, ...)
   if (s->mode & mode_silent)
     return;
 
+  if (s->pipeline != NULL)
+    s->pipeline->drain();
+  stdout_output().flush();
+  if (s->progress != NULL)
+    s->progress->erase();
+
   va_list ap;
   
   va_start(ap,fmt); 
@@ -52,6 +74,11 @@ void print_error_unicode(state *s, const TCHAR *fn, const char *fmt, ...)
 
   if (!(s->mode & mode_silent))
     {
+      if (s->pipeline != NULL)
+	s->pipeline->drain();
+      stdout_output().flush();
+      if (s->progress != NULL)
+	s->progress->erase();
       display_filename(stderr, fn, false);
       fprintf(stderr,": ");
       MD5DEEP_PRINT_MSG(stderr,fmt);
@@ -65,8 +92,10 @@ void print_error_unicode(state *s, const TCHAR *fn, const char *fmt, ...)
    preferences. Besides, the program is probably crashing anyway... */
 void internal_error(const char *fmt, ... )
 {
+  stdout_output().flush();
   MD5DEEP_PRINT_MSG(stderr,fmt);  
   print_status ("%s: Internal error. Contact developer!", __progname);  
+  stdout_output().flush();
   exit (EXIT_FAILURE);
 }
 
@@ -74,6 +103,8 @@ void internal_error(const char *fmt, ... )
 
 void fatal_error(const char *fmt, ... )
 {
+  stdout_output().flush();
+
   va_list ap;
   
   va_start(ap,fmt); 
@@ -124,12 +155,134 @@ void display_filename(FILE *out, const TCHAR *fn, bool escape_quotes)
     return;
 
   len = _tcslen(fn);
-  for (pos = 0 ; pos < len ; ++pos)
+  if (!escape_quotes)
   {
-    if (escape_quotes && '"' == fn[pos])
-      _ftprintf(out, _TEXT("\\\""));
-    else
-      _ftprintf(out, _TEXT("%c"), fn[pos]);
+    fwrite(fn, 1, len, out);
+    return;
+  }
+
+  // Write everything up to each quotation mark in one go
+  for (pos = 0 ; pos < len ; )
+  {
+    const char * quote = (const char *)memchr(fn + pos, '"', len - pos);
+    size_t end = quote ? (size_t)(quote - fn) : len;
+    fwrite(fn + pos, 1, end - pos, out);
+    if (quote)
+    {
+      fputs("\\\"", out);
+      ++end;
+    }
+    pos = end;
   } 
 }
 #endif
+
+
+// ------------------------------------------------------------------
+// BUFFERED OUTPUT
+// ------------------------------------------------------------------
+
+Output::Output(FILE * stream) : m_stream(stream), m_len(0)
+{
+  int fd = fileno(stream);
+  m_line_buffered = (fd >= 0 && isatty(fd));
+}
+
+
+Output& stdout_output(void)
+{
+  static thread_local Output out(stdout);
+  return out;
+}
+
+
+void Output::write_slow(const char * s, size_t len)
+{
+  flush();
+  if (len >= OUTPUT_BUFFER_SIZE)
+    fwrite(s, 1, len, m_stream);
+  else
+  {
+    memcpy(m_buffer, s, len);
+    m_len = len;
+  }
+}
+
+
+void Output::number(unsigned int n)
+{
+  char digits[16];
+  size_t pos = sizeof(digits);
+
+  do
+  {
+    digits[--pos] = '0' + (n % 10);
+    n /= 10;
+  } while (n > 0);
+
+  write(digits + pos, sizeof(digits) - pos);
+}
+
+
+void Output::newline(void)
+{
+  write(NEWLINE, sizeof(NEWLINE) - 1);
+  if (m_line_buffered)
+    flush();
+}
+
+
+void Output::flush(void)
+{
+  if (m_len > 0)
+    fwrite(m_buffer, 1, m_len, m_stream);
+  m_len = 0;
+}
+
+
+#ifdef _WIN32
+void Output::filename(const TCHAR * fn, bool escape_quotes)
+{
+  if (NULL == fn)
+    return;
+
+  // The same as display_filename
+  size_t len = _tcslen(fn);
+  for (size_t pos = 0 ; pos < len ; ++pos)
+  {
+    if (escape_quotes && ('"' == ((fn[pos] & 0xff00) >> 16)))
+      write("\\\"", 2);
+    else if (0 == (fn[pos] & 0xff00))
+      put((char)fn[pos]);
+    else
+      put('?');
+  }
+}
+#else
+void Output::filename(const TCHAR * fn, bool escape_quotes)
+{
+  if (NULL == fn)
+    return;
+
+  size_t len = strlen(fn);
+  if (!escape_quotes)
+  {
+    write(fn, len);
+    return;
+  }
+
+  const char * end = fn + len;
+  for (;;)
+  {
+    const char * quote = (const char *)memchr(fn, '"', end - fn);
+    if (NULL == quote)
+    {
+      write(fn, end - fn);
+      return;
+    }
+    write(fn, quote - fn);
+    write("\\\"", 2);
+    fn = quote + 1;
+  }
+}
+#endif